@@ -0,0 +1,561 @@
+/**
+ * @file video_quantizer_bench.cpp
+ * @brief Micro-benchmark measuring every stage of the pipeline in isolation on synthetic frames.
+ *
+ * The host stages (encode, decode, sws_scale conversions) are timed with a steady clock, the device
+ * stages (upload, every kernel of uniformQuantization.cl, readback) with the profiling events of the queue.
+ * The results are printed as a table and can be written as CSV or JSON to track regressions.
+ */
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Dither.hpp"
+#include "OpenCLFrameProcessor.hpp"
+#include "Palette.hpp"
+#include "PlanarFrame.hpp"
+#include "ProgramBinaryCache.hpp"
+#include "ProgramCache.hpp"
+#include "QuantizationLut.hpp"
+#include "VideoReaderFFMPEG.hpp"
+#include "VideoWriterFFMPEG.hpp"
+#include "ocl_kernels.hpp"
+#include "ocl_utility.hpp"
+
+namespace {
+    /**
+     * @struct BenchConfig
+     * @brief What the benchmark runs and on which frames.
+     */
+    struct BenchConfig {
+        int width = 1920;                   ///< Width of the synthetic frames
+        int height = 1080;                  ///< Height of the synthetic frames
+        int iterations = 50;                ///< Measured runs of every stage
+        int warmup = 5;                     ///< Runs of every stage before the measured ones
+        int levels = 4;                     ///< Number of levels of the quantization kernels
+        bool specialize = true;             ///< Build the kernels with the levels as a compile-time constant
+        int palette_size = 16;              ///< Colors of the palette given to the palette kernels
+        std::string kernel_file;            ///< The file containing the OpenCL kernels, empty for the embedded ones
+        std::string program_cache;          ///< Directory of the compiled programs, empty to always build from source
+        std::string scratch_file;           ///< Video written by the encode stage and read by the decode stage
+        EncoderOptions encoder;             ///< Settings of the encode stage
+    };
+
+    /**
+     * @struct StageResult
+     * @brief Timings of a stage and the throughput derived from them.
+     */
+    struct StageResult {
+        std::string stage;                  ///< Name of the stage
+        int iterations = 0;                 ///< Number of measured runs
+        double mean_ms = 0;                 ///< Mean time of a run
+        double min_ms = 0;                  ///< Fastest run
+        double max_ms = 0;                  ///< Slowest run
+        double megapixels_per_second = 0;   ///< Pixels of a frame over the mean time, 0 for stages not working on pixels
+        double gigabytes_per_second = 0;    ///< Bytes read and written by a run over the mean time
+    };
+
+    /**
+     * @brief Summarizes the timings of a stage.
+     * @param stage The name of the stage.
+     * @param pixels The pixels handled by a run.
+     * @param bytes The bytes read and written by a run.
+     * @param times_ms The time of every measured run.
+     */
+    StageResult summarize(const std::string& stage, size_t pixels, size_t bytes, const std::vector<double>& times_ms) {
+        StageResult result;
+        result.stage = stage;
+        result.iterations = static_cast<int>(times_ms.size());
+        if (times_ms.empty()) {
+            return result;
+        }
+        double total = 0;
+        for (double time : times_ms) {
+            total += time;
+        }
+        result.mean_ms = total / times_ms.size();
+        result.min_ms = *std::min_element(times_ms.begin(), times_ms.end());
+        result.max_ms = *std::max_element(times_ms.begin(), times_ms.end());
+        if (result.mean_ms > 0) {
+            result.megapixels_per_second = pixels / (result.mean_ms * 1.0e3);
+            result.gigabytes_per_second = bytes / (result.mean_ms * 1.0e6);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Times a host function.
+     * @param config The number of warmup and measured runs.
+     * @param run The function, called once per run.
+     * @return The time of every measured run in milliseconds.
+     */
+    std::vector<double> time_host(const BenchConfig& config, const std::function<void()>& run) {
+        for (int i = 0; i < config.warmup; i++) {
+            run();
+        }
+        std::vector<double> times_ms;
+        for (int i = 0; i < config.iterations; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            run();
+            times_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return times_ms;
+    }
+
+    /**
+     * @brief Times a device command with its profiling event.
+     * @param config The number of warmup and measured runs.
+     * @param enqueue The function enqueuing the command and returning its event.
+     * @return The execution time of every measured run in milliseconds.
+     */
+    std::vector<double> time_device(const BenchConfig& config, const std::function<cl_event()>& enqueue) {
+        std::vector<double> times_ms;
+        for (int i = 0; i < config.warmup + config.iterations; i++) {
+            cl_event evt = enqueue();
+            ocl::check(clWaitForEvents(1, &evt), "Waiting for the benchmarked command");
+            if (i >= config.warmup) {
+                times_ms.push_back(ocl::runtime_ms(evt));
+            }
+            clReleaseEvent(evt);
+        }
+        return times_ms;
+    }
+
+    /**
+     * @brief Builds a BGRA frame of gradients and noise, so that neither the quantization nor the encoder see flat areas.
+     */
+    std::vector<uint8_t> synthetic_bgra(int width, int height) {
+        std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 4);
+        uint32_t state = 0x9E3779B9u;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                // xorshift noise on top of the gradients
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                uint8_t* pixel = &frame[(static_cast<size_t>(y) * width + x) * 4];
+                pixel[0] = static_cast<uint8_t>((x * 255 / std::max(1, width - 1) + (state & 15)) & 255);
+                pixel[1] = static_cast<uint8_t>((y * 255 / std::max(1, height - 1) + ((state >> 4) & 15)) & 255);
+                pixel[2] = static_cast<uint8_t>(((x + y) * 127 / std::max(1, width + height - 2) + ((state >> 8) & 63)) & 255);
+                pixel[3] = 255;
+            }
+        }
+        return frame;
+    }
+
+    /**
+     * @brief Converts the synthetic BGRA frame into a packed YUV 4:2:0 frame with swscale.
+     */
+    std::vector<uint8_t> synthetic_yuv420(const std::vector<uint8_t>& bgra, int width, int height) {
+        std::vector<uint8_t> frame(yuv420_frame_size(width, height));
+        PlanarFrame planes = make_packed_yuv420(frame.data(), width, height);
+        SwsContext* sws_ctx = sws_getContext(width, height, AV_PIX_FMT_BGRA, width, height, AV_PIX_FMT_YUV420P,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!sws_ctx) {
+            throw std::runtime_error("[THROW] synthetic_yuv420: Could not create the scaler");
+        }
+        const uint8_t* in_data[1] = { bgra.data() };
+        const int in_linesize[1] = { width * 4 };
+        sws_scale(sws_ctx, in_data, in_linesize, 0, height, planes.data, planes.linesize);
+        sws_freeContext(sws_ctx);
+        return frame;
+    }
+
+    /**
+     * @brief Measures the host stages: encoding, decoding and the swscale conversions around the backend.
+     * @param config The benchmark settings.
+     * @param bgra The synthetic BGRA frame.
+     * @param yuv420 The same frame as packed YUV 4:2:0.
+     * @param results Receives the results of the stages.
+     */
+    void bench_host(const BenchConfig& config, const std::vector<uint8_t>& bgra, const std::vector<uint8_t>& yuv420,
+        std::vector<StageResult>& results) {
+        const int width = config.width;
+        const int height = config.height;
+        const size_t pixels = static_cast<size_t>(width) * height;
+        const size_t yuv420_size = yuv420.size();
+        const PlanarFrame source = make_packed_yuv420(const_cast<uint8_t*>(yuv420.data()), width, height);
+
+        // decoded 4:2:0 planes to the RGB32 frame handed to the backend, like the reader
+        std::vector<uint8_t> rgb(pixels * 4);
+        SwsContext* to_rgb = sws_getContext(width, height, AV_PIX_FMT_YUV420P, width, height, AV_PIX_FMT_RGB32,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        // processed RGBA frame to the 4:4:4 planes of the encoder, like the writer
+        std::vector<uint8_t> yuv444(pixels * 3);
+        SwsContext* to_yuv = sws_getContext(width, height, AV_PIX_FMT_RGBA, width, height, AV_PIX_FMT_YUV444P,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!to_rgb || !to_yuv) {
+            sws_freeContext(to_rgb);
+            sws_freeContext(to_yuv);
+            throw std::runtime_error("[THROW] bench_host: Could not create the scalers");
+        }
+        results.push_back(summarize("sws_scale_to_rgb32", pixels, yuv420_size + pixels * 4, time_host(config, [&]() {
+            uint8_t* out_data[1] = { rgb.data() };
+            const int out_linesize[1] = { width * 4 };
+            sws_scale(to_rgb, source.data, source.linesize, 0, height, out_data, out_linesize);
+        })));
+        results.push_back(summarize("rgb_to_yuv444p", pixels, pixels * 4 + pixels * 3, time_host(config, [&]() {
+            const uint8_t* in_data[1] = { bgra.data() };
+            const int in_linesize[1] = { width * 4 };
+            uint8_t* out_data[3] = { yuv444.data(), yuv444.data() + pixels, yuv444.data() + 2 * pixels };
+            const int out_linesize[3] = { width, width, width };
+            sws_scale(to_yuv, in_data, in_linesize, 0, height, out_data, out_linesize);
+        })));
+        sws_freeContext(to_rgb);
+        sws_freeContext(to_yuv);
+
+        // the encoder keeps frames in flight, so the time of the final flush is spread over all the frames
+        const int frame_count = config.warmup + config.iterations;
+        std::vector<double> encode_ms;
+        auto writer = std::make_unique<VideoWriterFFMPEG>(config.scratch_file, width, height, 25, config.encoder);
+        for (int i = 0; i < frame_count; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            copy_yuv420(source, writer->acquire_frame(), width, height);
+            writer->submit_frame();
+            encode_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        const auto flush_start = std::chrono::steady_clock::now();
+        writer.reset();
+        const double flush_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - flush_start).count();
+        encode_ms.erase(encode_ms.begin(), encode_ms.begin() + config.warmup);
+        for (double& time : encode_ms) {
+            time += flush_ms / frame_count;
+        }
+        results.push_back(summarize("encode", pixels, yuv420_size, encode_ms));
+
+        // the decode stage reads back the video of the encode stage
+        VideoReaderFFMPEG reader(config.scratch_file);
+        std::vector<double> decode_ms;
+        PlanarFrame planes;
+        for (int i = 0; i < frame_count; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            if (!reader.read_next_frame_planar(planes)) {
+                break;
+            }
+            const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (i >= config.warmup) {
+                decode_ms.push_back(elapsed);
+            }
+        }
+        results.push_back(summarize("decode", pixels, yuv420_size, decode_ms));
+        std::remove(config.scratch_file.c_str());
+    }
+
+    /**
+     * @brief Measures the device stages: upload, every kernel of the kernel file and readback.
+     * @param config The benchmark settings.
+     * @param bgra The synthetic BGRA frame.
+     * @param yuv420 The same frame as packed YUV 4:2:0.
+     * @param results Receives the results of the stages.
+     */
+    void bench_device(const BenchConfig& config, const std::vector<uint8_t>& bgra, const std::vector<uint8_t>& yuv420,
+        std::vector<StageResult>& results) {
+        const cl_int width = config.width;
+        const cl_int height = config.height;
+        const size_t pixels = static_cast<size_t>(width) * height;
+        const size_t frame_size = pixels * 4;
+        const size_t yuv420_size = yuv420.size();
+
+        cl_platform_id platform = ocl::select_platform();
+        cl_device_id device = ocl::select_device(platform);
+        cl_context context = ocl::create_context(platform, device);
+        cl_command_queue queue = ocl::create_queue(context, device);
+        std::vector<StageResult> device_results;
+        {
+            ProgramCache programs(context, device, config.kernel_file, config.program_cache);
+            const int program_levels = config.specialize ? config.levels : 0;
+            auto kernel = [&](const char* name) { return programs.kernel(name, program_levels); };
+
+            size_t lws_in;
+            cl_int err = clGetKernelWorkGroupInfo(kernel("uniform_quantize_nearest"), device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                sizeof(lws_in), &lws_in, nullptr);
+            ocl::check(err, "Getting preferred work group size");
+            // the histogram and k-means kernels get a few work groups per compute unit, like in the backend
+            cl_uint compute_units;
+            err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+            ocl::check(err, "Getting compute units");
+            size_t reduction_lws = 256;
+            for (const char* name : { "bgra_color_histogram", "bgra_color_signature", "bgra_palette_accumulate" }) {
+                size_t kernel_max_lws;
+                err = clGetKernelWorkGroupInfo(kernel(name), device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_max_lws), &kernel_max_lws, nullptr);
+                ocl::check(err, "Getting reduction work group size");
+                reduction_lws = std::min(reduction_lws, kernel_max_lws);
+            }
+            const size_t reduction_gws = reduction_lws * compute_units * 4;
+
+            // an evenly spread palette, a uniform lookup table and the Bayer matrix as constant inputs
+            std::vector<palette::Color> entries(config.palette_size);
+            for (int i = 0; i < config.palette_size; i++) {
+                const int value = i * 255 / std::max(1, config.palette_size - 1);
+                entries[i] = palette::Color{ static_cast<uint8_t>(value), static_cast<uint8_t>(255 - value),
+                    static_cast<uint8_t>((value * 7) & 255), 255 };
+            }
+            QuantizationSettings settings;
+            settings.levels = config.levels;
+            const std::vector<uint8_t> table = lut::build_uniform(settings);
+            const std::vector<uint8_t> matrix = dither::threshold_matrix(DITHER_BAYER);
+            auto create_buffer = [&](cl_mem_flags flags, size_t size, const void* data, const char* what) {
+                cl_mem buffer = clCreateBuffer(context, data ? flags | CL_MEM_COPY_HOST_PTR : flags, size, const_cast<void*>(data), &err);
+                ocl::check(err, "Creating %s buffer", what);
+                return buffer;
+            };
+            cl_mem input_buffer = create_buffer(CL_MEM_READ_WRITE, frame_size, bgra.data(), "input");
+            cl_mem output_buffer = create_buffer(CL_MEM_READ_WRITE, frame_size, nullptr, "output");
+            cl_mem yuv_input_buffer = create_buffer(CL_MEM_READ_WRITE, yuv420_size, yuv420.data(), "YUV input");
+            cl_mem yuv_output_buffer = create_buffer(CL_MEM_READ_WRITE, yuv420_size, nullptr, "YUV output");
+            cl_mem counts_buffer = create_buffer(CL_MEM_READ_WRITE,
+                std::max(palette::HISTOGRAM_BINS, palette::SIGNATURE_BINS) * sizeof(cl_uint), nullptr, "counts");
+            cl_mem sums_buffer = create_buffer(CL_MEM_READ_WRITE, 4 * palette::MAX_COLORS * sizeof(cl_uint), nullptr, "k-means sums");
+            cl_mem palette_buffer = create_buffer(CL_MEM_READ_ONLY, entries.size() * sizeof(palette::Color), entries.data(), "palette");
+            cl_mem cube_buffer = create_buffer(CL_MEM_READ_WRITE, palette::CUBE_CELLS * palette::CUBE_CELL_SIZE, nullptr, "palette cube");
+            cl_mem lut_buffer = create_buffer(CL_MEM_READ_ONLY, table.size(), table.data(), "lookup table");
+            cl_mem matrix_buffer = create_buffer(CL_MEM_READ_ONLY, matrix.size(), matrix.data(), "dither matrix");
+            std::vector<uint8_t> readback(frame_size);
+            // the batched kernels run on as many copies of the frame as the backend batches at this resolution, at least two
+            const cl_int batch = static_cast<cl_int>(std::max<size_t>(OpenCLFrameProcessor::auto_batch_frames(width, height), 2));
+            std::vector<uint8_t> batch_frames;
+            for (cl_int i = 0; i < batch; i++) {
+                batch_frames.insert(batch_frames.end(), bgra.begin(), bgra.end());
+            }
+            cl_mem batch_input_buffer = create_buffer(CL_MEM_READ_WRITE, batch * frame_size, batch_frames.data(), "batch input");
+            cl_mem batch_output_buffer = create_buffer(CL_MEM_READ_WRITE, batch * frame_size, nullptr, "batch output");
+
+            auto add = [&](const std::string& stage, size_t stage_pixels, size_t bytes, const std::function<cl_event()>& enqueue) {
+                device_results.push_back(summarize(stage, stage_pixels, bytes, time_device(config, enqueue)));
+            };
+            add("upload", pixels, frame_size, [&]() {
+                cl_event evt;
+                ocl::check(clEnqueueWriteBuffer(queue, input_buffer, CL_FALSE, 0, frame_size, bgra.data(), 0, nullptr, &evt), "Enqueue upload");
+                return evt;
+            });
+            // every kernel of the file, the clearing of the counters is left out of the measure
+            const cl_int palette_size = config.palette_size;
+            const cl_int levels = config.levels;
+            for (const char* name : { "uniform_quantize_lower_bound", "uniform_quantize_upper_bound", "uniform_quantize_nearest",
+                "uniform_quantize_binary_bitshift", "yuv_uniform_quantize_nearest" }) {
+                add(name, pixels, 2 * frame_size, [&]() {
+                    return uniform_quantize(queue, kernel(name), width, height, lws_in, input_buffer, output_buffer, levels);
+                });
+            }
+            for (const char* name : { "uniform_quantize_binary_threshold", "rgb_to_grayscale", "rgba_to_yuv", "bgra_to_yuv",
+                "yuv_uniform_quantize_binary_bitshift" }) {
+                add(name, pixels, 2 * frame_size, [&]() {
+                    return rgba_to_grayscale(queue, kernel(name), width, height, lws_in, input_buffer, output_buffer);
+                });
+            }
+            add("brga_to_rgba", pixels, 2 * frame_size, [&]() {
+                return brga_to_rgba(queue, kernel("brga_to_rgba"), width, height, lws_in, input_buffer, output_buffer);
+            });
+            add("bgra_quantize_fused", pixels, 2 * frame_size, [&]() {
+                return bgra_quantize_fused(queue, kernel("bgra_quantize_fused"), width, height, lws_in,
+                    input_buffer, output_buffer, levels, 0, QUANTIZE_NEAREST);
+            });
+            add("bgra_lut_fused", pixels, 2 * frame_size, [&]() {
+                return bgra_lut_fused(queue, kernel("bgra_lut_fused"), width, height, lws_in, input_buffer, output_buffer, 0, lut_buffer);
+            });
+            add("bgra_quantize_fused_batch", batch * pixels, 2 * batch * frame_size, [&]() {
+                return bgra_quantize_fused_batch(queue, kernel("bgra_quantize_fused_batch"), width, height, batch, lws_in,
+                    batch_input_buffer, batch_output_buffer, levels, 0, QUANTIZE_NEAREST);
+            });
+            add("bgra_lut_fused_batch", batch * pixels, 2 * batch * frame_size, [&]() {
+                return bgra_lut_fused_batch(queue, kernel("bgra_lut_fused_batch"), width, height, batch, lws_in,
+                    batch_input_buffer, batch_output_buffer, 0, lut_buffer);
+            });
+            add("yuv420p_quantize_fused", pixels, 2 * yuv420_size, [&]() {
+                return yuv420p_quantize_fused(queue, kernel("yuv420p_quantize_fused"), width, height, lws_in,
+                    yuv_input_buffer, yuv_output_buffer, levels, 0, QUANTIZE_NEAREST, 0);
+            });
+            add("yuv420p_quantize_planes", pixels, 2 * yuv420_size, [&]() {
+                return yuv420p_quantize_planes(queue, kernel("yuv420p_quantize_planes"), width, height, lws_in,
+                    yuv_output_buffer, levels, levels, 0, QUANTIZE_NEAREST);
+            });
+            add("bgra_color_histogram", pixels, frame_size, [&]() {
+                return bgra_color_count(queue, kernel("bgra_color_histogram"), width, height, reduction_lws, reduction_gws,
+                    input_buffer, counts_buffer);
+            });
+            // the signature only samples one pixel every palette::SIGNATURE_SAMPLE_STEP
+            add("bgra_color_signature", pixels, frame_size / palette::SIGNATURE_SAMPLE_STEP, [&]() {
+                return bgra_color_count(queue, kernel("bgra_color_signature"), width, height, reduction_lws, reduction_gws,
+                    input_buffer, counts_buffer);
+            });
+            add("bgra_palette_accumulate", pixels, frame_size / palette::KMEANS_SAMPLE_STEP, [&]() {
+                return bgra_palette_accumulate(queue, kernel("bgra_palette_accumulate"), width, height, reduction_lws, reduction_gws,
+                    input_buffer, palette_buffer, palette_size, sums_buffer);
+            });
+            add("bgra_palette_map", pixels, 2 * frame_size, [&]() {
+                return bgra_palette_map(queue, kernel("bgra_palette_map"), width, height, lws_in,
+                    input_buffer, output_buffer, palette_buffer, palette_size);
+            });
+            // the cube does not depend on the frame, it is reported without a pixel rate
+            add("build_palette_cube", 0, palette::CUBE_CELLS * palette::CUBE_CELL_SIZE, [&]() {
+                return build_palette_cube(queue, kernel("build_palette_cube"), lws_in, palette_buffer, palette_size, cube_buffer);
+            });
+            add("bgra_palette_map_cube", pixels, 2 * frame_size, [&]() {
+                return bgra_palette_map_cube(queue, kernel("bgra_palette_map_cube"), width, height, lws_in,
+                    input_buffer, output_buffer, palette_buffer, palette_size, cube_buffer);
+            });
+            add("bgra_dither_ordered", pixels, 2 * frame_size, [&]() {
+                return bgra_dither_ordered(queue, kernel("bgra_dither_ordered"), width, height, lws_in,
+                    input_buffer, output_buffer, levels, 0, QUANTIZE_NEAREST, matrix_buffer, dither::BAYER_BITS);
+            });
+            add("bgra_dither_ordered_batch", batch * pixels, 2 * batch * frame_size, [&]() {
+                return bgra_dither_ordered_batch(queue, kernel("bgra_dither_ordered_batch"), width, height, batch, lws_in,
+                    batch_input_buffer, batch_output_buffer, levels, 0, QUANTIZE_NEAREST, matrix_buffer, dither::BAYER_BITS);
+            });
+            add("bgra_dither_error_diffusion", pixels, 2 * frame_size, [&]() {
+                return bgra_dither_error_diffusion(queue, kernel("bgra_dither_error_diffusion"), width, height,
+                    input_buffer, output_buffer, levels, 0, QUANTIZE_NEAREST);
+            });
+            add("readback", pixels, frame_size, [&]() {
+                cl_event evt;
+                ocl::check(clEnqueueReadBuffer(queue, output_buffer, CL_FALSE, 0, frame_size, readback.data(), 0, nullptr, &evt), "Enqueue readback");
+                return evt;
+            });
+
+            for (cl_mem buffer : { input_buffer, output_buffer, yuv_input_buffer, yuv_output_buffer, counts_buffer, sums_buffer,
+                palette_buffer, cube_buffer, lut_buffer, matrix_buffer, batch_input_buffer, batch_output_buffer }) {
+                clReleaseMemObject(buffer);
+            }
+        }
+        clReleaseCommandQueue(queue);
+        clReleaseContext(context);
+        results.insert(results.end(), device_results.begin(), device_results.end());
+    }
+
+    /**
+     * @brief Prints the results as an aligned table.
+     */
+    void print_table(const std::vector<StageResult>& results, std::ostream& out) {
+        out << std::left << std::setw(38) << "stage" << std::right << std::setw(10) << "mean ms" << std::setw(10) << "min ms"
+            << std::setw(10) << "max ms" << std::setw(12) << "MPix/s" << std::setw(10) << "GB/s" << "\n";
+        out << std::fixed;
+        for (const StageResult& result : results) {
+            out << std::left << std::setw(38) << result.stage << std::right << std::setprecision(3)
+                << std::setw(10) << result.mean_ms << std::setw(10) << result.min_ms << std::setw(10) << result.max_ms
+                << std::setprecision(1) << std::setw(12) << result.megapixels_per_second
+                << std::setprecision(2) << std::setw(10) << result.gigabytes_per_second << "\n";
+        }
+        out << std::defaultfloat;
+    }
+
+    /**
+     * @brief Writes the results as CSV, one row per stage.
+     */
+    void write_csv(const BenchConfig& config, const std::vector<StageResult>& results, std::ostream& out) {
+        out << "stage,width,height,iterations,mean_ms,min_ms,max_ms,mpix_per_s,gb_per_s\n";
+        for (const StageResult& result : results) {
+            out << result.stage << "," << config.width << "," << config.height << "," << result.iterations << ","
+                << result.mean_ms << "," << result.min_ms << "," << result.max_ms << ","
+                << result.megapixels_per_second << "," << result.gigabytes_per_second << "\n";
+        }
+    }
+
+    /**
+     * @brief Writes the results as a JSON document holding the configuration and one object per stage.
+     */
+    void write_json(const BenchConfig& config, const std::vector<StageResult>& results, std::ostream& out) {
+        out << "{\n  \"width\": " << config.width << ",\n  \"height\": " << config.height
+            << ",\n  \"levels\": " << config.levels << ",\n  \"iterations\": " << config.iterations << ",\n  \"stages\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const StageResult& result = results[i];
+            out << "    {\"stage\": \"" << result.stage << "\", \"iterations\": " << result.iterations
+                << ", \"mean_ms\": " << result.mean_ms << ", \"min_ms\": " << result.min_ms << ", \"max_ms\": " << result.max_ms
+                << ", \"mpix_per_s\": " << result.megapixels_per_second << ", \"gb_per_s\": " << result.gigabytes_per_second
+                << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+} // namespace
+
+int main(int argc, char** argv) {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    BenchConfig config;
+    std::string stages, csv_file, json_file;
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("width", po::value<int>(&config.width)->default_value(1920), "width of the synthetic frames")
+        ("height", po::value<int>(&config.height)->default_value(1080), "height of the synthetic frames")
+        ("iterations", po::value<int>(&config.iterations)->default_value(50), "measured runs of every stage")
+        ("warmup", po::value<int>(&config.warmup)->default_value(5), "runs of every stage before the measured ones")
+        ("levels,l", po::value<int>(&config.levels)->default_value(4), "number of levels of the quantization kernels")
+        ("generic-kernels", "pass the levels to the kernels at runtime instead of building a variant specialized for them")
+        ("palette", po::value<int>(&config.palette_size)->default_value(16), "number of colors given to the palette kernels")
+        ("stages", po::value<std::string>(&stages)->default_value("all"), "stages to run: all, host (encode, decode, swscale) or device (upload, kernels, readback)")
+        ("kernel-file", po::value<std::string>(&config.kernel_file), "build the OpenCL kernels from this file instead of the ones embedded in the executable")
+        ("program-cache", po::value<std::string>(&config.program_cache)->default_value(ProgramBinaryCache::default_directory()), "directory of the compiled OpenCL programs, none to always build from source")
+        ("scratch-file", po::value<std::string>(&config.scratch_file)->default_value("video_quantizer_bench.mp4"), "video written by the encode stage and read back by the decode stage, removed at the end")
+        ("preset", po::value<std::string>(&config.encoder.preset), "encoder speed preset of the encode stage")
+        ("csv", po::value<std::string>(&csv_file), "write the results as CSV to this file")
+        ("json", po::value<std::string>(&json_file), "write the results as JSON to this file");
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (config.program_cache == "none") {
+        config.program_cache.clear();
+    }
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+    config.specialize = !vm.count("generic-kernels");
+    config.encoder.pix_fmt = AV_PIX_FMT_YUV420P;
+    if (config.width < 2 || config.height < 2 || config.iterations < 1 || config.warmup < 0) {
+        std::cerr << "The frames must be at least 2x2 and every stage must run at least once.\n";
+        return 1;
+    }
+    if (config.levels < 2 || config.levels > 256 || config.palette_size < 2 || static_cast<size_t>(config.palette_size) > palette::MAX_COLORS) {
+        std::cerr << "The levels must be between 2 and 256 and the palette between 2 and " << palette::MAX_COLORS << " colors.\n";
+        return 1;
+    }
+    if (stages != "all" && stages != "host" && stages != "device") {
+        std::cerr << "Unknown stages: " << stages << ", expected all, host or device.\n";
+        return 1;
+    }
+
+    std::vector<StageResult> results;
+    try {
+        const std::vector<uint8_t> bgra = synthetic_bgra(config.width, config.height);
+        const std::vector<uint8_t> yuv420 = synthetic_yuv420(bgra, config.width, config.height);
+        if (stages != "device") {
+            bench_host(config, bgra, yuv420, results);
+        }
+        if (stages != "host") {
+            bench_device(config, bgra, yuv420, results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    std::cout << "Frames of " << config.width << "x" << config.height << ", " << config.iterations << " runs per stage\n";
+    print_table(results, std::cout);
+    if (!csv_file.empty()) {
+        std::ofstream csv(csv_file);
+        write_csv(config, results, csv);
+        if (!csv) {
+            std::cerr << "Could not write " << csv_file << "\n";
+            return 1;
+        }
+    }
+    if (!json_file.empty()) {
+        std::ofstream json(json_file);
+        write_json(config, results, json);
+        if (!json) {
+            std::cerr << "Could not write " << json_file << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
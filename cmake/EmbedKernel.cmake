@@ -0,0 +1,23 @@
+# Turns an OpenCL source file into a C++ array definition
+# Usage: cmake -DINPUT=<file.cl> -DOUTPUT=<file.cpp> -DNAME=<identifier> -P EmbedKernel.cmake
+file(READ ${INPUT} hex HEX)
+string(LENGTH "${hex}" hex_length)
+# 16 bytes per line keep the generated file readable by compilers and editors
+set(content "")
+set(offset 0)
+while(offset LESS hex_length)
+  string(SUBSTRING "${hex}" ${offset} 32 line)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," line "${line}")
+  string(APPEND content "    ${line}\n")
+  math(EXPR offset "${offset} + 32")
+endwhile()
+file(WRITE ${OUTPUT}.tmp
+  "// Generated from ${INPUT}, do not edit\n"
+  "#include \"EmbeddedKernels.hpp\"\n\n"
+  "namespace embedded_kernels {\n"
+  "    const unsigned char ${NAME}[] = {\n${content}    0x00\n    };\n"
+  "    const size_t ${NAME}_size = sizeof(${NAME}) - 1;\n"
+  "} // namespace embedded_kernels\n")
+# Only touch the output when it changes, so that unrelated reconfigurations do not rebuild the library
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different ${OUTPUT}.tmp ${OUTPUT})
+file(REMOVE ${OUTPUT}.tmp)
@@ -0,0 +1,171 @@
+/**
+ * @file CpuFrameProcessor.cpp
+ * @brief Implementation of the CpuFrameProcessor class.
+ */
+#include "CpuFrameProcessor.hpp"
+#include "QuantizationLut.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+CpuFrameProcessor::CpuFrameProcessor(const QuantizationSettings& settings, int width, int height, size_t thread_count)
+    : settings_(settings), width_(width), height_(height), params_(cpu::make_params(settings)), kernel_(cpu::select_kernel()),
+    lut_kernel_(cpu::select_lut_kernel(!settings.lut.empty() && lut::is_shared(settings.lut))),
+    schedule_(settings.scene_threshold, settings.palette_interval), pool_(thread_count), staging_(static_cast<size_t>(width) * height * 4) {
+    // in YUV space grayscale only neutralizes the chroma, the luma is already the gray level
+    QuantizationSettings plane_settings = settings;
+    plane_settings.levels = settings.luma_levels;
+    plane_settings.grayscale = false;
+    luma_params_ = cpu::make_params(plane_settings);
+    plane_settings.levels = settings.chroma_levels;
+    plane_settings.grayscale = settings.grayscale;
+    chroma_params_ = cpu::make_params(plane_settings);
+    if (settings.dither == DITHER_BAYER || settings.dither == DITHER_BLUE_NOISE) {
+        dither_matrix_ = dither::threshold_matrix(settings.dither);
+    }
+    if (settings.palette_size > 0 && settings.palette_cube) {
+        palette_cube_.resize(palette::CUBE_CELLS * palette::CUBE_CELL_SIZE);
+    }
+}
+
+void CpuFrameProcessor::process(const uint8_t* bgra_frame, uint8_t* rgba_frame) {
+    const size_t row_size = static_cast<size_t>(width_) * 4;
+    if (settings_.palette_size > 0) {
+        // the palette is reused within a scene and rebuilt at the scene cuts
+        const std::vector<uint32_t> signature = schedule_.needs_signature() ? compute_signature(bgra_frame) : std::vector<uint32_t>();
+        const palette::PaletteSchedule::Decision decision = schedule_.next_frame(signature);
+        if (decision != palette::PaletteSchedule::KEEP) {
+            build_palette(bgra_frame, decision == palette::PaletteSchedule::REFINE);
+        }
+        pool_.parallel_for(height_, [&](size_t first_row, size_t last_row) {
+            if (!palette_cube_.empty()) {
+                cpu::map_to_palette_cube(bgra_frame + first_row * row_size, rgba_frame + first_row * row_size,
+                    (last_row - first_row) * width_, palette_.data(), palette_.size(), palette_cube_.data());
+            } else {
+                cpu::map_to_palette(bgra_frame + first_row * row_size, rgba_frame + first_row * row_size,
+                    (last_row - first_row) * width_, palette_.data(), palette_.size());
+            }
+        });
+        return;
+    }
+    if (settings_.dither == DITHER_ERROR_DIFFUSION) {
+        // the error stays inside its tile, so the tiles are split across the threads
+        pool_.parallel_for(dither::tile_count(width_, height_), [&](size_t first_tile, size_t last_tile) {
+            cpu::dither_error_diffusion_tiles(bgra_frame, rgba_frame, width_, height_,
+                static_cast<int>(first_tile), static_cast<int>(last_tile), params_);
+        });
+        return;
+    }
+    if (!dither_matrix_.empty()) {
+        pool_.parallel_for(height_, [&](size_t first_row, size_t last_row) {
+            cpu::dither_ordered_rows(bgra_frame, rgba_frame, width_, static_cast<int>(first_row), static_cast<int>(last_row),
+                params_, dither_matrix_.data(), dither::matrix_bits(settings_.dither));
+        });
+        return;
+    }
+    pool_.parallel_for(height_, [&](size_t first_row, size_t last_row) {
+        if (!settings_.lut.empty()) {
+            lut_kernel_.kernel(bgra_frame + first_row * row_size, rgba_frame + first_row * row_size,
+                (last_row - first_row) * width_, settings_.lut.data(), settings_.grayscale);
+            return;
+        }
+        kernel_.kernel(bgra_frame + first_row * row_size, rgba_frame + first_row * row_size,
+            (last_row - first_row) * width_, params_);
+    });
+}
+
+uint8_t* CpuFrameProcessor::map_input() {
+    return staging_.data();
+}
+
+void CpuFrameProcessor::process_mapped(uint8_t* rgba_frame) {
+    process(staging_.data(), rgba_frame);
+}
+
+void CpuFrameProcessor::process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) {
+    // every chroma row owns two luma rows, so the chroma rows are split across the threads
+    pool_.parallel_for(yuv420_chroma_height(height_), [&](size_t first_row, size_t last_row) {
+        cpu::quantize_yuv420_rows(input, output, width_, height_,
+            static_cast<int>(first_row), static_cast<int>(last_row), params_, full_range);
+    });
+}
+
+void CpuFrameProcessor::quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) {
+    const int chroma_width = yuv420_chroma_width(width_);
+    const int chroma_height = yuv420_chroma_height(height_);
+    pool_.parallel_for(chroma_height, [&](size_t first_row, size_t last_row) {
+        // the two luma rows of every chroma row, so each thread touches a disjoint band of all the planes
+        const int first_luma_row = static_cast<int>(2 * first_row);
+        const int last_luma_row = std::min(static_cast<int>(2 * last_row), height_);
+        cpu::quantize_plane_rows(input.data[0], input.linesize[0], output.data[0], output.linesize[0],
+            width_, first_luma_row, last_luma_row, luma_params_);
+        for (int plane = 1; plane < 3; plane++) {
+            cpu::quantize_plane_rows(input.data[plane], input.linesize[plane], output.data[plane], output.linesize[plane],
+                chroma_width, static_cast<int>(first_row), static_cast<int>(last_row), chroma_params_);
+        }
+    });
+}
+
+std::vector<uint32_t> CpuFrameProcessor::compute_signature(const uint8_t* bgra_frame) {
+    std::mutex merge_mutex;
+    std::vector<uint32_t> signature(palette::SIGNATURE_BINS, 0);
+    pool_.parallel_for(height_, [&](size_t first_row, size_t last_row) {
+        std::vector<uint32_t> chunk_signature(palette::SIGNATURE_BINS, 0);
+        cpu::color_signature(bgra_frame, first_row * width_, last_row * width_, chunk_signature.data());
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (size_t bin = 0; bin < signature.size(); bin++) {
+            signature[bin] += chunk_signature[bin];
+        }
+    });
+    return signature;
+}
+
+void CpuFrameProcessor::build_palette(const uint8_t* bgra_frame, bool refine) {
+    const size_t row_size = static_cast<size_t>(width_) * 4;
+    std::mutex merge_mutex;
+    // without k-means iterations there is nothing to refine
+    if (!refine || settings_.kmeans_iterations == 0) {
+        // every chunk of rows counts into its own histogram, merged under the lock once per chunk
+        std::vector<uint32_t> histogram(palette::HISTOGRAM_BINS, 0);
+        pool_.parallel_for(height_, [&](size_t first_row, size_t last_row) {
+            std::vector<uint32_t> chunk_histogram(palette::HISTOGRAM_BINS, 0);
+            cpu::color_histogram(bgra_frame + first_row * row_size, (last_row - first_row) * width_, chunk_histogram.data());
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            for (size_t bin = 0; bin < histogram.size(); bin++) {
+                histogram[bin] += chunk_histogram[bin];
+            }
+        });
+        palette_ = palette::median_cut(histogram, settings_.palette_size);
+    }
+
+    for (int iteration = 0; iteration < settings_.kmeans_iterations; iteration++) {
+        std::vector<uint32_t> sums(4 * palette_.size(), 0);
+        pool_.parallel_for(height_, [&](size_t first_row, size_t last_row) {
+            std::vector<uint32_t> chunk_sums(sums.size(), 0);
+            cpu::accumulate_palette(bgra_frame, first_row * width_, last_row * width_,
+                palette_.data(), palette_.size(), chunk_sums.data());
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            for (size_t i = 0; i < sums.size(); i++) {
+                sums[i] += chunk_sums[i];
+            }
+        });
+        palette::update_centroids(palette_, sums);
+    }
+    palette::remove_duplicates(palette_);
+
+    if (!palette_cube_.empty()) {
+        // the cube is built once per palette, every frame sharing the palette maps through it
+        pool_.parallel_for(palette::CUBE_CELLS, [&](size_t first_cell, size_t last_cell) {
+            cpu::build_palette_cube(palette_.data(), palette_.size(), first_cell, last_cell, palette_cube_.data());
+        });
+    }
+}
+
+std::string CpuFrameProcessor::name() const {
+    if (settings_.palette_size > 0) {
+        return "cpu (palette, " + std::to_string(pool_.thread_count()) + " threads)";
+    }
+    const bool lut = !settings_.lut.empty();
+    const char* isa = lut ? lut_kernel_.isa : kernel_.isa;
+    return std::string("cpu (") + isa + (lut ? ", lut" : "") + ", " + std::to_string(pool_.thread_count()) + " threads)";
+}
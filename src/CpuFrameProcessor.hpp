@@ -0,0 +1,69 @@
+/**
+ * @file CpuFrameProcessor.hpp
+ * @brief Native CPU backend, an alternative to OpenCL for hosts without a usable device.
+ */
+#pragma once
+
+#include "FrameProcessor.hpp"
+#include "ThreadPool.hpp"
+#include "cpu_kernels.hpp"
+
+#include <vector>
+
+/**
+ * @class CpuFrameProcessor
+ * @brief Processes frames with the SIMD kernels of cpu_kernels.hpp, split by rows across a thread pool.
+ */
+class CpuFrameProcessor : public FrameProcessor {
+public:
+    /**
+     * @brief Constructs the backend and selects the kernel for the running CPU.
+     * @param settings The operations applied to every frame.
+     * @param width The width of the frames.
+     * @param height The height of the frames.
+     * @param thread_count The number of threads processing a frame, 0 uses the number of cores.
+     */
+    CpuFrameProcessor(const QuantizationSettings& settings, int width, int height, size_t thread_count = 0);
+
+    void process(const uint8_t* bgra_frame, uint8_t* rgba_frame) override;
+
+    uint8_t* map_input() override;
+
+    void process_mapped(uint8_t* rgba_frame) override;
+
+    void process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) override;
+
+    void quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) override;
+
+    std::string name() const override;
+
+private:
+    /**
+     * @brief Builds the adaptive palette from a frame: histogram, median cut and k-means iterations.
+     * @param bgra_frame The frame, width * height pixels in BGRA order.
+     * @param refine Start the k-means iterations from the current palette instead of a median cut.
+     */
+    void build_palette(const uint8_t* bgra_frame, bool refine);
+
+    /**
+     * @brief Computes the scene signature of a frame.
+     * @param bgra_frame The frame, width * height pixels in BGRA order.
+     * @return palette::SIGNATURE_BINS counters.
+     */
+    std::vector<uint32_t> compute_signature(const uint8_t* bgra_frame);
+
+    QuantizationSettings settings_; ///< Operations applied to every frame
+    int width_;                     ///< Frame width
+    int height_;                    ///< Frame height
+    cpu::QuantizeParams params_;    ///< Kernel constants for the settings
+    cpu::QuantizeParams luma_params_;   ///< Kernel constants of the Y plane in YUV space
+    cpu::QuantizeParams chroma_params_; ///< Kernel constants of the U and V planes in YUV space
+    cpu::KernelInfo kernel_;        ///< Kernel selected for the running CPU
+    cpu::LutKernelInfo lut_kernel_; ///< Lookup table kernel selected for the running CPU and the table
+    std::vector<uint8_t> dither_matrix_;    ///< Threshold matrix of the ordered dithering, empty when not used
+    std::vector<palette::Color> palette_;   ///< Adaptive palette of the current frames
+    std::vector<uint8_t> palette_cube_;     ///< Candidate lists of the palette cube, empty when not used
+    palette::PaletteSchedule schedule_;     ///< Decides when the palette is rebuilt
+    ThreadPool pool_;               ///< Threads processing the rows
+    std::vector<uint8_t> staging_;  ///< Frame decoded in place through map_input()
+};
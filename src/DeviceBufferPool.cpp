@@ -0,0 +1,88 @@
+/**
+ * @file DeviceBufferPool.cpp
+ * @brief Implementation of the DeviceBufferPool class.
+ */
+#include "DeviceBufferPool.hpp"
+
+DeviceBufferPool::DeviceBufferPool(cl_context context, cl_command_queue queue)
+    : context_(context), queue_(queue), input_(nullptr), intermediate_(nullptr), output_(nullptr),
+    mapped_input_(nullptr), width_(0), height_(0), bytes_per_pixel_(0), frame_size_(0), frames_(0), allocation_count_(0) {
+}
+
+DeviceBufferPool::~DeviceBufferPool() {
+    release();
+}
+
+void DeviceBufferPool::reserve(int width, int height, size_t bytes_per_pixel, size_t frames) {
+    if (input_ && width == width_ && height == height_ && bytes_per_pixel == bytes_per_pixel_ && frames == frames_) {
+        return;
+    }
+    release();
+
+    width_ = width;
+    height_ = height;
+    bytes_per_pixel_ = bytes_per_pixel;
+    frame_size_ = static_cast<size_t>(width) * height * bytes_per_pixel;
+    frames_ = frames;
+
+    // the kernels read and write every buffer at some point of the chain, so they are all read-write
+    // the input buffer lives in host-accessible memory so that frames can be decoded straight into it
+    const size_t buffer_size = frame_size_ * frames_;
+    cl_int err;
+    input_ = clCreateBuffer(context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, buffer_size, nullptr, &err);
+    ocl::check(err, "Creating pooled input buffer");
+    intermediate_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, buffer_size, nullptr, &err);
+    ocl::check(err, "Creating pooled intermediate buffer");
+    output_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, buffer_size, nullptr, &err);
+    ocl::check(err, "Creating pooled output buffer");
+    allocation_count_++;
+}
+
+cl_event DeviceBufferPool::upload(const uint8_t* host_data, size_t frame) {
+    cl_event upload_evt;
+    cl_int err = clEnqueueWriteBuffer(queue_, input_, CL_FALSE, frame * frame_size_, frame_size_, host_data, 0, nullptr, &upload_evt);
+    ocl::check(err, "Uploading frame to pooled input buffer");
+    return upload_evt;
+}
+
+uint8_t* DeviceBufferPool::map_input(size_t frame) {
+    if (mapped_input_) {
+        return mapped_input_;
+    }
+    // the frame is overwritten as a whole, so the runtime does not have to copy the previous contents to the host
+    cl_int err;
+    void* mapped = clEnqueueMapBuffer(queue_, input_, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, frame * frame_size_, frame_size_, 0, nullptr, nullptr, &err);
+    ocl::check(err, "Mapping pooled input buffer");
+    mapped_input_ = static_cast<uint8_t*>(mapped);
+    return mapped_input_;
+}
+
+cl_event DeviceBufferPool::unmap_input() {
+    cl_event unmap_evt;
+    cl_int err = clEnqueueUnmapMemObject(queue_, input_, mapped_input_, 0, nullptr, &unmap_evt);
+    ocl::check(err, "Unmapping pooled input buffer");
+    mapped_input_ = nullptr;
+    return unmap_evt;
+}
+
+void DeviceBufferPool::release() {
+    if (mapped_input_) {
+        // a frame was mapped but never processed, e.g. at the end of the stream
+        cl_event unmap_evt = unmap_input();
+        clWaitForEvents(1, &unmap_evt);
+        clReleaseEvent(unmap_evt);
+    }
+    if (input_) {
+        clReleaseMemObject(input_);
+        input_ = nullptr;
+    }
+    if (intermediate_) {
+        clReleaseMemObject(intermediate_);
+        intermediate_ = nullptr;
+    }
+    if (output_) {
+        clReleaseMemObject(output_);
+        output_ = nullptr;
+    }
+    frame_size_ = 0;
+}
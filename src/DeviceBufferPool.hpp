@@ -0,0 +1,128 @@
+/**
+ * @file DeviceBufferPool.hpp
+ * @brief Persistent set of OpenCL device buffers reused across video frames.
+ */
+#pragma once
+
+#include "ocl_utility.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @class DeviceBufferPool
+ * @brief Owns the input, intermediate and output device buffers used by the per-frame loop.
+ *
+ * The buffers are allocated once per resolution and reused for every frame, so that
+ * steady-state processing does not allocate or release any device memory.
+ * Frames are uploaded into the input buffer with clEnqueueWriteBuffer, or written in place
+ * through map_input(), and the kernels ping-pong between the intermediate and output buffers.
+ * A pool reserved for several frames packs them one after the other in every buffer, for the batched kernels.
+ * The input buffer is allocated in host-accessible memory, so that mapping it is zero-copy on
+ * CPU and integrated devices. It is mapped with CL_MAP_WRITE_INVALIDATE_REGION, so a discrete device
+ * does not read the previous frame back before the map, and only transfers the new one at the unmap.
+ */
+class DeviceBufferPool {
+public:
+    /**
+     * @brief Constructs an empty pool bound to an OpenCL context and queue.
+     * @param context The OpenCL context in which the buffers are created.
+     * @param queue The command queue used for the uploads.
+     */
+    DeviceBufferPool(cl_context context, cl_command_queue queue);
+
+    /**
+     * @brief Destructor that releases every device buffer owned by the pool.
+     */
+    ~DeviceBufferPool();
+
+    DeviceBufferPool(const DeviceBufferPool&) = delete;
+    DeviceBufferPool& operator=(const DeviceBufferPool&) = delete;
+
+    /**
+     * @brief Makes sure the buffers can hold frames of the given resolution.
+     * Buffers are only (re)allocated when the resolution or the number of frames changes.
+     * @param width The width of the frames.
+     * @param height The height of the frames.
+     * @param bytes_per_pixel The size of a pixel in bytes (4 for BGRA/RGBA).
+     * @param frames The number of frames packed one after the other in every buffer, for the batched kernels.
+     */
+    void reserve(int width, int height, size_t bytes_per_pixel = 4, size_t frames = 1);
+
+    /**
+     * @brief Uploads a host frame into the input buffer without blocking.
+     * The host memory must stay valid until the returned event has completed.
+     * @param host_data Pointer to frame_size() bytes of pixel data.
+     * @param frame The position of the frame in the buffer, below frames().
+     * @return The event of the write command, to be released by the caller.
+     */
+    cl_event upload(const uint8_t* host_data, size_t frame = 0);
+
+    /**
+     * @brief Maps a frame of the input buffer for writing, waiting for the commands still reading it.
+     * The frame must be written in the returned memory and handed back with unmap_input() before running the kernels.
+     * @param frame The position of the frame in the buffer, below frames().
+     * @return Pointer to frame_size() bytes of host-accessible memory.
+     */
+    uint8_t* map_input(size_t frame = 0);
+
+    /**
+     * @brief Unmaps the input buffer after a frame has been written into it.
+     * @return The event of the unmap command, to be released by the caller.
+     */
+    cl_event unmap_input();
+
+    /**
+     * @brief Tells whether a frame of the input buffer is mapped and not unmapped yet.
+     */
+    bool input_mapped() const { return mapped_input_ != nullptr; }
+
+    /**
+     * @brief Gets the buffer the frames are uploaded to.
+     */
+    cl_mem input() const { return input_; }
+
+    /**
+     * @brief Gets the scratch buffer used between two kernels.
+     */
+    cl_mem intermediate() const { return intermediate_; }
+
+    /**
+     * @brief Gets the buffer that holds the result of the last kernel.
+     */
+    cl_mem output() const { return output_; }
+
+    /**
+     * @brief Gets the size in bytes of one frame.
+     */
+    size_t frame_size() const { return frame_size_; }
+
+    /**
+     * @brief Gets the number of frames every buffer holds.
+     */
+    size_t frames() const { return frames_; }
+
+    /**
+     * @brief Gets how many times the buffers have been allocated, useful to verify that the steady state does not allocate.
+     */
+    size_t allocation_count() const { return allocation_count_; }
+
+private:
+    /**
+     * @brief Releases the currently allocated buffers, if any.
+     */
+    void release();
+
+    cl_context context_;        ///< Context owning the buffers
+    cl_command_queue queue_;    ///< Queue used for the uploads
+    cl_mem input_;              ///< Buffer the frames are uploaded to
+    cl_mem intermediate_;       ///< Scratch buffer between kernels
+    cl_mem output_;             ///< Buffer for the kernel results
+    uint8_t* mapped_input_;     ///< Host pointer of the input buffer while it is mapped
+    int width_;                 ///< Width the buffers were allocated for
+    int height_;                ///< Height the buffers were allocated for
+    size_t bytes_per_pixel_;    ///< Pixel size the buffers were allocated for
+    size_t frame_size_;         ///< Size of a frame in bytes
+    size_t frames_;             ///< Number of frames every buffer holds
+    size_t allocation_count_;   ///< Number of (re)allocations performed
+};
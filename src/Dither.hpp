@@ -0,0 +1,42 @@
+/**
+ * @file Dither.hpp
+ * @brief Threshold matrices and tiling of the dithered quantization.
+ *
+ * The ordered methods add a per-pixel rounding offset read from a threshold matrix repeated over the frame.
+ * Error diffusion runs Floyd-Steinberg inside independent tiles, so the tiles can be processed in parallel.
+ * Both are anchored to the pixel coordinates and use no per-frame randomness, so a static scene gets the
+ * same pattern in every frame and the encoder is not fed dithering noise.
+ */
+#pragma once
+
+#include "FrameProcessor.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace dither {
+    constexpr int BAYER_BITS = 3;           ///< log2 of the side of the Bayer matrix
+    constexpr int BLUE_NOISE_BITS = 4;      ///< log2 of the side of the blue-noise matrix
+    constexpr int TILE_WIDTH = 64;          ///< Width of an error diffusion tile, same as DITHER_TILE_WIDTH in uniformQuantization.cl
+    constexpr int TILE_HEIGHT = 32;         ///< Height of an error diffusion tile, same as DITHER_TILE_HEIGHT in uniformQuantization.cl
+
+    /**
+     * @brief Gets log2 of the side of the threshold matrix of an ordered method.
+     * @param method DITHER_BAYER or DITHER_BLUE_NOISE.
+     */
+    int matrix_bits(DitherMethod method);
+
+    /**
+     * @brief Builds the threshold matrix of an ordered method.
+     * @param method DITHER_BAYER or DITHER_BLUE_NOISE.
+     * @return The ranks 0..side * side - 1 of the matrix cells, row by row.
+     */
+    std::vector<uint8_t> threshold_matrix(DitherMethod method);
+
+    /**
+     * @brief Gets the number of error diffusion tiles covering a frame.
+     */
+    inline int tile_count(int width, int height) {
+        return ((width + TILE_WIDTH - 1) / TILE_WIDTH) * ((height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+    }
+} // namespace dither
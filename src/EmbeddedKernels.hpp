@@ -0,0 +1,14 @@
+/**
+ * @file EmbeddedKernels.hpp
+ * @brief OpenCL sources compiled into the executable, so that starting does not depend on the working directory.
+ *
+ * The definitions are generated at build time from src/kernels by cmake/EmbedKernel.cmake.
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace embedded_kernels {
+    extern const unsigned char uniform_quantization[];  ///< Content of uniformQuantization.cl, null-terminated
+    extern const size_t uniform_quantization_size;      ///< Length of the content, without the terminator
+} // namespace embedded_kernels
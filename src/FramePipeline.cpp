@@ -0,0 +1,161 @@
+/**
+ * @file FramePipeline.cpp
+ * @brief Implementation of the FramePipeline class.
+ */
+#include "FramePipeline.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+    /**
+     * @brief Waits a little before retrying a queue operation, backing off from spinning to sleeping.
+     * @param attempt How many times the operation has been retried.
+     */
+    void backoff(unsigned attempt) {
+        if (attempt < 64) {
+            return; // busy spin, the other stage is about to be done
+        }
+        if (attempt < 128) {
+            std::this_thread::yield();
+            return;
+        }
+        // the other stage is much slower than this one, do not burn a core waiting for it
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+FramePipeline::FramePipeline(size_t depth, size_t input_size, size_t output_size)
+    : frames_(depth), free_(depth), decoded_(depth), processed_(depth), abort_(false) {
+    if (depth == 0) {
+        throw std::invalid_argument("[THROW] FramePipeline::FramePipeline: depth must be at least 1");
+    }
+    for (PipelineFrame& frame : frames_) {
+        frame.input.resize(input_size);
+        frame.output.resize(output_size);
+        free_.try_push(&frame);
+    }
+}
+
+bool FramePipeline::push(SpscQueue<PipelineFrame*>& queue, PipelineFrame* frame) {
+    for (unsigned attempt = 0; !queue.try_push(frame); attempt++) {
+        if (abort_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        backoff(attempt);
+    }
+    return true;
+}
+
+bool FramePipeline::pop(SpscQueue<PipelineFrame*>& queue, PipelineFrame*& frame) {
+    for (unsigned attempt = 0; !queue.try_pop(frame); attempt++) {
+        if (abort_.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        backoff(attempt);
+    }
+    return true;
+}
+
+int64_t FramePipeline::run(const DecodeStage& decode, const ComputeStage& compute, const EncodeStage& encode) {
+    return run(decode, compute, [](PipelineFrame&) {}, 1, encode);
+}
+
+int64_t FramePipeline::run(const DecodeStage& decode, const ComputeStage& submit, const CompleteStage& complete, size_t in_flight,
+    const EncodeStage& encode) {
+    std::exception_ptr decode_error, compute_error, encode_error;
+    // the decoder needs a free frame to make progress while the compute stage holds the others
+    in_flight = std::max<size_t>(1, std::min(in_flight, frames_.size() - 1));
+
+    std::thread decode_thread([&]() {
+        try {
+            int64_t index = 0;
+            PipelineFrame* frame = nullptr;
+            while (pop(free_, frame)) {
+                frame->index = index;
+                if (!decode(*frame)) {
+                    push(decoded_, nullptr); // end of stream
+                    return;
+                }
+                index++;
+                if (!push(decoded_, frame)) {
+                    return;
+                }
+            }
+        } catch (...) {
+            decode_error = std::current_exception();
+            abort_ = true;
+        }
+    });
+
+    std::thread compute_thread([&]() {
+        try {
+            std::deque<PipelineFrame*> pending; // submitted frames, oldest first
+            auto retire = [&]() {
+                PipelineFrame* oldest = pending.front();
+                pending.pop_front();
+                complete(*oldest);
+                return push(processed_, oldest);
+            };
+            while (true) {
+                // the oldest frame is only waited for once in_flight frames are submitted, so that a decoder slower than
+                // the device still fills the batches, the decoder always has a free frame since in_flight is below the depth
+                PipelineFrame* frame = nullptr;
+                if (!pop(decoded_, frame)) {
+                    return;
+                }
+                if (!frame) {
+                    while (!pending.empty()) {
+                        if (!retire()) {
+                            return;
+                        }
+                    }
+                    push(processed_, nullptr); // forward the end of stream
+                    return;
+                }
+                if (pending.size() == in_flight && !retire()) {
+                    return;
+                }
+                submit(*frame);
+                pending.push_back(frame);
+            }
+        } catch (...) {
+            compute_error = std::current_exception();
+            abort_ = true;
+        }
+    });
+
+    // the encode stage runs on the calling thread, encoders are not required to be thread-agnostic
+    int64_t frame_count = 0;
+    try {
+        PipelineFrame* frame = nullptr;
+        while (pop(processed_, frame) && frame) {
+            encode(*frame);
+            frame_count++;
+            if (!push(free_, frame)) {
+                break;
+            }
+        }
+    } catch (...) {
+        encode_error = std::current_exception();
+        abort_ = true;
+    }
+
+    decode_thread.join();
+    compute_thread.join();
+
+    if (decode_error) {
+        std::rethrow_exception(decode_error);
+    }
+    if (compute_error) {
+        std::rethrow_exception(compute_error);
+    }
+    if (encode_error) {
+        std::rethrow_exception(encode_error);
+    }
+    return frame_count;
+}
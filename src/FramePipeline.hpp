@@ -0,0 +1,101 @@
+/**
+ * @file FramePipeline.hpp
+ * @brief Three-stage threaded decode, compute and encode pipeline.
+ */
+#pragma once
+
+#include "SpscQueue.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * @struct PipelineFrame
+ * @brief A recycled frame travelling through the pipeline stages.
+ */
+struct PipelineFrame {
+    std::vector<uint8_t> input;     ///< Decoded frame data, filled by the decode stage
+    std::vector<uint8_t> output;    ///< Processed frame data, filled by the compute stage
+    int64_t index = 0;              ///< Position of the frame in the video
+};
+
+/**
+ * @class FramePipeline
+ * @brief Runs decode, compute and encode on dedicated threads connected by bounded lock-free queues.
+ *
+ * A fixed number of frames is allocated up front and recycled from the encode stage back
+ * to the decode stage, so the steady state does not allocate. Every stage runs on a single
+ * thread and the queues are FIFO, so the frame order is preserved.
+ * The compute stage can keep several frames in flight, submitting the next ones before completing the oldest,
+ * so that an asynchronous backend works on a frame while the previous one is transferred back.
+ */
+class FramePipeline {
+public:
+    /// Fills frame.input with the next frame, returns false at the end of the stream.
+    using DecodeStage = std::function<bool(PipelineFrame&)>;
+    /// Processes frame.input into frame.output, or starts doing so when the frames are completed separately.
+    using ComputeStage = std::function<void(PipelineFrame&)>;
+    /// Waits until the oldest frame started by the compute stage has its output ready.
+    using CompleteStage = std::function<void(PipelineFrame&)>;
+    /// Consumes frame.output.
+    using EncodeStage = std::function<void(PipelineFrame&)>;
+
+    /**
+     * @brief Constructs the pipeline and allocates the recycled frames.
+     * @param depth The number of frames in flight, at least 3 to keep every stage busy.
+     * @param input_size The size in bytes of a decoded frame.
+     * @param output_size The size in bytes of a processed frame.
+     */
+    FramePipeline(size_t depth, size_t input_size, size_t output_size);
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    /**
+     * @brief Runs the pipeline until the decode stage reports the end of the stream.
+     * The decode and compute stages run on their own threads, the encode stage on the calling thread.
+     * If a stage throws, the pipeline is stopped and the exception is rethrown here.
+     * The recycled frames are not returned at the end of the stream, so a pipeline is meant to be run once.
+     * @param decode The decode stage.
+     * @param compute The compute stage.
+     * @param encode The encode stage.
+     * @return The number of frames that went through the pipeline.
+     */
+    int64_t run(const DecodeStage& decode, const ComputeStage& compute, const EncodeStage& encode);
+
+    /**
+     * @brief Runs the pipeline with an asynchronous compute stage keeping several frames in flight.
+     * The frames are completed in the order they were submitted, the oldest one when in_flight frames have been submitted
+     * or at the end of the stream, so that the backend always holds as many frames as it can batch and overlap.
+     * @param decode The decode stage.
+     * @param submit The compute stage, starting the processing of a frame.
+     * @param complete The stage waiting for the oldest submitted frame.
+     * @param in_flight The largest number of frames submitted and not completed, capped below the depth.
+     * @param encode The encode stage.
+     * @return The number of frames that went through the pipeline.
+     */
+    int64_t run(const DecodeStage& decode, const ComputeStage& submit, const CompleteStage& complete, size_t in_flight,
+        const EncodeStage& encode);
+
+private:
+    /**
+     * @brief Pushes into a queue, waiting while it is full.
+     * @return False if the pipeline was aborted while waiting.
+     */
+    bool push(SpscQueue<PipelineFrame*>& queue, PipelineFrame* frame);
+
+    /**
+     * @brief Pops from a queue, waiting while it is empty.
+     * @return False if the pipeline was aborted while waiting.
+     */
+    bool pop(SpscQueue<PipelineFrame*>& queue, PipelineFrame*& frame);
+
+    std::vector<PipelineFrame> frames_;     ///< Storage of the recycled frames
+    SpscQueue<PipelineFrame*> free_;        ///< Frames available to the decode stage
+    SpscQueue<PipelineFrame*> decoded_;     ///< Frames waiting for the compute stage, nullptr ends the stream
+    SpscQueue<PipelineFrame*> processed_;   ///< Frames waiting for the encode stage, nullptr ends the stream
+    std::atomic<bool> abort_;               ///< Set when a stage failed
+};
@@ -0,0 +1,151 @@
+/**
+ * @file FrameProcessor.hpp
+ * @brief Common interface of the backends that quantize video frames.
+ */
+#pragma once
+
+#include "FrameStats.hpp"
+#include "PlanarFrame.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Quantization modes, mirrored by the QUANTIZE_* defines in uniformQuantization.cl.
+ */
+enum QuantizationMode : int32_t {
+    QUANTIZE_NEAREST = 0,       ///< round to the nearest level
+    QUANTIZE_LOWER_BOUND = 1,   ///< round down to the lower bound of the interval
+    QUANTIZE_UPPER_BOUND = 2,   ///< round up to the upper bound of the interval
+    QUANTIZE_BINARY = 3         ///< binarize every channel to either 0 or 255
+};
+
+/**
+ * @brief Dithering methods of the per-channel quantization.
+ */
+enum DitherMethod : int32_t {
+    DITHER_NONE = 0,            ///< plain rounding
+    DITHER_BAYER = 1,           ///< ordered dithering with an 8x8 Bayer matrix
+    DITHER_BLUE_NOISE = 2,      ///< ordered dithering with a 16x16 blue-noise matrix
+    DITHER_ERROR_DIFFUSION = 3  ///< Floyd-Steinberg error diffusion within independent tiles
+};
+
+/**
+ * @struct QuantizationSettings
+ * @brief The operations applied to every frame.
+ */
+struct QuantizationSettings {
+    int levels = 2;                             ///< Number of levels for every channel, between 2 and 256
+    QuantizationMode mode = QUANTIZE_NEAREST;   ///< How the channels are rounded to the levels
+    bool grayscale = false;                     ///< Convert to grayscale with the luminosity method before quantizing
+    DitherMethod dither = DITHER_NONE;          ///< Dithering of the nearest and binary quantization
+    bool fused = true;                          ///< Use the single-pass path instead of one pass per operation
+    bool specialize = true;                     ///< Build the OpenCL kernels with the levels as a compile-time constant
+    int luma_levels = 2;                        ///< Number of levels of the Y plane when quantizing in YUV space
+    int chroma_levels = 2;                      ///< Number of levels of the U and V planes when quantizing in YUV space
+    int palette_size = 0;                       ///< Number of colors of the adaptive palette, 0 for per-channel quantization
+    int kmeans_iterations = 3;                  ///< k-means iterations refining the median cut palette
+    int palette_interval = 0;                   ///< Largest number of frames sharing a palette, 0 for no limit
+    bool palette_cube = true;                   ///< Map the pixels through the palette cube instead of searching the whole palette
+    double scene_threshold = 0.2;               ///< Scene signature distance that triggers a new palette, 0 disables the detection
+    std::vector<uint8_t> lut;                   ///< Per-channel 3 x 256 lookup table replacing the quantization, empty to use the arithmetic kernels
+};
+
+/**
+ * @class FrameProcessor
+ * @brief A backend that turns decoded BGRA frames into quantized RGBA frames.
+ *
+ * All the backends produce bit-exact results for the same settings.
+ */
+class FrameProcessor {
+public:
+    virtual ~FrameProcessor() = default;
+
+    /**
+     * @brief Processes a single frame.
+     * @param bgra_frame The decoded frame, width * height pixels in BGRA order.
+     * @param rgba_frame The processed frame, width * height pixels in RGBA order.
+     */
+    virtual void process(const uint8_t* bgra_frame, uint8_t* rgba_frame) = 0;
+
+    /**
+     * @brief Gets the memory the next frame should be decoded into, to be processed without further host copies.
+     * @return Pointer to width * height BGRA pixels, valid until process_mapped() is called.
+     */
+    virtual uint8_t* map_input() = 0;
+
+    /**
+     * @brief Processes the frame written into the memory returned by map_input().
+     * @param rgba_frame The processed frame, width * height pixels in RGBA order.
+     */
+    virtual void process_mapped(uint8_t* rgba_frame) = 0;
+
+    /**
+     * @brief Processes a planar YUV 4:2:0 frame, converting it to RGB and back inside the backend.
+     * @param input The decoded frame.
+     * @param output The processed frame in limited range, e.g. the planes of the encoder frame.
+     * @param full_range Whether the input uses the full (0-255) range instead of the limited one.
+     */
+    virtual void process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) = 0;
+
+    /**
+     * @brief Quantizes the planes of a YUV 4:2:0 frame directly in YUV space, without any RGB conversion.
+     * The Y plane uses the luma levels and the U and V planes the chroma levels, grayscale sets the chroma to neutral.
+     * @param input The decoded frame.
+     * @param output The processed frame, it can be the input itself.
+     */
+    virtual void quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) = 0;
+
+    /**
+     * @brief Starts processing a frame without waiting for the result, so that the next frames can be prepared meanwhile.
+     * Both frames must stay untouched until the frame is retired by complete(), frames complete in submission order.
+     * The default implementation processes the frame before returning.
+     * @param bgra_frame The decoded frame, width * height pixels in BGRA order.
+     * @param rgba_frame The processed frame, width * height pixels in RGBA order.
+     */
+    virtual void submit(const uint8_t* bgra_frame, uint8_t* rgba_frame) { process(bgra_frame, rgba_frame); }
+
+    /**
+     * @brief Gets the memory the next submitted frame should be decoded into, so that it is submitted without a host copy.
+     * The frame is then submitted with submit_mapped(), and the frames in flight stay in flight meanwhile.
+     * @return Pointer to width * height BGRA pixels, or null if the backend has no such memory and submit() takes host frames.
+     */
+    virtual uint8_t* map_submit_input() { return nullptr; }
+
+    /**
+     * @brief Submits the frame written into the memory returned by map_submit_input(), like submit().
+     * @param rgba_frame The processed frame, width * height pixels in RGBA order.
+     */
+    virtual void submit_mapped(uint8_t* rgba_frame) { (void)rgba_frame; }
+
+    /**
+     * @brief Gives back the memory returned by map_submit_input() without submitting a frame, e.g. at the end of the stream.
+     */
+    virtual void cancel_mapped_input() {}
+
+    /**
+     * @brief Waits until the oldest submitted frame has been written to its output.
+     */
+    virtual void complete() {}
+
+    /**
+     * @brief Gets how many frames can be submitted before the oldest one has to be completed.
+     */
+    virtual size_t max_in_flight() const { return 1; }
+
+    /**
+     * @brief Gets a human readable description of the backend.
+     */
+    virtual std::string name() const = 0;
+
+    /**
+     * @brief Records the device time of every kernel and transfer into a collector, for the backends that can measure it.
+     * @param stats The collector, null to stop recording.
+     */
+    virtual void set_stats(FrameStats* stats) { stats_ = stats; }
+
+protected:
+    FrameStats* stats_ = nullptr;   ///< Collector of the stage timings, null when not recording
+};
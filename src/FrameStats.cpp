@@ -0,0 +1,111 @@
+/**
+ * @file FrameStats.cpp
+ * @brief Implementation of the stage timing collector.
+ */
+#include "FrameStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+namespace {
+    /**
+     * @brief Gets a percentile of sorted samples with the nearest-rank method.
+     */
+    double percentile(const std::vector<double>& sorted, double p) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+}
+
+void FrameStats::record(const std::string& stage, double milliseconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = stage_index_.find(stage);
+    if (found == stage_index_.end()) {
+        found = stage_index_.emplace(stage, stages_.size()).first;
+        stages_.push_back(stage);
+        samples_.emplace_back();
+    }
+    samples_[found->second].push_back(milliseconds);
+}
+
+std::vector<FrameStats::Summary> FrameStats::summarize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Summary> summaries;
+    for (size_t i = 0; i < stages_.size(); i++) {
+        std::vector<double> sorted = samples_[i];
+        std::sort(sorted.begin(), sorted.end());
+        Summary summary;
+        summary.stage = stages_[i];
+        summary.count = sorted.size();
+        for (double sample : sorted) {
+            summary.total_ms += sample;
+        }
+        summary.mean_ms = sorted.empty() ? 0 : summary.total_ms / sorted.size();
+        summary.p50_ms = percentile(sorted, 50);
+        summary.p95_ms = percentile(sorted, 95);
+        summary.p99_ms = percentile(sorted, 99);
+        summary.max_ms = sorted.empty() ? 0 : sorted.back();
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+void FrameStats::print(std::ostream& out) const {
+    const std::vector<Summary> summaries = summarize();
+    out << std::left << std::setw(30) << "stage" << std::right << std::setw(8) << "frames" << std::setw(12) << "total ms"
+        << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (const Summary& summary : summaries) {
+        out << std::left << std::setw(30) << summary.stage << std::right << std::setw(8) << summary.count
+            << std::setw(12) << summary.total_ms << std::setw(10) << summary.p50_ms << std::setw(10) << summary.p95_ms
+            << std::setw(10) << summary.p99_ms << std::setw(10) << summary.max_ms << "\n";
+    }
+    out << std::defaultfloat;
+}
+
+void FrameStats::write_csv(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("[THROW] FrameStats::write_csv: Could not create " + filename);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    file << "stage,sample,ms\n";
+    for (size_t i = 0; i < stages_.size(); i++) {
+        for (size_t sample = 0; sample < samples_[i].size(); sample++) {
+            file << stages_[i] << "," << sample << "," << samples_[i][sample] << "\n";
+        }
+    }
+    if (!file.flush()) {
+        throw std::runtime_error("[THROW] FrameStats::write_csv: Could not write " + filename);
+    }
+}
+
+void FrameStats::write_json(const std::string& filename) const {
+    const std::vector<Summary> summaries = summarize();
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("[THROW] FrameStats::write_json: Could not create " + filename);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    file << "{\n  \"stages\": [\n";
+    for (size_t i = 0; i < summaries.size(); i++) {
+        const Summary& summary = summaries[i];
+        file << "    {\"stage\": \"" << summary.stage << "\", \"frames\": " << summary.count << ", \"total_ms\": " << summary.total_ms
+            << ", \"mean_ms\": " << summary.mean_ms << ", \"p50_ms\": " << summary.p50_ms << ", \"p95_ms\": " << summary.p95_ms
+            << ", \"p99_ms\": " << summary.p99_ms << ", \"max_ms\": " << summary.max_ms << ", \"samples_ms\": [";
+        for (size_t frame = 0; frame < samples_[i].size(); frame++) {
+            file << (frame > 0 ? ", " : "") << samples_[i][frame];
+        }
+        file << "]}" << (i + 1 < summaries.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    if (!file.flush()) {
+        throw std::runtime_error("[THROW] FrameStats::write_json: Could not write " + filename);
+    }
+}
@@ -0,0 +1,117 @@
+/**
+ * @file FrameStats.hpp
+ * @brief Per-frame timings of the pipeline stages and their percentiles.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @class FrameStats
+ * @brief Collects one time sample per frame and stage, from any thread.
+ *
+ * The host stages are measured with a steady clock, the device stages with the profiling events of the
+ * OpenCL queue. The samples of a stage are numbered in the order they were recorded, which is not the frame
+ * number: the segment workers interleave their frames, and some stages, such as the palette builds, skip
+ * frames. The samples of different stages therefore cannot be joined on their number.
+ */
+class FrameStats {
+public:
+    /**
+     * @struct Summary
+     * @brief Distribution of the samples of a stage.
+     */
+    struct Summary {
+        std::string stage;      ///< Name of the stage
+        size_t count = 0;       ///< Number of samples
+        double total_ms = 0;    ///< Sum of the samples
+        double mean_ms = 0;     ///< Mean sample
+        double p50_ms = 0;      ///< Median
+        double p95_ms = 0;      ///< 95th percentile
+        double p99_ms = 0;      ///< 99th percentile
+        double max_ms = 0;      ///< Slowest sample
+    };
+
+    /**
+     * @brief Adds the sample of a frame to a stage, creating the stage on first use.
+     * @param stage The name of the stage.
+     * @param milliseconds The time spent in the stage.
+     */
+    void record(const std::string& stage, double milliseconds);
+
+    /**
+     * @brief Computes the distribution of every stage, in the order the stages were first recorded.
+     */
+    std::vector<Summary> summarize() const;
+
+    /**
+     * @brief Prints the distribution of every stage as an aligned table.
+     */
+    void print(std::ostream& out) const;
+
+    /**
+     * @brief Writes every sample as CSV, one row per sample with its stage and its index within the stage.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void write_csv(const std::string& filename) const;
+
+    /**
+     * @brief Writes the distributions and every sample as JSON.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void write_json(const std::string& filename) const;
+
+private:
+    mutable std::mutex mutex_;                          ///< Guards the samples, the stages are recorded from several threads
+    std::map<std::string, size_t> stage_index_;         ///< Position of every stage in samples_
+    std::vector<std::string> stages_;                   ///< Names of the stages in recording order
+    std::vector<std::vector<double>> samples_;          ///< Samples of every stage in milliseconds
+};
+
+/**
+ * @class StageTimer
+ * @brief Records the wall time of a scope as a sample of a stage, does nothing without a collector.
+ */
+class StageTimer {
+public:
+    /**
+     * @brief Starts timing the scope.
+     * @param stats The collector, null to skip the measure.
+     * @param stage The name of the stage, it must outlive the timer.
+     */
+    StageTimer(FrameStats* stats, const char* stage) : stats_(stats), stage_(stage) {
+        if (stats_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    /**
+     * @brief Records the time elapsed since the construction.
+     */
+    ~StageTimer() {
+        if (stats_) {
+            stats_->record(stage_, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count());
+        }
+    }
+
+    /**
+     * @brief Drops the measure, e.g. when the scope found no frame to work on.
+     */
+    void discard() {
+        stats_ = nullptr;
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    FrameStats* stats_;                                 ///< The collector, null when not measuring
+    const char* stage_;                                 ///< Name of the stage
+    std::chrono::steady_clock::time_point start_;       ///< When the scope started
+};
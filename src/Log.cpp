@@ -0,0 +1,165 @@
+/**
+ * @file Log.cpp
+ * @brief Implementation of the background log sink.
+ */
+#include "Log.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+    /**
+     * @class Sink
+     * @brief Queue of messages drained by a single thread writing them to stderr.
+     *
+     * The producers only take a mutex to append to the queue, the console I/O happens on the sink thread,
+     * in batches. The sink is a function-local static, so it is drained and joined at exit, std::exit included.
+     */
+    class Sink {
+    public:
+        ~Sink() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            if (thread_.joinable()) {
+                thread_.join();
+            }
+        }
+
+        void push(logging::Level level, std::string message) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!thread_.joinable()) {
+                    thread_ = std::thread(&Sink::run, this);
+                }
+                queue_.emplace_back(level, std::move(message));
+                pushed_++;
+            }
+            wake_.notify_all();
+        }
+
+        void flush() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            const uint64_t target = pushed_;
+            drained_.wait(lock, [&]() { return written_ >= target || !thread_.joinable(); });
+        }
+
+    private:
+        void run() {
+            std::deque<std::pair<logging::Level, std::string>> batch;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                wake_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+                if (queue_.empty() && stopping_) {
+                    return;
+                }
+                batch.swap(queue_);
+                lock.unlock();
+                std::string text;
+                for (const auto& [level, message] : batch) {
+                    text += prefix(level);
+                    text += message;
+                    text += '\n';
+                }
+                std::fwrite(text.data(), 1, text.size(), stderr);
+                std::fflush(stderr);
+                const uint64_t count = batch.size();
+                batch.clear();
+                lock.lock();
+                written_ += count;
+                drained_.notify_all();
+            }
+        }
+
+        static const char* prefix(logging::Level level) {
+            switch (level) {
+                case logging::Level::DEBUG:
+                    return "[DEBUG] ";
+                case logging::Level::WARNING:
+                    return "[WARNING] ";
+                case logging::Level::ERROR:
+                    return "[ERROR] ";
+                default:
+                    return "[INFO] ";
+            }
+        }
+
+        std::mutex mutex_;                                              ///< Guards the queue and the counters
+        std::condition_variable wake_;                                  ///< Signals new messages or the shutdown to the sink thread
+        std::condition_variable drained_;                               ///< Signals written messages to flush()
+        std::deque<std::pair<logging::Level, std::string>> queue_;      ///< Messages waiting to be written
+        uint64_t pushed_ = 0;                                           ///< Messages queued so far
+        uint64_t written_ = 0;                                          ///< Messages written so far
+        bool stopping_ = false;                                         ///< The sink drains the queue and stops
+        std::thread thread_;                                            ///< The sink thread, started by the first message
+    };
+
+    Sink& sink() {
+        static Sink instance;
+        return instance;
+    }
+
+    std::atomic<int> current_level{ static_cast<int>(logging::Level::INFO) };
+}
+
+namespace logging {
+    void set_level(Level level) {
+        current_level.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    bool parse_level(const std::string& name, Level& level) {
+        if (name == "debug") {
+            level = Level::DEBUG;
+        } else if (name == "info") {
+            level = Level::INFO;
+        } else if (name == "warning") {
+            level = Level::WARNING;
+        } else if (name == "error") {
+            level = Level::ERROR;
+        } else if (name == "quiet") {
+            level = Level::OFF;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool enabled(Level level) {
+        return static_cast<int>(level) >= current_level.load(std::memory_order_relaxed);
+    }
+
+    void write(Level level, std::string message) {
+        sink().push(level, std::move(message));
+    }
+
+    void flush() {
+        sink().flush();
+    }
+
+    Progress::Progress(std::string what, std::chrono::milliseconds interval)
+        : what_(std::move(what)), interval_(interval), next_(std::chrono::steady_clock::time_point::min()) {
+    }
+
+    void Progress::update(int64_t current, int64_t total) {
+        if (!enabled(Level::INFO)) {
+            return;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (now < next_) {
+            return;
+        }
+        next_ = now + interval_;
+        if (total > 0) {
+            LOG_INFO(what_ << " " << current << " of " << total);
+        } else {
+            LOG_INFO(what_ << " " << current);
+        }
+    }
+} // namespace logging
@@ -0,0 +1,111 @@
+/**
+ * @file Log.hpp
+ * @brief Leveled logging written to stderr by a background thread, so that logging never blocks on the console.
+ *
+ * The LOG_* macros take a stream expression, e.g. LOG_INFO("Video width: " << width), which is only
+ * evaluated when the level is enabled. LOG_DEBUG compiles to nothing unless VCQ_DEBUG_LOG is defined,
+ * so the debug messages of the hot paths cost nothing in release builds.
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace logging {
+    /**
+     * @brief Severity of a message, a level enables itself and every level above it.
+     */
+    enum class Level : int {
+        DEBUG = 0,      ///< Details of every operation, compiled out of release builds
+        INFO = 1,       ///< Progress and settings
+        WARNING = 2,    ///< Something was ignored or adjusted
+        ERROR = 3,      ///< The operation failed
+        OFF = 4         ///< Nothing is logged
+    };
+
+    /**
+     * @brief Sets the lowest level that is logged, INFO by default.
+     */
+    void set_level(Level level);
+
+    /**
+     * @brief Parses a level name: debug, info, warning, error or quiet.
+     * @param name The name.
+     * @param level Receives the level.
+     * @return Whether the name is valid.
+     */
+    bool parse_level(const std::string& name, Level& level);
+
+    /**
+     * @brief Tells whether messages of a level are logged.
+     */
+    bool enabled(Level level);
+
+    /**
+     * @brief Queues a message for the background thread, starting it on first use.
+     * @param level The severity of the message.
+     * @param message The message, without the trailing newline.
+     */
+    void write(Level level, std::string message);
+
+    /**
+     * @brief Waits until every queued message has been written, e.g. before exiting the process.
+     */
+    void flush();
+
+    /**
+     * @brief Gets a name returned by a C library, or "unknown" when it is null, which cannot be streamed.
+     */
+    inline const char* or_unknown(const char* name) {
+        return name ? name : "unknown";
+    }
+
+    /**
+     * @class Progress
+     * @brief Logs the progress of a long operation at most once per interval, whatever the number of updates.
+     */
+    class Progress {
+    public:
+        /**
+         * @brief Constructs the progress of an operation.
+         * @param what Description of the counted items, e.g. "Reading frame".
+         * @param interval Shortest time between two messages.
+         */
+        explicit Progress(std::string what, std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+        /**
+         * @brief Reports the current count, logged only if the interval has elapsed since the last message.
+         * @param current The number of items done.
+         * @param total The number of items expected, 0 when unknown.
+         */
+        void update(int64_t current, int64_t total = 0);
+
+    private:
+        std::string what_;                                  ///< Description of the counted items
+        std::chrono::milliseconds interval_;                ///< Shortest time between two messages
+        std::chrono::steady_clock::time_point next_;        ///< When the next message can be logged
+    };
+} // namespace logging
+
+/**
+ * @brief Logs a stream expression at a level, evaluating it only when the level is enabled.
+ */
+#define VCQ_LOG(level, expression) \
+    do { \
+        if (logging::enabled(level)) { \
+            std::ostringstream vcq_log_stream; \
+            vcq_log_stream << expression; \
+            logging::write(level, vcq_log_stream.str()); \
+        } \
+    } while (0)
+
+#ifdef VCQ_DEBUG_LOG
+#define LOG_DEBUG(expression) VCQ_LOG(logging::Level::DEBUG, expression)
+#else
+#define LOG_DEBUG(expression) do { } while (0)
+#endif
+#define LOG_INFO(expression) VCQ_LOG(logging::Level::INFO, expression)
+#define LOG_WARNING(expression) VCQ_LOG(logging::Level::WARNING, expression)
+#define LOG_ERROR(expression) VCQ_LOG(logging::Level::ERROR, expression)
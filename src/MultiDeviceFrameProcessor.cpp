@@ -0,0 +1,259 @@
+/**
+ * @file MultiDeviceFrameProcessor.cpp
+ * @brief Implementation of the MultiDeviceFrameProcessor class.
+ */
+#include "MultiDeviceFrameProcessor.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    /// Weight of the last frame in the moving average of the time per frame
+    const double FRAME_TIME_SMOOTHING = 0.2;
+
+    /**
+     * @brief Parses a non-negative index of a device list.
+     */
+    cl_uint parse_index(const std::string& text, const std::string& spec) {
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+            throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::select_devices: Invalid device list " + spec);
+        }
+        return static_cast<cl_uint>(std::stoul(text));
+    }
+
+    /**
+     * @brief Gets the partition properties of a partition name.
+     * @return The zero-terminated properties, empty for no partition.
+     */
+    std::vector<cl_device_partition_property> partition_properties(const std::string& partition) {
+        if (partition == "none") {
+            return {};
+        }
+        if (partition == "numa") {
+            return { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+        }
+        const std::string prefix = "equally:";
+        if (partition.compare(0, prefix.size(), prefix) == 0) {
+            const std::string units = partition.substr(prefix.size());
+            if (!units.empty() && units.find_first_not_of("0123456789") == std::string::npos && std::stoul(units) > 0) {
+                return { CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(std::stoul(units)), 0 };
+            }
+        }
+        throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::select_devices: Invalid partition " + partition
+            + ", expected none, numa or equally:<compute units>");
+    }
+}
+
+std::vector<cl_device_id> MultiDeviceFrameProcessor::select_devices(const std::string& spec, const std::string& partition) {
+    const std::vector<cl_device_partition_property> properties = partition_properties(partition);
+
+    std::vector<cl_device_id> selected;
+    if (spec == "all") {
+        cl_uint n_platforms;
+        ocl::check(clGetPlatformIDs(0, nullptr, &n_platforms), "Getting platform count");
+        std::vector<cl_platform_id> platforms(n_platforms);
+        ocl::check(clGetPlatformIDs(n_platforms, platforms.data(), nullptr), "Getting platforms");
+        for (cl_platform_id platform : platforms) {
+            for (cl_device_id device : ocl::platform_devices(platform)) {
+                selected.push_back(device);
+            }
+        }
+    } else {
+        cl_platform_id default_platform = nullptr;
+        std::stringstream items(spec);
+        std::string item;
+        while (std::getline(items, item, ',')) {
+            cl_platform_id platform;
+            std::string device_index = item;
+            const size_t separator = item.find(':');
+            if (separator != std::string::npos) {
+                cl_uint n_platforms;
+                ocl::check(clGetPlatformIDs(0, nullptr, &n_platforms), "Getting platform count");
+                std::vector<cl_platform_id> platforms(n_platforms);
+                ocl::check(clGetPlatformIDs(n_platforms, platforms.data(), nullptr), "Getting platforms");
+                const cl_uint platform_index = parse_index(item.substr(0, separator), spec);
+                if (platform_index >= n_platforms) {
+                    throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::select_devices: No platform " + std::to_string(platform_index));
+                }
+                platform = platforms[platform_index];
+                device_index = item.substr(separator + 1);
+            } else {
+                if (!default_platform) {
+                    default_platform = ocl::select_platform();
+                }
+                platform = default_platform;
+            }
+            const std::vector<cl_device_id> devices = ocl::platform_devices(platform);
+            const cl_uint index = parse_index(device_index, spec);
+            if (index >= devices.size()) {
+                throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::select_devices: No device " + item);
+            }
+            if (std::find(selected.begin(), selected.end(), devices[index]) != selected.end()) {
+                throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::select_devices: Device " + item + " is listed twice");
+            }
+            selected.push_back(devices[index]);
+        }
+    }
+    if (selected.empty()) {
+        throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::select_devices: No device in " + spec);
+    }
+    if (properties.empty()) {
+        return selected;
+    }
+
+    std::vector<cl_device_id> partitioned;
+    for (cl_device_id device : selected) {
+        const std::vector<cl_device_id> sub_devices = ocl::create_sub_devices(device, properties.data());
+        if (sub_devices.empty()) {
+            LOG_WARNING("Device " << ocl::device_string(device, CL_DEVICE_NAME) << " cannot be partitioned with " << partition
+                << ", it is used as a whole");
+            partitioned.push_back(device);
+        } else {
+            LOG_INFO("Device " << ocl::device_string(device, CL_DEVICE_NAME) << " split into " << sub_devices.size() << " sub-devices");
+            partitioned.insert(partitioned.end(), sub_devices.begin(), sub_devices.end());
+        }
+    }
+    return partitioned;
+}
+
+MultiDeviceFrameProcessor::MultiDeviceFrameProcessor(std::vector<cl_device_id> devices, const QuantizationSettings& settings,
+    int width, int height, const std::string& kernel_file, const std::string& program_cache, size_t frames_in_flight,
+    size_t batch_frames)
+    : device_ids_(std::move(devices)), staging_(static_cast<size_t>(width) * height * 4) {
+    if (device_ids_.empty()) {
+        throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::MultiDeviceFrameProcessor: No device");
+    }
+    if (settings.palette_size > 0 && device_ids_.size() > 1) {
+        // every device would follow the scenes of its own frames and build different palettes
+        throw std::runtime_error("[THROW] MultiDeviceFrameProcessor::MultiDeviceFrameProcessor: The palette mode runs on a single device");
+    }
+    devices_.resize(device_ids_.size());
+    for (size_t i = 0; i < device_ids_.size(); i++) {
+        devices_[i].processor = std::make_unique<OpenCLFrameProcessor>(device_ids_[i], settings, width, height,
+            kernel_file, program_cache, frames_in_flight, batch_frames);
+        LOG_INFO("Device " << i << ": " << devices_[i].processor->name());
+    }
+}
+
+MultiDeviceFrameProcessor::~MultiDeviceFrameProcessor() {
+    std::ostringstream counts;
+    for (int64_t frames : frame_counts()) {
+        counts << " " << frames;
+    }
+    LOG_INFO("Frames per device:" << counts.str());
+    // the processors wait for their frames in flight, then the sub-devices can go
+    devices_.clear();
+    for (cl_device_id device : device_ids_) {
+        clReleaseDevice(device);
+    }
+}
+
+void MultiDeviceFrameProcessor::process(const uint8_t* bgra_frame, uint8_t* rgba_frame) {
+    submit(bgra_frame, rgba_frame);
+    while (!reorder_.empty()) {
+        complete();
+    }
+}
+
+uint8_t* MultiDeviceFrameProcessor::map_input() {
+    // the device is only chosen at submission, so the frame is staged on the host
+    return staging_.data();
+}
+
+void MultiDeviceFrameProcessor::process_mapped(uint8_t* rgba_frame) {
+    process(staging_.data(), rgba_frame);
+}
+
+void MultiDeviceFrameProcessor::process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) {
+    while (!reorder_.empty()) {
+        complete();
+    }
+    devices_.front().processor->process_yuv420(input, output, full_range);
+}
+
+void MultiDeviceFrameProcessor::quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) {
+    while (!reorder_.empty()) {
+        complete();
+    }
+    devices_.front().processor->quantize_yuv420_planes(input, output);
+}
+
+size_t MultiDeviceFrameProcessor::pick_device() const {
+    size_t best = devices_.size();
+    double best_finish = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < devices_.size(); i++) {
+        const Device& device = devices_[i];
+        if (device.in_flight == device.processor->max_in_flight()) {
+            continue;
+        }
+        // the frame waits for the ones already on the device, an unmeasured device is tried first
+        const double finish = (device.in_flight + 1) * device.frame_ms;
+        if (finish < best_finish) {
+            best = i;
+            best_finish = finish;
+        }
+    }
+    return best;
+}
+
+void MultiDeviceFrameProcessor::submit(const uint8_t* bgra_frame, uint8_t* rgba_frame) {
+    size_t index = pick_device();
+    while (index == devices_.size()) {
+        // every slot is taken, retiring the oldest frame frees one on its device
+        complete();
+        index = pick_device();
+    }
+    Device& device = devices_[index];
+    device.processor->submit(bgra_frame, rgba_frame);
+    device.in_flight++;
+    reorder_.push_back(index);
+}
+
+void MultiDeviceFrameProcessor::complete() {
+    if (reorder_.empty()) {
+        return;
+    }
+    // every device completes its frames in order, so the oldest frame overall is the oldest of its device
+    Device& device = devices_[reorder_.front()];
+    reorder_.pop_front();
+    device.processor->complete();
+    device.in_flight--;
+    device.frames++;
+    const double frame_ms = device.processor->last_frame_ms();
+    device.frame_ms = device.frame_ms == 0 ? frame_ms : (1 - FRAME_TIME_SMOOTHING) * device.frame_ms + FRAME_TIME_SMOOTHING * frame_ms;
+}
+
+size_t MultiDeviceFrameProcessor::max_in_flight() const {
+    size_t total = 0;
+    for (const Device& device : devices_) {
+        total += device.processor->max_in_flight();
+    }
+    return total;
+}
+
+std::string MultiDeviceFrameProcessor::name() const {
+    std::string description = "opencl on " + std::to_string(devices_.size()) + " devices (";
+    for (size_t i = 0; i < devices_.size(); i++) {
+        description += (i > 0 ? "; " : "") + devices_[i].processor->name();
+    }
+    return description + ")";
+}
+
+void MultiDeviceFrameProcessor::set_stats(FrameStats* stats) {
+    FrameProcessor::set_stats(stats);
+    for (Device& device : devices_) {
+        device.processor->set_stats(stats);
+    }
+}
+
+std::vector<int64_t> MultiDeviceFrameProcessor::frame_counts() const {
+    std::vector<int64_t> counts;
+    for (const Device& device : devices_) {
+        counts.push_back(device.frames);
+    }
+    return counts;
+}
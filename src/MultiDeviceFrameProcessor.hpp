@@ -0,0 +1,115 @@
+/**
+ * @file MultiDeviceFrameProcessor.hpp
+ * @brief OpenCL backend spreading the frames over several devices or sub-devices.
+ */
+#pragma once
+
+#include "FrameProcessor.hpp"
+#include "OpenCLFrameProcessor.hpp"
+#include "ocl_utility.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @class MultiDeviceFrameProcessor
+ * @brief Dispatches the submitted frames to one OpenCLFrameProcessor per device and hands them back in order.
+ *
+ * Every device has its own context, queues, programs and buffer pools. A frame goes to the device that is
+ * expected to finish it first, from the frames it already holds and its measured time per frame, so that a
+ * faster device gets proportionally more frames. The frames finish out of order across devices: a reorder
+ * buffer remembers which device holds every submitted frame and complete() retires them in submission order.
+ * The palette mode carries state from frame to frame and cannot be split across devices.
+ */
+class MultiDeviceFrameProcessor : public FrameProcessor {
+public:
+    /**
+     * @brief Selects devices from a list, optionally splitting each of them into sub-devices.
+     * @param spec "all" for every device of every platform, or a comma-separated list of device indices on the
+     * platform of OCL_PLATFORM, each one optionally prefixed by its platform index (e.g. "0,1" or "0:0,1:0").
+     * @param partition "none", "numa" for one sub-device per NUMA node, or "equally:<n>" for sub-devices of n compute units.
+     * @return The devices, to be released with clReleaseDevice.
+     * @throws std::runtime_error if the list or the partition is invalid.
+     */
+    static std::vector<cl_device_id> select_devices(const std::string& spec, const std::string& partition);
+
+    /**
+     * @brief Creates a processor on every device.
+     * @param devices The devices, owned by the processor from now on.
+     * @param settings The operations applied to every frame.
+     * @param width The width of the frames.
+     * @param height The height of the frames.
+     * @param kernel_file The file containing the OpenCL kernels, empty for the kernels embedded in the executable.
+     * @param program_cache The directory of the compiled program binaries, empty to always build from source.
+     * @param frames_in_flight The number of batches in flight on every device.
+     * @param batch_frames The number of frames per kernel launch on every device, 0 to choose it from the resolution.
+     * @throws std::runtime_error if there is no device or the settings use a palette.
+     */
+    MultiDeviceFrameProcessor(std::vector<cl_device_id> devices, const QuantizationSettings& settings, int width, int height,
+        const std::string& kernel_file, const std::string& program_cache, size_t frames_in_flight, size_t batch_frames);
+
+    /**
+     * @brief Destructor that waits for the frames in flight and releases the devices.
+     */
+    ~MultiDeviceFrameProcessor() override;
+
+    MultiDeviceFrameProcessor(const MultiDeviceFrameProcessor&) = delete;
+    MultiDeviceFrameProcessor& operator=(const MultiDeviceFrameProcessor&) = delete;
+
+    void process(const uint8_t* bgra_frame, uint8_t* rgba_frame) override;
+
+    uint8_t* map_input() override;
+
+    void process_mapped(uint8_t* rgba_frame) override;
+
+    /**
+     * @brief Processes a planar frame on the first device, the planar paths are synchronous.
+     */
+    void process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) override;
+
+    /**
+     * @brief Quantizes the planes of a frame on the first device, the planar paths are synchronous.
+     */
+    void quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) override;
+
+    void submit(const uint8_t* bgra_frame, uint8_t* rgba_frame) override;
+
+    void complete() override;
+
+    size_t max_in_flight() const override;
+
+    std::string name() const override;
+
+    void set_stats(FrameStats* stats) override;
+
+    /**
+     * @brief Gets how many frames every device has processed, to verify the balance.
+     */
+    std::vector<int64_t> frame_counts() const;
+
+private:
+    /**
+     * @struct Device
+     * @brief A device with its processor and the measures driving the dispatch.
+     */
+    struct Device {
+        std::unique_ptr<OpenCLFrameProcessor> processor;    ///< Processor bound to the device
+        size_t in_flight = 0;                               ///< Frames submitted to the device and not completed yet
+        double frame_ms = 0;                                ///< Moving average of the device time per frame, 0 until measured
+        int64_t frames = 0;                                 ///< Frames completed by the device
+    };
+
+    /**
+     * @brief Picks the device expected to finish a new frame first, among the ones with a free slot.
+     * @return The index of the device, or the number of devices if all of them are full.
+     */
+    size_t pick_device() const;
+
+    std::vector<cl_device_id> device_ids_;      ///< The devices, released at destruction
+    std::vector<Device> devices_;               ///< Processors of the devices
+    std::deque<size_t> reorder_;                ///< Device of every submitted frame not completed yet, oldest first
+    std::vector<uint8_t> staging_;              ///< Host frame returned by map_input()
+};
@@ -0,0 +1,1108 @@
+/**
+ * @file OpenCLFrameProcessor.cpp
+ * @brief Implementation of the OpenCLFrameProcessor class and of the kernel launch helpers.
+ */
+#include "OpenCLFrameProcessor.hpp"
+#include "Log.hpp"
+#include "ocl_kernels.hpp"
+
+#include <algorithm>
+#include <utility>
+
+cl_event brga_to_rgba(cl_command_queue queue, cl_kernel bgra_to_rgba_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer)
+{
+    uint nels = width * height;
+    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
+
+    LOG_DEBUG("number of elements " << nels << " round to " << lws_in << " GWS " << gws[0]);
+
+    cl_int err = clSetKernelArg(bgra_to_rgba_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 0");
+
+    err = clSetKernelArg(bgra_to_rgba_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 1");
+
+    err = clSetKernelArg(bgra_to_rgba_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 2");
+
+    err = clSetKernelArg(bgra_to_rgba_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 3");
+
+    cl_event bgra_to_rgba_evt;
+    err = clEnqueueNDRangeKernel(queue, bgra_to_rgba_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &bgra_to_rgba_evt); // evento di questo comando
+    ocl::check(err, "Enqueue brga_to_rgba");
+
+    return bgra_to_rgba_evt;
+}
+
+cl_event rgba_to_grayscale(cl_command_queue queue, cl_kernel rgba_to_grayscale_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer)
+{
+    const size_t gws[] = { ocl::round_mul_up(width, lws_in), ocl::round_mul_up(height, lws_in) };
+    LOG_DEBUG("number of elements " << width * height << " round to " << lws_in << " GWS " << gws[0]);
+    cl_int err = clSetKernelArg(rgba_to_grayscale_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 0");
+    err = clSetKernelArg(rgba_to_grayscale_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 1");
+    err = clSetKernelArg(rgba_to_grayscale_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 2");
+    err = clSetKernelArg(rgba_to_grayscale_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 3");
+    cl_event rgba_to_grayscale_evt;
+    err = clEnqueueNDRangeKernel(queue, rgba_to_grayscale_kernel,
+        2, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &rgba_to_grayscale_evt); // evento di questo comando
+    ocl::check(err, "Enqueue rgba_to_grayscale");
+    return rgba_to_grayscale_evt;
+}
+
+cl_event uniform_quantize(cl_command_queue queue, cl_kernel uniform_quantize_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, int levels)
+{
+    const size_t gws[] = { ocl::round_mul_up(width, lws_in), ocl::round_mul_up(height, lws_in) };
+    LOG_DEBUG("number of elements " << width * height << " round to " << lws_in << " GWS " << gws[0]);
+    cl_int err = clSetKernelArg(uniform_quantize_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg uniform_quantize_kernel 0");
+    err = clSetKernelArg(uniform_quantize_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg uniform_quantize_kernel 1");
+    err = clSetKernelArg(uniform_quantize_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg uniform_quantize_kernel 2");
+    err = clSetKernelArg(uniform_quantize_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg uniform_quantize_kernel 3");
+    err = clSetKernelArg(uniform_quantize_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg uniform_quantize_kernel 4");
+    cl_event uniform_quantize_evt;
+    err = clEnqueueNDRangeKernel(queue, uniform_quantize_kernel,
+        2, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &uniform_quantize_evt); // evento di questo comando
+    ocl::check(err, "Enqueue uniform_quantize");
+    return uniform_quantize_evt;
+}
+
+cl_event bgra_quantize_fused(cl_command_queue queue, cl_kernel fused_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode)
+{
+    uint nels = width * height;
+    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
+    cl_int err = clSetKernelArg(fused_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 0");
+    err = clSetKernelArg(fused_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 1");
+    err = clSetKernelArg(fused_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 2");
+    err = clSetKernelArg(fused_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 3");
+    err = clSetKernelArg(fused_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 4");
+    err = clSetKernelArg(fused_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 5");
+    err = clSetKernelArg(fused_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg bgra_quantize_fused 6");
+    cl_event fused_evt;
+    err = clEnqueueNDRangeKernel(queue, fused_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &fused_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_quantize_fused");
+    return fused_evt;
+}
+cl_event bgra_lut_fused(cl_command_queue queue, cl_kernel lut_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int grayscale, cl_mem lut_buffer)
+{
+    uint nels = width * height;
+    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
+    cl_int err = clSetKernelArg(lut_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_lut_fused 0");
+    err = clSetKernelArg(lut_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_lut_fused 1");
+    err = clSetKernelArg(lut_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_lut_fused 2");
+    err = clSetKernelArg(lut_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_lut_fused 3");
+    err = clSetKernelArg(lut_kernel, 4, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_lut_fused 4");
+    err = clSetKernelArg(lut_kernel, 5, sizeof(lut_buffer), &lut_buffer);
+    ocl::check(err, "setKernelArg bgra_lut_fused 5");
+    cl_event lut_evt;
+    err = clEnqueueNDRangeKernel(queue, lut_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &lut_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_lut_fused");
+    return lut_evt;
+}
+
+cl_event bgra_quantize_fused_batch(cl_command_queue queue, cl_kernel fused_batch_kernel, cl_int width, cl_int height, cl_int frames,
+    size_t lws_in, cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode)
+{
+    // one work item per pixel of every frame, only the rows are rounded up
+    const size_t gws[] = { ocl::round_mul_up(width, lws_in), static_cast<size_t>(height), static_cast<size_t>(frames) };
+    cl_int err = clSetKernelArg(fused_batch_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 0");
+    err = clSetKernelArg(fused_batch_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 1");
+    err = clSetKernelArg(fused_batch_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 2");
+    err = clSetKernelArg(fused_batch_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 3");
+    err = clSetKernelArg(fused_batch_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 4");
+    err = clSetKernelArg(fused_batch_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 5");
+    err = clSetKernelArg(fused_batch_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg bgra_quantize_fused_batch 6");
+    cl_event fused_batch_evt;
+    err = clEnqueueNDRangeKernel(queue, fused_batch_kernel,
+        3, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &fused_batch_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_quantize_fused_batch");
+    return fused_batch_evt;
+}
+
+cl_event bgra_lut_fused_batch(cl_command_queue queue, cl_kernel lut_batch_kernel, cl_int width, cl_int height, cl_int frames,
+    size_t lws_in, cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int grayscale, cl_mem lut_buffer)
+{
+    const size_t gws[] = { ocl::round_mul_up(width, lws_in), static_cast<size_t>(height), static_cast<size_t>(frames) };
+    cl_int err = clSetKernelArg(lut_batch_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_lut_fused_batch 0");
+    err = clSetKernelArg(lut_batch_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_lut_fused_batch 1");
+    err = clSetKernelArg(lut_batch_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_lut_fused_batch 2");
+    err = clSetKernelArg(lut_batch_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_lut_fused_batch 3");
+    err = clSetKernelArg(lut_batch_kernel, 4, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_lut_fused_batch 4");
+    err = clSetKernelArg(lut_batch_kernel, 5, sizeof(lut_buffer), &lut_buffer);
+    ocl::check(err, "setKernelArg bgra_lut_fused_batch 5");
+    cl_event lut_batch_evt;
+    err = clEnqueueNDRangeKernel(queue, lut_batch_kernel,
+        3, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &lut_batch_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_lut_fused_batch");
+    return lut_batch_evt;
+}
+
+cl_event bgra_color_count(cl_command_queue queue, cl_kernel count_kernel, cl_int width, cl_int height,
+    size_t lws, size_t gws, cl_mem input_image_buffer, cl_mem counts_buffer)
+{
+    // the kernels loop over the frame, so the global size only depends on the device
+    const size_t gws_array[] = { gws };
+    const size_t lws_array[] = { lws };
+    cl_int err = clSetKernelArg(count_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg color count 0");
+    err = clSetKernelArg(count_kernel, 1, sizeof(width), &width);
+    ocl::check(err, "setKernelArg color count 1");
+    err = clSetKernelArg(count_kernel, 2, sizeof(height), &height);
+    ocl::check(err, "setKernelArg color count 2");
+    err = clSetKernelArg(count_kernel, 3, sizeof(counts_buffer), &counts_buffer);
+    ocl::check(err, "setKernelArg color count 3");
+    cl_event count_evt;
+    err = clEnqueueNDRangeKernel(queue, count_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws_array, // global work size
+        lws_array, // local work size, the local counters are shared by the work group
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &count_evt); // evento di questo comando
+    ocl::check(err, "Enqueue color count");
+    return count_evt;
+}
+
+cl_event bgra_palette_accumulate(cl_command_queue queue, cl_kernel accumulate_kernel, cl_int width, cl_int height,
+    size_t lws, size_t gws, cl_mem input_image_buffer, cl_mem palette_buffer, cl_int palette_size, cl_mem sums_buffer)
+{
+    const size_t gws_array[] = { gws };
+    const size_t lws_array[] = { lws };
+    cl_int err = clSetKernelArg(accumulate_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_accumulate 0");
+    err = clSetKernelArg(accumulate_kernel, 1, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_palette_accumulate 1");
+    err = clSetKernelArg(accumulate_kernel, 2, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_palette_accumulate 2");
+    err = clSetKernelArg(accumulate_kernel, 3, sizeof(palette_buffer), &palette_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_accumulate 3");
+    err = clSetKernelArg(accumulate_kernel, 4, sizeof(palette_size), &palette_size);
+    ocl::check(err, "setKernelArg bgra_palette_accumulate 4");
+    err = clSetKernelArg(accumulate_kernel, 5, sizeof(sums_buffer), &sums_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_accumulate 5");
+    cl_event accumulate_evt;
+    err = clEnqueueNDRangeKernel(queue, accumulate_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws_array, // global work size
+        lws_array, // local work size, the local sums are shared by the work group
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &accumulate_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_palette_accumulate");
+    return accumulate_evt;
+}
+
+cl_event bgra_palette_map(cl_command_queue queue, cl_kernel palette_map_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_mem palette_buffer, cl_int palette_size)
+{
+    uint nels = width * height;
+    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
+    cl_int err = clSetKernelArg(palette_map_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map 0");
+    err = clSetKernelArg(palette_map_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map 1");
+    err = clSetKernelArg(palette_map_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_palette_map 2");
+    err = clSetKernelArg(palette_map_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_palette_map 3");
+    err = clSetKernelArg(palette_map_kernel, 4, sizeof(palette_buffer), &palette_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map 4");
+    err = clSetKernelArg(palette_map_kernel, 5, sizeof(palette_size), &palette_size);
+    ocl::check(err, "setKernelArg bgra_palette_map 5");
+    cl_event palette_map_evt;
+    err = clEnqueueNDRangeKernel(queue, palette_map_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &palette_map_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_palette_map");
+    return palette_map_evt;
+}
+
+cl_event build_palette_cube(cl_command_queue queue, cl_kernel cube_kernel, size_t lws_in,
+    cl_mem palette_buffer, cl_int palette_size, cl_mem cube_buffer)
+{
+    // one work item per cell
+    const size_t gws[] = { ocl::round_mul_up(palette::CUBE_CELLS, lws_in) };
+    cl_int err = clSetKernelArg(cube_kernel, 0, sizeof(palette_buffer), &palette_buffer);
+    ocl::check(err, "setKernelArg build_palette_cube 0");
+    err = clSetKernelArg(cube_kernel, 1, sizeof(palette_size), &palette_size);
+    ocl::check(err, "setKernelArg build_palette_cube 1");
+    err = clSetKernelArg(cube_kernel, 2, sizeof(cube_buffer), &cube_buffer);
+    ocl::check(err, "setKernelArg build_palette_cube 2");
+    cl_event cube_evt;
+    err = clEnqueueNDRangeKernel(queue, cube_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &cube_evt); // evento di questo comando
+    ocl::check(err, "Enqueue build_palette_cube");
+    return cube_evt;
+}
+
+cl_event bgra_palette_map_cube(cl_command_queue queue, cl_kernel map_cube_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_mem palette_buffer, cl_int palette_size, cl_mem cube_buffer)
+{
+    uint nels = width * height;
+    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
+    cl_int err = clSetKernelArg(map_cube_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 0");
+    err = clSetKernelArg(map_cube_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 1");
+    err = clSetKernelArg(map_cube_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 2");
+    err = clSetKernelArg(map_cube_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 3");
+    err = clSetKernelArg(map_cube_kernel, 4, sizeof(palette_buffer), &palette_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 4");
+    err = clSetKernelArg(map_cube_kernel, 5, sizeof(palette_size), &palette_size);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 5");
+    err = clSetKernelArg(map_cube_kernel, 6, sizeof(cube_buffer), &cube_buffer);
+    ocl::check(err, "setKernelArg bgra_palette_map_cube 6");
+    cl_event map_cube_evt;
+    err = clEnqueueNDRangeKernel(queue, map_cube_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &map_cube_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_palette_map_cube");
+    return map_cube_evt;
+}
+
+cl_event bgra_dither_ordered(cl_command_queue queue, cl_kernel dither_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode,
+    cl_mem matrix_buffer, cl_int matrix_bits)
+{
+    uint nels = width * height;
+    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
+    cl_int err = clSetKernelArg(dither_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 0");
+    err = clSetKernelArg(dither_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 1");
+    err = clSetKernelArg(dither_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 2");
+    err = clSetKernelArg(dither_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 3");
+    err = clSetKernelArg(dither_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 4");
+    err = clSetKernelArg(dither_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 5");
+    err = clSetKernelArg(dither_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 6");
+    err = clSetKernelArg(dither_kernel, 7, sizeof(matrix_buffer), &matrix_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 7");
+    err = clSetKernelArg(dither_kernel, 8, sizeof(matrix_bits), &matrix_bits);
+    ocl::check(err, "setKernelArg bgra_dither_ordered 8");
+    cl_event dither_evt;
+    err = clEnqueueNDRangeKernel(queue, dither_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &dither_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_dither_ordered");
+    return dither_evt;
+}
+
+cl_event bgra_dither_ordered_batch(cl_command_queue queue, cl_kernel dither_batch_kernel, cl_int width, cl_int height, cl_int frames,
+    size_t lws_in, cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode,
+    cl_mem matrix_buffer, cl_int matrix_bits)
+{
+    const size_t gws[] = { ocl::round_mul_up(width, lws_in), static_cast<size_t>(height), static_cast<size_t>(frames) };
+    cl_int err = clSetKernelArg(dither_batch_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 0");
+    err = clSetKernelArg(dither_batch_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 1");
+    err = clSetKernelArg(dither_batch_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 2");
+    err = clSetKernelArg(dither_batch_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 3");
+    err = clSetKernelArg(dither_batch_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 4");
+    err = clSetKernelArg(dither_batch_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 5");
+    err = clSetKernelArg(dither_batch_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 6");
+    err = clSetKernelArg(dither_batch_kernel, 7, sizeof(matrix_buffer), &matrix_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 7");
+    err = clSetKernelArg(dither_batch_kernel, 8, sizeof(matrix_bits), &matrix_bits);
+    ocl::check(err, "setKernelArg bgra_dither_ordered_batch 8");
+    cl_event dither_batch_evt;
+    err = clEnqueueNDRangeKernel(queue, dither_batch_kernel,
+        3, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &dither_batch_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_dither_ordered_batch");
+    return dither_batch_evt;
+}
+
+cl_event bgra_dither_error_diffusion(cl_command_queue queue, cl_kernel diffusion_kernel, cl_int width, cl_int height,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode)
+{
+    // one work group per tile and one work item per row of the tile
+    const size_t lws[] = { static_cast<size_t>(dither::TILE_HEIGHT) };
+    const size_t gws[] = { static_cast<size_t>(dither::tile_count(width, height)) * dither::TILE_HEIGHT };
+    cl_int err = clSetKernelArg(diffusion_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 0");
+    err = clSetKernelArg(diffusion_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 1");
+    err = clSetKernelArg(diffusion_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 2");
+    err = clSetKernelArg(diffusion_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 3");
+    err = clSetKernelArg(diffusion_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 4");
+    err = clSetKernelArg(diffusion_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 5");
+    err = clSetKernelArg(diffusion_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg bgra_dither_error_diffusion 6");
+    cl_event diffusion_evt;
+    err = clEnqueueNDRangeKernel(queue, diffusion_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        lws, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &diffusion_evt); // evento di questo comando
+    ocl::check(err, "Enqueue bgra_dither_error_diffusion");
+    return diffusion_evt;
+}
+
+cl_event yuv420p_quantize_fused(cl_command_queue queue, cl_kernel yuv420_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode, cl_int full_range)
+{
+    // one work item per chroma sample
+    const size_t gws[] = { ocl::round_mul_up(yuv420_chroma_width(width), lws_in), ocl::round_mul_up(yuv420_chroma_height(height), lws_in) };
+    cl_int err = clSetKernelArg(yuv420_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 0");
+    err = clSetKernelArg(yuv420_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 1");
+    err = clSetKernelArg(yuv420_kernel, 2, sizeof(width), &width);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 2");
+    err = clSetKernelArg(yuv420_kernel, 3, sizeof(height), &height);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 3");
+    err = clSetKernelArg(yuv420_kernel, 4, sizeof(levels), &levels);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 4");
+    err = clSetKernelArg(yuv420_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 5");
+    err = clSetKernelArg(yuv420_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 6");
+    err = clSetKernelArg(yuv420_kernel, 7, sizeof(full_range), &full_range);
+    ocl::check(err, "setKernelArg yuv420p_quantize_fused 7");
+    cl_event yuv420_evt;
+    err = clEnqueueNDRangeKernel(queue, yuv420_kernel,
+        2, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &yuv420_evt); // evento di questo comando
+    ocl::check(err, "Enqueue yuv420p_quantize_fused");
+    return yuv420_evt;
+}
+cl_event yuv420p_quantize_planes(cl_command_queue queue, cl_kernel planes_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem image_buffer, cl_int luma_levels, cl_int chroma_levels, cl_int grayscale, cl_int mode)
+{
+    // one work item per sample of the packed frame
+    const size_t gws[] = { ocl::round_mul_up(yuv420_frame_size(width, height), lws_in) };
+    cl_int err = clSetKernelArg(planes_kernel, 0, sizeof(image_buffer), &image_buffer);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 0");
+    err = clSetKernelArg(planes_kernel, 1, sizeof(width), &width);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 1");
+    err = clSetKernelArg(planes_kernel, 2, sizeof(height), &height);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 2");
+    err = clSetKernelArg(planes_kernel, 3, sizeof(luma_levels), &luma_levels);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 3");
+    err = clSetKernelArg(planes_kernel, 4, sizeof(chroma_levels), &chroma_levels);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 4");
+    err = clSetKernelArg(planes_kernel, 5, sizeof(grayscale), &grayscale);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 5");
+    err = clSetKernelArg(planes_kernel, 6, sizeof(mode), &mode);
+    ocl::check(err, "setKernelArg yuv420p_quantize_planes 6");
+    cl_event planes_evt;
+    err = clEnqueueNDRangeKernel(queue, planes_kernel,
+        1, // numero dimensioni
+        NULL, // offset
+        gws, // global work size
+        NULL, // local work size
+        0, // numero di elementi nella waiting list
+        NULL, // waiting list
+        &planes_evt); // evento di questo comando
+    ocl::check(err, "Enqueue yuv420p_quantize_planes");
+    return planes_evt;
+}
+
+namespace {
+    /**
+     * @brief Gets the name of the single-operation quantization kernel for a mode.
+     */
+    const char* quantization_kernel_name(QuantizationMode mode) {
+        switch (mode) {
+            case QUANTIZE_LOWER_BOUND:
+                return "uniform_quantize_lower_bound";
+            case QUANTIZE_UPPER_BOUND:
+                return "uniform_quantize_upper_bound";
+            case QUANTIZE_BINARY:
+                return "uniform_quantize_binary_bitshift";
+            default:
+                return "uniform_quantize_nearest";
+        }
+    }
+}
+
+OpenCLFrameProcessor::OpenCLFrameProcessor(const QuantizationSettings& settings, int width, int height,
+    const std::string& kernel_file, const std::string& program_cache, size_t frames_in_flight, size_t batch_frames)
+    // Select the OpenCL platform and device
+    : OpenCLFrameProcessor(ocl::select_device(ocl::select_platform()), settings, width, height, kernel_file, program_cache,
+        frames_in_flight, batch_frames) {
+}
+
+OpenCLFrameProcessor::OpenCLFrameProcessor(cl_device_id device, const QuantizationSettings& settings, int width, int height,
+    const std::string& kernel_file, const std::string& program_cache, size_t frames_in_flight, size_t batch_frames)
+    : settings_(settings), width_(width), height_(height), device_(device), lws_in_(0), lut_buffer_(nullptr), dither_matrix_buffer_(nullptr),
+    histogram_buffer_(nullptr), signature_buffer_(nullptr), sums_buffer_(nullptr), palette_buffer_(nullptr), cube_buffer_(nullptr),
+    reduction_lws_(0), reduction_gws_(0), schedule_(settings.scene_threshold, settings.palette_interval),
+    batch_frames_(1), current_(nullptr), next_slot_(0), batch_open_(false), batch_count_(0), last_readback_end_(0), last_frame_ms_(0) {
+    ocl::check(clGetDeviceInfo(device_, CL_DEVICE_PLATFORM, sizeof(platform_), &platform_, nullptr), "Getting device platform");
+    char name[ocl::BUFSIZE];
+    ocl::check(clGetDeviceInfo(device_, CL_DEVICE_NAME, ocl::BUFSIZE, name, nullptr), "Getting device name");
+    device_name_ = name;
+    // Create the OpenCL context
+    context_ = ocl::create_context(platform_, device_);
+    // Create the command queues, the transfers get their own so that they overlap the kernels
+    queue_ = ocl::create_queue(context_, device_);
+    upload_queue_ = ocl::create_queue(context_, device_);
+    readback_queue_ = ocl::create_queue(context_, device_);
+    // Create the OpenCL program, specialized for the number of levels unless asked otherwise
+    programs_ = std::make_unique<ProgramCache>(context_, device_, kernel_file, program_cache);
+    const int program_levels = settings_.specialize ? settings_.levels : 0;
+    bgra_to_rgba_kernel_ = programs_->kernel("brga_to_rgba", program_levels);
+    grayscale_kernel_ = programs_->kernel("rgb_to_grayscale", program_levels);
+    quantization_kernel_ = programs_->kernel(quantization_kernel_name(settings_.mode), program_levels);
+    // the fused kernel does the channel swap, grayscale and quantization reading and writing every pixel once
+    fused_kernel_ = programs_->kernel("bgra_quantize_fused", program_levels);
+    lut_kernel_ = programs_->kernel("bgra_lut_fused", program_levels);
+    dither_ordered_kernel_ = programs_->kernel("bgra_dither_ordered", program_levels);
+    fused_batch_kernel_ = programs_->kernel("bgra_quantize_fused_batch", program_levels);
+    lut_batch_kernel_ = programs_->kernel("bgra_lut_fused_batch", program_levels);
+    dither_ordered_batch_kernel_ = programs_->kernel("bgra_dither_ordered_batch", program_levels);
+    error_diffusion_kernel_ = programs_->kernel("bgra_dither_error_diffusion", program_levels);
+    histogram_kernel_ = programs_->kernel("bgra_color_histogram", program_levels);
+    signature_kernel_ = programs_->kernel("bgra_color_signature", program_levels);
+    accumulate_kernel_ = programs_->kernel("bgra_palette_accumulate", program_levels);
+    palette_map_kernel_ = programs_->kernel("bgra_palette_map", program_levels);
+    cube_kernel_ = programs_->kernel("build_palette_cube", program_levels);
+    map_cube_kernel_ = programs_->kernel("bgra_palette_map_cube", program_levels);
+    yuv420_kernel_ = programs_->kernel("yuv420p_quantize_fused", program_levels);
+    yuv420_planes_kernel_ = programs_->kernel("yuv420p_quantize_planes", program_levels);
+    // get information on the preferred work group size
+    cl_int err = clGetKernelWorkGroupInfo(quantization_kernel_, device_, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+        sizeof(lws_in_), &lws_in_, nullptr);  // TODO also change from parameters in the future
+    ocl::check(err, "Getting preferred work group size");
+
+    if (!settings_.lut.empty()) {
+        // the table is uploaded once, the kernel reads it from constant memory
+        lut_buffer_ = clCreateBuffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            settings_.lut.size(), settings_.lut.data(), &err);
+        ocl::check(err, "Creating lookup table buffer");
+    }
+
+    if (settings_.dither == DITHER_BAYER || settings_.dither == DITHER_BLUE_NOISE) {
+        // the threshold matrix is uploaded once, the kernel reads it from constant memory
+        std::vector<uint8_t> matrix = dither::threshold_matrix(settings_.dither);
+        dither_matrix_buffer_ = clCreateBuffer(context_, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+            matrix.size(), matrix.data(), &err);
+        ocl::check(err, "Creating dither matrix buffer");
+    }
+
+    if (settings_.palette_size > 0) {
+        histogram_buffer_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, palette::HISTOGRAM_BINS * sizeof(cl_uint), nullptr, &err);
+        ocl::check(err, "Creating histogram buffer");
+        signature_buffer_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, palette::SIGNATURE_BINS * sizeof(cl_uint), nullptr, &err);
+        ocl::check(err, "Creating signature buffer");
+        sums_buffer_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, 4 * palette::MAX_COLORS * sizeof(cl_uint), nullptr, &err);
+        ocl::check(err, "Creating k-means sums buffer");
+        palette_buffer_ = clCreateBuffer(context_, CL_MEM_READ_ONLY, palette::MAX_COLORS * sizeof(palette::Color), nullptr, &err);
+        ocl::check(err, "Creating palette buffer");
+        cube_buffer_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, palette::CUBE_CELLS * palette::CUBE_CELL_SIZE, nullptr, &err);
+        ocl::check(err, "Creating palette cube buffer");
+        // a few work groups per compute unit, each merging its local histogram once, is enough to fill the device
+        cl_uint compute_units;
+        err = clGetDeviceInfo(device_, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+        ocl::check(err, "Getting compute units");
+        size_t kernel_max_lws;
+        err = clGetKernelWorkGroupInfo(histogram_kernel_, device_, CL_KERNEL_WORK_GROUP_SIZE,
+            sizeof(kernel_max_lws), &kernel_max_lws, nullptr);
+        ocl::check(err, "Getting histogram work group size");
+        reduction_lws_ = std::min<size_t>(256, kernel_max_lws);
+        err = clGetKernelWorkGroupInfo(accumulate_kernel_, device_, CL_KERNEL_WORK_GROUP_SIZE,
+            sizeof(kernel_max_lws), &kernel_max_lws, nullptr);
+        ocl::check(err, "Getting k-means work group size");
+        reduction_lws_ = std::min(reduction_lws_, kernel_max_lws);
+        err = clGetKernelWorkGroupInfo(signature_kernel_, device_, CL_KERNEL_WORK_GROUP_SIZE,
+            sizeof(kernel_max_lws), &kernel_max_lws, nullptr);
+        ocl::check(err, "Getting signature work group size");
+        reduction_lws_ = std::min(reduction_lws_, kernel_max_lws);
+        reduction_gws_ = reduction_lws_ * compute_units * 4;
+    }
+
+    // the error diffusion tiles, the palette state and the unfused chain work on one frame at a time
+    const bool batchable = settings_.palette_size == 0 && settings_.dither != DITHER_ERROR_DIFFUSION
+        && (dither_matrix_buffer_ || lut_buffer_ || settings_.fused);
+    if (batchable) {
+        batch_frames_ = batch_frames == 0 ? auto_batch_frames(width_, height_) : batch_frames;
+        // every buffer of a slot holds the whole batch, it must fit in a single allocation and the buffers of all the slots in the device
+        cl_ulong max_alloc = 0, global_mem = 0;
+        ocl::check(clGetDeviceInfo(device_, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr), "Getting max allocation size");
+        ocl::check(clGetDeviceInfo(device_, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, nullptr), "Getting global memory size");
+        const cl_ulong buffer_limit = std::min(max_alloc, global_mem / (3 * std::max<size_t>(frames_in_flight, 1)));
+        const size_t max_batch_frames = std::max<size_t>(static_cast<size_t>(buffer_limit / (static_cast<cl_ulong>(width_) * height_ * 4)), 1);
+        if (batch_frames_ > max_batch_frames) {
+            LOG_WARNING("A batch of " << batch_frames_ << " frames does not fit in the memory of " << device_name_
+                << ", batching " << max_batch_frames << " frames instead");
+            batch_frames_ = max_batch_frames;
+        }
+    } else if (batch_frames > 1) {
+        LOG_WARNING("The " << (settings_.palette_size > 0 ? "palette" : settings_.dither == DITHER_ERROR_DIFFUSION ? "error diffusion" : "unfused")
+            << " kernels process one frame at a time, the frames are not batched");
+    }
+    if (batch_frames_ > 1) {
+        LOG_INFO("Batching " << batch_frames_ << " frames per kernel launch");
+    }
+
+    // the device buffers are allocated once for the resolution of the video and reused for every batch
+    slots_.resize(std::max<size_t>(frames_in_flight, 1));
+    for (Slot& slot : slots_) {
+        slot.buffers = std::make_unique<DeviceBufferPool>(context_, upload_queue_);
+        slot.buffers->reserve(width_, height_, 4, batch_frames_);
+    }
+    current_ = &slots_.front();
+}
+
+size_t OpenCLFrameProcessor::auto_batch_frames(int width, int height) {
+    // a launch and its synchronization cost about the same whatever the frame size, so small frames are grouped
+    // until a launch covers enough pixels to amortize it
+    const size_t pixels = std::max<size_t>(static_cast<size_t>(width) * height, 1);
+    return std::clamp<size_t>(BATCH_PIXELS / pixels, 1, MAX_BATCH_FRAMES);
+}
+
+OpenCLFrameProcessor::~OpenCLFrameProcessor() {
+    // the readbacks still write into host memory, they have to be done before anything is released
+    complete_all();
+    slots_.clear();
+    // the kernels are owned by the program cache
+    programs_.reset();
+    for (cl_mem buffer : { lut_buffer_, dither_matrix_buffer_, histogram_buffer_, signature_buffer_, sums_buffer_, palette_buffer_, cube_buffer_ }) {
+        if (buffer) {
+            clReleaseMemObject(buffer);
+        }
+    }
+    clReleaseCommandQueue(readback_queue_);
+    clReleaseCommandQueue(upload_queue_);
+    clReleaseCommandQueue(queue_);
+    clReleaseContext(context_);
+}
+
+void OpenCLFrameProcessor::process(const uint8_t* bgra_frame, uint8_t* rgba_frame) {
+    submit(bgra_frame, rgba_frame);
+    complete_all();
+}
+
+uint8_t* OpenCLFrameProcessor::map_input() {
+    // the mapped frame is processed on its own, after the frames submitted before it
+    complete_all();
+    acquire_slot();
+    return current_->buffers->map_input();
+}
+
+void OpenCLFrameProcessor::process_mapped(uint8_t* rgba_frame) {
+    // unmapping hands the frame to the device, with no copy at all on host-memory devices
+    add_frame(current_->buffers->unmap_input(), rgba_frame);
+    complete_all();
+}
+
+void OpenCLFrameProcessor::submit(const uint8_t* bgra_frame, uint8_t* rgba_frame) {
+    if (!batch_open_) {
+        acquire_slot();
+    }
+    // upload the frame into its place in the input buffer of the slot, the upload queue runs it while the kernels of the previous batch run
+    add_frame(current_->buffers->upload(bgra_frame, current_->outputs.size()), rgba_frame);
+}
+
+uint8_t* OpenCLFrameProcessor::map_submit_input() {
+    if (!batch_open_) {
+        acquire_slot();
+    }
+    // the frame is decoded straight into its place in the input buffer of the slot, without the upload of submit()
+    return current_->buffers->map_input(current_->outputs.size());
+}
+
+void OpenCLFrameProcessor::submit_mapped(uint8_t* rgba_frame) {
+    add_frame(current_->buffers->unmap_input(), rgba_frame);
+}
+
+void OpenCLFrameProcessor::cancel_mapped_input() {
+    if (!batch_open_ || !current_->buffers->input_mapped()) {
+        return;
+    }
+    // the kernels must not run on a buffer that is still mapped, so it is unmapped before the batch is launched
+    cl_event unmap_evt = current_->buffers->unmap_input();
+    ocl::check(clWaitForEvents(1, &unmap_evt), "Waiting for the unmap");
+    clReleaseEvent(unmap_evt);
+    if (current_->outputs.empty()) {
+        // the batch was only opened for the cancelled frame, its slot stays free
+        batch_open_ = false;
+    }
+}
+
+void OpenCLFrameProcessor::complete() {
+    if (pending_.empty()) {
+        return;
+    }
+    if (!pending_.front().readback_evt) {
+        // the oldest frame is still in the open batch, which cannot wait to be full
+        launch_batch();
+    }
+    const PendingFrame frame = pending_.front();
+    pending_.pop_front();
+    // the readback waits for the kernels, which wait for the upload, so the whole frame is done
+    ocl::check(clWaitForEvents(1, &frame.readback_evt), "Waiting for the readback");
+    clReleaseEvent(frame.readback_evt);
+    Slot& slot = slots_[frame.slot];
+    if (frame.last && slot.batch == frame.batch) {
+        finish_slot(slot);
+    }
+}
+
+void OpenCLFrameProcessor::acquire_slot() {
+    // the slot of the oldest batch is the next one, its buffers are reused once it is done
+    Slot& slot = slots_[next_slot_];
+    finish_slot(slot);
+    slot.batch = ++batch_count_;
+    current_ = &slot;
+    next_slot_ = (next_slot_ + 1) % slots_.size();
+    batch_open_ = true;
+}
+
+void OpenCLFrameProcessor::finish_slot(Slot& slot) {
+    if (!slot.readback_evt) {
+        return;
+    }
+    ocl::check(clWaitForEvents(1, &slot.readback_evt), "Waiting for the readback");
+    // the batch occupied the device from its first upload, or from the end of the previous batch if it was queued behind it
+    const size_t frames = slot.outputs.size();
+    cl_ulong upload_start = 0, readback_end = 0;
+    ocl::check(clGetEventProfilingInfo(slot.upload_evts.front(), CL_PROFILING_COMMAND_START, sizeof(upload_start), &upload_start, nullptr),
+        "Profiling upload start");
+    ocl::check(clGetEventProfilingInfo(slot.readback_evt, CL_PROFILING_COMMAND_END, sizeof(readback_end), &readback_end, nullptr),
+        "Profiling readback end");
+    last_frame_ms_ = (readback_end - std::min(readback_end, std::max(upload_start, last_readback_end_))) * 1.0e-6 / frames;
+    last_readback_end_ = readback_end;
+    if (stats_) {
+        for (cl_event upload_evt : slot.upload_evts) {
+            slot.profiled_events.emplace(slot.profiled_events.begin(), "upload", upload_evt);
+        }
+        collect_profiling(slot, frames);
+    } else {
+        for (cl_event upload_evt : slot.upload_evts) {
+            clReleaseEvent(upload_evt);
+        }
+    }
+    clReleaseEvent(slot.readback_evt);
+    slot.readback_evt = nullptr;
+    slot.upload_evts.clear();
+    slot.outputs.clear();
+}
+
+void OpenCLFrameProcessor::complete_all() {
+    while (!pending_.empty()) {
+        complete();
+    }
+}
+
+void OpenCLFrameProcessor::add_frame(cl_event input_evt, uint8_t* rgba_frame) {
+    // start the transfer now, the kernels only wait for it once the batch is launched
+    ocl::check(clFlush(upload_queue_), "Flushing the uploads");
+    current_->upload_evts.push_back(input_evt);
+    current_->outputs.push_back(rgba_frame);
+    pending_.push_back(PendingFrame{ static_cast<size_t>(current_ - slots_.data()), current_->batch, nullptr, false });
+    if (current_->outputs.size() == batch_frames_) {
+        launch_batch();
+    }
+}
+
+void OpenCLFrameProcessor::launch_batch() {
+    const size_t frames = current_->outputs.size();
+    // the transfers are on another queue, the barrier makes the kernels wait for them without blocking the host
+    cl_int err = clEnqueueBarrierWithWaitList(queue_, static_cast<cl_uint>(frames), current_->upload_evts.data(), nullptr);
+    ocl::check(err, "Waiting for the uploads");
+    cl_mem result_buffer;
+    if (settings_.palette_size > 0) {
+        // the palette is reused within a scene and rebuilt at the scene cuts, the signature only costs a sampled pass
+        const std::vector<uint32_t> signature = schedule_.needs_signature() ? compute_signature() : std::vector<uint32_t>();
+        const palette::PaletteSchedule::Decision decision = schedule_.next_frame(signature);
+        if (decision != palette::PaletteSchedule::KEEP) {
+            build_palette(decision == palette::PaletteSchedule::REFINE);
+        }
+        cl_event palette_map_evt = settings_.palette_cube
+            ? bgra_palette_map_cube(queue_, map_cube_kernel_, width_, height_, lws_in_,
+                current_->buffers->input(), current_->buffers->output(), palette_buffer_, static_cast<cl_int>(palette_.size()), cube_buffer_)
+            : bgra_palette_map(queue_, palette_map_kernel_, width_, height_, lws_in_,
+                current_->buffers->input(), current_->buffers->output(), palette_buffer_, static_cast<cl_int>(palette_.size()));
+        release_event(palette_map_evt, settings_.palette_cube ? "bgra_palette_map_cube" : "bgra_palette_map");
+        result_buffer = current_->buffers->output();
+    } else if (settings_.dither == DITHER_ERROR_DIFFUSION) {
+        cl_event diffusion_evt = bgra_dither_error_diffusion(queue_, error_diffusion_kernel_, width_, height_,
+            current_->buffers->input(), current_->buffers->output(), settings_.levels, settings_.grayscale, settings_.mode);
+        release_event(diffusion_evt, "bgra_dither_error_diffusion");
+        result_buffer = current_->buffers->output();
+    } else if (dither_matrix_buffer_) {
+        cl_event dither_evt = frames > 1
+            ? bgra_dither_ordered_batch(queue_, dither_ordered_batch_kernel_, width_, height_, static_cast<cl_int>(frames), lws_in_,
+                current_->buffers->input(), current_->buffers->output(), settings_.levels, settings_.grayscale, settings_.mode,
+                dither_matrix_buffer_, dither::matrix_bits(settings_.dither))
+            : bgra_dither_ordered(queue_, dither_ordered_kernel_, width_, height_, lws_in_,
+                current_->buffers->input(), current_->buffers->output(), settings_.levels, settings_.grayscale, settings_.mode,
+                dither_matrix_buffer_, dither::matrix_bits(settings_.dither));
+        release_event(dither_evt, frames > 1 ? "bgra_dither_ordered_batch" : "bgra_dither_ordered");
+        result_buffer = current_->buffers->output();
+    } else if (lut_buffer_) {
+        // single pass through the lookup table, whatever curve it holds
+        cl_event lut_evt = frames > 1
+            ? bgra_lut_fused_batch(queue_, lut_batch_kernel_, width_, height_, static_cast<cl_int>(frames), lws_in_,
+                current_->buffers->input(), current_->buffers->output(), settings_.grayscale, lut_buffer_)
+            : bgra_lut_fused(queue_, lut_kernel_, width_, height_, lws_in_,
+                current_->buffers->input(), current_->buffers->output(), settings_.grayscale, lut_buffer_);
+        release_event(lut_evt, frames > 1 ? "bgra_lut_fused_batch" : "bgra_lut_fused");
+        result_buffer = current_->buffers->output();
+    } else if (settings_.fused) {
+        // single pass from the input buffer to the output buffer, over every frame of the batch at once
+        cl_event fused_evt = frames > 1
+            ? bgra_quantize_fused_batch(queue_, fused_batch_kernel_, width_, height_, static_cast<cl_int>(frames), lws_in_,
+                current_->buffers->input(), current_->buffers->output(), settings_.levels, settings_.grayscale, settings_.mode)
+            : bgra_quantize_fused(queue_, fused_kernel_, width_, height_, lws_in_,
+                current_->buffers->input(), current_->buffers->output(), settings_.levels, settings_.grayscale, settings_.mode);
+        release_event(fused_evt, frames > 1 ? "bgra_quantize_fused_batch" : "bgra_quantize_fused");
+        result_buffer = current_->buffers->output();
+    } else {
+        result_buffer = process_unfused();
+    }
+    // the marker completes with the last kernel of the batch, the readbacks wait for it on their own queue
+    cl_event kernels_evt;
+    err = clEnqueueMarkerWithWaitList(queue_, 0, nullptr, &kernels_evt);
+    ocl::check(err, "Marking the end of the kernels");
+    err = clFlush(queue_);
+    ocl::check(err, "Flushing the kernels");
+    // every frame is read back on its own into its destination, the frames of the batch are pending in batch order at the back
+    const size_t frame_size = current_->buffers->frame_size();
+    const size_t first = pending_.size() - frames;
+    for (size_t i = 0; i < frames; i++) {
+        cl_event readback_evt;
+        err = clEnqueueReadBuffer(readback_queue_, result_buffer, CL_FALSE, i * frame_size, frame_size, current_->outputs[i],
+            1, &kernels_evt, &readback_evt);
+        ocl::check(err, "Reading output image");
+        pending_[first + i].readback_evt = readback_evt;
+        if (stats_) {
+            // the frame releases its own reference once completed, the slot keeps one to measure the readback
+            clRetainEvent(readback_evt);
+            current_->profiled_events.emplace_back("readback", readback_evt);
+        }
+    }
+    // the readback queue is in order, so the last readback ends the batch
+    pending_.back().last = true;
+    current_->readback_evt = pending_.back().readback_evt;
+    clRetainEvent(current_->readback_evt);
+    clReleaseEvent(kernels_evt);
+    err = clFlush(readback_queue_);
+    ocl::check(err, "Flushing the readback");
+    batch_open_ = false;
+}
+
+void OpenCLFrameProcessor::process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) {
+    // the planar paths are synchronous, on the buffers of the current slot
+    complete_all();
+    upload_yuv420(input);
+    cl_event yuv420_evt = yuv420p_quantize_fused(queue_, yuv420_kernel_, width_, height_, lws_in_,
+        current_->buffers->input(), current_->buffers->output(), settings_.levels, settings_.grayscale, settings_.mode, full_range);
+    release_event(yuv420_evt, "yuv420p_quantize_fused");
+    read_yuv420(current_->buffers->output(), output);
+    collect_profiling(*current_);
+}
+
+void OpenCLFrameProcessor::quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) {
+    complete_all();
+    upload_yuv420(input);
+    // the planes are quantized in place, no intermediate or output buffer is needed
+    cl_event planes_evt = yuv420p_quantize_planes(queue_, yuv420_planes_kernel_, width_, height_, lws_in_,
+        current_->buffers->input(), settings_.luma_levels, settings_.chroma_levels, settings_.grayscale, settings_.mode);
+    release_event(planes_evt, "yuv420p_quantize_planes");
+    read_yuv420(current_->buffers->input(), output);
+    collect_profiling(*current_);
+}
+
+std::vector<uint32_t> OpenCLFrameProcessor::compute_signature() {
+    const cl_uint zero = 0;
+    cl_int err = clEnqueueFillBuffer(queue_, signature_buffer_, &zero, sizeof(zero), 0,
+        palette::SIGNATURE_BINS * sizeof(cl_uint), 0, nullptr, nullptr);
+    ocl::check(err, "Clearing signature");
+    cl_event signature_evt = bgra_color_count(queue_, signature_kernel_, width_, height_,
+        reduction_lws_, reduction_gws_, current_->buffers->input(), signature_buffer_);
+    release_event(signature_evt, "bgra_color_signature");
+    std::vector<uint32_t> signature(palette::SIGNATURE_BINS);
+    err = clEnqueueReadBuffer(queue_, signature_buffer_, CL_TRUE, 0, signature.size() * sizeof(cl_uint),
+        signature.data(), 0, nullptr, nullptr);
+    ocl::check(err, "Reading signature");
+    return signature;
+}
+
+void OpenCLFrameProcessor::build_palette(bool refine) {
+    const cl_uint zero = 0;
+    cl_int err;
+    // without k-means iterations there is nothing to refine
+    if (!refine || settings_.kmeans_iterations == 0) {
+        err = clEnqueueFillBuffer(queue_, histogram_buffer_, &zero, sizeof(zero), 0,
+            palette::HISTOGRAM_BINS * sizeof(cl_uint), 0, nullptr, nullptr);
+        ocl::check(err, "Clearing histogram");
+        cl_event histogram_evt = bgra_color_count(queue_, histogram_kernel_, width_, height_,
+            reduction_lws_, reduction_gws_, current_->buffers->input(), histogram_buffer_);
+        release_event(histogram_evt, "bgra_color_histogram");
+        std::vector<uint32_t> histogram(palette::HISTOGRAM_BINS);
+        err = clEnqueueReadBuffer(queue_, histogram_buffer_, CL_TRUE, 0, histogram.size() * sizeof(cl_uint),
+            histogram.data(), 0, nullptr, nullptr);
+        ocl::check(err, "Reading histogram");
+        palette_ = palette::median_cut(histogram, settings_.palette_size);
+    }
+
+    for (int iteration = 0; iteration < settings_.kmeans_iterations; iteration++) {
+        // the blocking write leaves palette_ free to be updated
+        err = clEnqueueWriteBuffer(queue_, palette_buffer_, CL_TRUE, 0, palette_.size() * sizeof(palette::Color),
+            palette_.data(), 0, nullptr, nullptr);
+        ocl::check(err, "Uploading palette");
+        std::vector<uint32_t> sums(4 * palette_.size());
+        err = clEnqueueFillBuffer(queue_, sums_buffer_, &zero, sizeof(zero), 0, sums.size() * sizeof(cl_uint), 0, nullptr, nullptr);
+        ocl::check(err, "Clearing k-means sums");
+        cl_event accumulate_evt = bgra_palette_accumulate(queue_, accumulate_kernel_, width_, height_,
+            reduction_lws_, reduction_gws_, current_->buffers->input(), palette_buffer_, static_cast<cl_int>(palette_.size()), sums_buffer_);
+        release_event(accumulate_evt, "bgra_palette_accumulate");
+        err = clEnqueueReadBuffer(queue_, sums_buffer_, CL_TRUE, 0, sums.size() * sizeof(cl_uint),
+            sums.data(), 0, nullptr, nullptr);
+        ocl::check(err, "Reading k-means sums");
+        palette::update_centroids(palette_, sums);
+    }
+    palette::remove_duplicates(palette_);
+    err = clEnqueueWriteBuffer(queue_, palette_buffer_, CL_TRUE, 0, palette_.size() * sizeof(palette::Color),
+        palette_.data(), 0, nullptr, nullptr);
+    ocl::check(err, "Uploading palette");
+
+    if (settings_.palette_cube) {
+        // the cube is built once per palette, every frame sharing the palette maps through it
+        cl_event cube_evt = build_palette_cube(queue_, cube_kernel_, lws_in_, palette_buffer_,
+            static_cast<cl_int>(palette_.size()), cube_buffer_);
+        release_event(cube_evt, "build_palette_cube");
+    }
+}
+
+void OpenCLFrameProcessor::upload_yuv420(const PlanarFrame& input) {
+    // a packed 4:2:0 frame is 1.5 bytes per pixel, so it fits in the pooled RGBA buffers
+    // the queue is in order, so the kernels enqueued afterwards see the uploaded planes
+    const PlanarFrame layout = make_packed_yuv420(nullptr, width_, height_);
+    for (int plane = 0; plane < 3; plane++) {
+        const size_t plane_width = plane == 0 ? width_ : yuv420_chroma_width(width_);
+        const size_t plane_height = plane == 0 ? height_ : yuv420_chroma_height(height_);
+        const size_t buffer_origin[3] = { static_cast<size_t>(layout.data[plane] - layout.data[0]), 0, 0 };
+        const size_t host_origin[3] = { 0, 0, 0 };
+        const size_t region[3] = { plane_width, plane_height, 1 };
+        // the rows of the decoded planes are padded, the rectangular copy packs them on the fly
+        cl_event upload_evt;
+        cl_int err = clEnqueueWriteBufferRect(queue_, current_->buffers->input(), CL_FALSE, buffer_origin, host_origin, region,
+            plane_width, 0, input.linesize[plane], 0, input.data[plane], 0, nullptr, stats_ ? &upload_evt : nullptr);
+        ocl::check(err, "Uploading plane %d", plane);
+        if (stats_) {
+            release_event(upload_evt, "upload");
+        }
+    }
+}
+
+void OpenCLFrameProcessor::read_yuv420(cl_mem buffer, const PlanarFrame& output) {
+    const PlanarFrame layout = make_packed_yuv420(nullptr, width_, height_);
+    for (int plane = 0; plane < 3; plane++) {
+        const size_t plane_width = plane == 0 ? width_ : yuv420_chroma_width(width_);
+        const size_t plane_height = plane == 0 ? height_ : yuv420_chroma_height(height_);
+        const size_t buffer_origin[3] = { static_cast<size_t>(layout.data[plane] - layout.data[0]), 0, 0 };
+        const size_t host_origin[3] = { 0, 0, 0 };
+        const size_t region[3] = { plane_width, plane_height, 1 };
+        // the planes are read straight into the destination, e.g. the encoder frame, the last read waits for all the commands
+        cl_event read_evt;
+        cl_int err = clEnqueueReadBufferRect(queue_, buffer, plane == 2 ? CL_TRUE : CL_FALSE, buffer_origin, host_origin, region,
+            plane_width, 0, output.linesize[plane], 0, output.data[plane], 0, nullptr, stats_ ? &read_evt : nullptr);
+        ocl::check(err, "Reading plane %d", plane);
+        if (stats_) {
+            release_event(read_evt, "readback");
+        }
+    }
+}
+
+cl_mem OpenCLFrameProcessor::process_unfused() {
+    // convert the BRGA to RGBA, since the conversion in FFMPEG has some problems
+    // the queue is in order, every kernel waits for the previous one without the host waiting for any of them
+    cl_event bgra_to_rgba_evt = brga_to_rgba(queue_, bgra_to_rgba_kernel_,
+        width_, height_, lws_in_, current_->buffers->input(), current_->buffers->intermediate());
+    release_event(bgra_to_rgba_evt, "brga_to_rgba");
+    // the kernels ping-pong between the intermediate and output buffers, the input buffer is only written by the upload
+    cl_mem current_buffer = current_->buffers->intermediate();
+    cl_mem scratch_buffer = current_->buffers->output();
+    // grayscale the image if needed
+    if (settings_.grayscale) {
+        cl_event grayscale_evt = rgba_to_grayscale(queue_, grayscale_kernel_,
+            width_, height_, lws_in_, current_buffer, scratch_buffer);
+        release_event(grayscale_evt, "rgb_to_grayscale");
+        // swap the buffers
+        std::swap(current_buffer, scratch_buffer);
+    }
+    // quantize the image depending on input parameters
+    // the input parameters will establish which kernel to use and the number of levels in case of quantization with more than 2 levels
+    cl_event quantize_evt = uniform_quantize(queue_, quantization_kernel_,
+        width_, height_, lws_in_, current_buffer, scratch_buffer, settings_.levels);
+    release_event(quantize_evt, "uniform_quantize");
+    return scratch_buffer;
+}
+
+void OpenCLFrameProcessor::release_event(cl_event evt, const char* stage) {
+    if (stats_) {
+        // the profiling information is only complete once the command has run, so the event is kept until the frame is done
+        current_->profiled_events.emplace_back(stage, evt);
+    } else {
+        clReleaseEvent(evt);
+    }
+}
+
+void OpenCLFrameProcessor::collect_profiling(Slot& slot, size_t frames) {
+    // commands run several times in a frame, like the k-means steps or the plane transfers, add up into one sample
+    std::vector<std::pair<const char*, double>> frame_times;
+    for (const auto& [stage, evt] : slot.profiled_events) {
+        const double milliseconds = ocl::runtime_ms(evt);
+        clReleaseEvent(evt);
+        auto found = std::find_if(frame_times.begin(), frame_times.end(),
+            [stage](const std::pair<const char*, double>& entry) { return std::string(entry.first) == stage; });
+        if (found == frame_times.end()) {
+            frame_times.emplace_back(stage, milliseconds);
+        } else {
+            found->second += milliseconds;
+        }
+    }
+    slot.profiled_events.clear();
+    // the stats hold one sample per frame, so the frames of a batch share its commands evenly
+    for (size_t i = 0; i < frames; i++) {
+        for (const auto& [stage, milliseconds] : frame_times) {
+            stats_->record(std::string("device_") + stage, milliseconds / frames);
+        }
+    }
+}
+
+std::string OpenCLFrameProcessor::name() const {
+    const char* path = settings_.palette_size > 0 ? ", palette" : lut_buffer_ ? ", lut" : settings_.fused ? ", fused" : ", unfused";
+    return "opencl (" + device_name_ + path
+        + (settings_.specialize ? ", specialized" : ", generic")
+        + (batch_frames_ > 1 ? ", " + std::to_string(batch_frames_) + " frames per batch" : "") + ")";
+}
@@ -0,0 +1,270 @@
+/**
+ * @file OpenCLFrameProcessor.hpp
+ * @brief OpenCL backend running the kernels of uniformQuantization.cl.
+ */
+#pragma once
+
+#include "FrameProcessor.hpp"
+#include "DeviceBufferPool.hpp"
+#include "Dither.hpp"
+#include "Palette.hpp"
+#include "ProgramCache.hpp"
+#include "ocl_utility.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @class OpenCLFrameProcessor
+ * @brief Processes frames on the OpenCL device selected by the OCL_PLATFORM and OCL_DEVICE environment variables.
+ *
+ * Uploads, kernels and readbacks go to three in-order queues chained by events, and every frame in flight
+ * has its own set of device buffers, so the upload of a frame and the readback of the previous one overlap
+ * the kernels of the current one. The host only waits for a frame in complete(), when it hands it to the encoder.
+ *
+ * Small frames are batched: the submitted frames are uploaded one after the other into the buffers of a slot,
+ * and once the batch is full a single launch of the _batch kernels on a 3D (x, y, frame) range processes all of
+ * them. Every frame is read back on its own into its destination, so complete() still hands out one frame at a time.
+ * A batch is launched early when its oldest frame is completed before the batch is full.
+ */
+class OpenCLFrameProcessor : public FrameProcessor {
+public:
+    /**
+     * @brief Selects the device, builds the program and allocates the device buffers.
+     * @param settings The operations applied to every frame.
+     * @param width The width of the frames.
+     * @param height The height of the frames.
+     * @param kernel_file The file containing the OpenCL kernels, empty for the kernels embedded in the executable.
+     * @param program_cache The directory of the compiled program binaries, empty to always build from source.
+     * @param frames_in_flight The number of batches submitted before the oldest has to be completed, each with its own buffers.
+     * @param batch_frames The number of frames per kernel launch, 0 to choose it from the resolution with auto_batch_frames().
+     * It falls back to 1 for the error diffusion, the palette and the unfused kernels, which work on one frame at a time.
+     */
+    OpenCLFrameProcessor(const QuantizationSettings& settings, int width, int height,
+        const std::string& kernel_file = "", const std::string& program_cache = "", size_t frames_in_flight = 2,
+        size_t batch_frames = 1);
+
+    /**
+     * @brief Builds the program and allocates the device buffers on a given device, e.g. a sub-device.
+     * @param device The device, which must outlive the processor.
+     * @param settings The operations applied to every frame.
+     * @param width The width of the frames.
+     * @param height The height of the frames.
+     * @param kernel_file The file containing the OpenCL kernels, empty for the kernels embedded in the executable.
+     * @param program_cache The directory of the compiled program binaries, empty to always build from source.
+     * @param frames_in_flight The number of batches submitted before the oldest has to be completed, each with its own buffers.
+     * @param batch_frames The number of frames per kernel launch, 0 to choose it from the resolution.
+     */
+    OpenCLFrameProcessor(cl_device_id device, const QuantizationSettings& settings, int width, int height,
+        const std::string& kernel_file, const std::string& program_cache, size_t frames_in_flight, size_t batch_frames);
+
+    /**
+     * @brief Chooses the number of frames per launch for a resolution: enough frames to cover BATCH_PIXELS,
+     * at most MAX_BATCH_FRAMES, and a single frame from 720p up, where a launch already fills the device.
+     */
+    static size_t auto_batch_frames(int width, int height);
+
+    /// Pixels a batch covers when its size is chosen from the resolution, about one megapixel
+    static constexpr size_t BATCH_PIXELS = 1 << 20;
+
+    /// Largest number of frames in a batch chosen from the resolution
+    static constexpr size_t MAX_BATCH_FRAMES = 16;
+
+    /**
+     * @brief Destructor that releases the OpenCL objects.
+     */
+    ~OpenCLFrameProcessor() override;
+
+    OpenCLFrameProcessor(const OpenCLFrameProcessor&) = delete;
+    OpenCLFrameProcessor& operator=(const OpenCLFrameProcessor&) = delete;
+
+    void process(const uint8_t* bgra_frame, uint8_t* rgba_frame) override;
+
+    uint8_t* map_input() override;
+
+    void process_mapped(uint8_t* rgba_frame) override;
+
+    void process_yuv420(const PlanarFrame& input, const PlanarFrame& output, bool full_range) override;
+
+    void quantize_yuv420_planes(const PlanarFrame& input, const PlanarFrame& output) override;
+
+    void submit(const uint8_t* bgra_frame, uint8_t* rgba_frame) override;
+
+    /**
+     * @brief Maps the place of the next frame in the input buffer of the open batch, opening a batch if needed.
+     */
+    uint8_t* map_submit_input() override;
+
+    void submit_mapped(uint8_t* rgba_frame) override;
+
+    void cancel_mapped_input() override;
+
+    void complete() override;
+
+    size_t max_in_flight() const override { return slots_.size() * batch_frames_; }
+
+    std::string name() const override;
+
+    /**
+     * @brief Gets how long the last completed frame occupied the device, from the later of its upload and the
+     * readback of the previous frame to the end of its own readback, measured with the profiling events.
+     * With frames in flight this is the time between two frames, i.e. the inverse of the throughput.
+     * The frames of a batch share the time of the whole batch.
+     * @return The time in milliseconds, 0 before the first frame is completed.
+     */
+    double last_frame_ms() const { return last_frame_ms_; }
+
+private:
+    /**
+     * @struct Slot
+     * @brief A batch in flight: its device buffers, the events of its commands and the destinations of its frames.
+     */
+    struct Slot {
+        std::unique_ptr<DeviceBufferPool> buffers;                      ///< Device buffers of the batch
+        std::vector<cl_event> upload_evts;                              ///< Uploads of the frames, kept to wait for them and measure the batch
+        std::vector<uint8_t*> outputs;                                  ///< Destinations of the frames, in batch order
+        cl_event readback_evt = nullptr;                                ///< Readback of the last frame, null when the slot is free
+        uint64_t batch = 0;                                             ///< Sequence number of the batch using the slot
+        std::vector<std::pair<const char*, cl_event>> profiled_events;  ///< Commands of the batch waiting to be measured
+    };
+
+    /**
+     * @struct PendingFrame
+     * @brief A submitted frame not completed yet.
+     */
+    struct PendingFrame {
+        size_t slot;                    ///< Slot holding the frame
+        uint64_t batch;                 ///< Batch of the frame, to tell whether the slot has been reused since
+        cl_event readback_evt;          ///< Readback of the frame, null until its batch is launched
+        bool last;                      ///< Whether the frame is the last one of its batch
+    };
+
+    /**
+     * @brief Opens a batch on the next slot, waiting for the batch still using it.
+     */
+    void acquire_slot();
+
+    /**
+     * @brief Waits for the batch of a slot if it is still in flight, measures it and frees the slot.
+     */
+    void finish_slot(Slot& slot);
+
+    /**
+     * @brief Waits for every frame in flight, before the synchronous paths reuse the buffers.
+     */
+    void complete_all();
+
+    /**
+     * @brief Adds a frame to the open batch, launching the batch once it is full.
+     * @param input_evt The event of the command that filled the frame of the input buffer, owned by the slot.
+     * @param rgba_frame The processed frame, written once the frame is completed.
+     */
+    void add_frame(cl_event input_evt, uint8_t* rgba_frame);
+
+    /**
+     * @brief Enqueues the kernels on the frames of the open batch and their readbacks, without waiting for them.
+     */
+    void launch_batch();
+
+    /**
+     * @brief Runs the channel swap, grayscale and quantization as one kernel each, kept for validation.
+     * @return The buffer holding the result.
+     */
+    cl_mem process_unfused();
+
+    /**
+     * @brief Builds the adaptive palette from the frame in the input buffer: histogram, median cut and k-means iterations.
+     * The histogram and the k-means sums are computed on the device, only they are read back.
+     * @param refine Start the k-means iterations from the current palette instead of a median cut.
+     */
+    void build_palette(bool refine);
+
+    /**
+     * @brief Computes the scene signature of the frame in the input buffer on the device.
+     * @return palette::SIGNATURE_BINS counters.
+     */
+    std::vector<uint32_t> compute_signature();
+
+    /**
+     * @brief Uploads the planes of a YUV 4:2:0 frame into the input buffer, packed one after the other.
+     * @param input The frame to upload.
+     */
+    void upload_yuv420(const PlanarFrame& input);
+
+    /**
+     * @brief Reads a packed YUV 4:2:0 frame back into the planes of the destination, blocking until it is done.
+     * @param buffer The buffer holding the packed frame.
+     * @param output The planes receiving the frame.
+     */
+    void read_yuv420(cl_mem buffer, const PlanarFrame& output);
+
+    /**
+     * @brief Releases the event of a command, or keeps it in the current slot to measure the command once the frame is done when recording stats.
+     * @param evt The event, owned by this function.
+     * @param stage The name of the stage the command belongs to.
+     */
+    void release_event(cl_event evt, const char* stage);
+
+    /**
+     * @brief Records the device time of the commands kept by release_event() for a slot and releases them.
+     * Called once the frames of the slot have been read back, when all of them have completed.
+     * @param frames The number of frames of the batch, each of them gets an equal share of the batch.
+     */
+    void collect_profiling(Slot& slot, size_t frames = 1);
+
+    QuantizationSettings settings_;             ///< Operations applied to every frame
+    int width_;                                 ///< Frame width
+    int height_;                                ///< Frame height
+    std::string device_name_;                   ///< Name of the selected device
+
+    cl_platform_id platform_;                   ///< Selected platform
+    cl_device_id device_;                       ///< Selected device
+    cl_context context_;                        ///< Context of the device
+    cl_command_queue queue_;                    ///< In-order profiling queue of the kernels
+    cl_command_queue upload_queue_;             ///< In-order profiling queue of the uploads
+    cl_command_queue readback_queue_;           ///< In-order profiling queue of the readbacks
+    std::unique_ptr<ProgramCache> programs_;    ///< Programs specialized for the levels, owning the kernels
+    cl_kernel bgra_to_rgba_kernel_;             ///< Channel swap kernel
+    cl_kernel grayscale_kernel_;                ///< Grayscale kernel
+    cl_kernel quantization_kernel_;             ///< Quantization kernel for the mode
+    cl_kernel fused_kernel_;                    ///< Single-pass kernel
+    cl_kernel lut_kernel_;                      ///< Single-pass lookup table kernel
+    cl_kernel dither_ordered_kernel_;           ///< Single-pass ordered dithering kernel
+    cl_kernel fused_batch_kernel_;              ///< Single-pass kernel over a batch of frames
+    cl_kernel lut_batch_kernel_;                ///< Single-pass lookup table kernel over a batch of frames
+    cl_kernel dither_ordered_batch_kernel_;     ///< Single-pass ordered dithering kernel over a batch of frames
+    cl_kernel error_diffusion_kernel_;          ///< Tiled error diffusion kernel
+    cl_kernel yuv420_kernel_;                   ///< Single-pass kernel for planar YUV 4:2:0 frames
+    cl_kernel yuv420_planes_kernel_;            ///< In-place YUV space quantization of planar 4:2:0 frames
+    size_t lws_in_;                             ///< Preferred work group size multiple
+    cl_mem lut_buffer_;                         ///< Lookup table in constant memory, null without a table
+    cl_mem dither_matrix_buffer_;               ///< Threshold matrix in constant memory, null without ordered dithering
+    cl_kernel histogram_kernel_;                ///< Color histogram kernel of the palette mode
+    cl_kernel signature_kernel_;                ///< Scene signature kernel of the palette mode
+    cl_kernel accumulate_kernel_;               ///< k-means step kernel of the palette mode
+    cl_kernel palette_map_kernel_;              ///< Nearest palette entry kernel
+    cl_kernel cube_kernel_;                     ///< Palette cube building kernel
+    cl_kernel map_cube_kernel_;                 ///< Nearest palette entry kernel through the cube
+    cl_mem histogram_buffer_;                   ///< Color histogram, null without a palette
+    cl_mem signature_buffer_;                   ///< Scene signature, null without a palette
+    cl_mem sums_buffer_;                        ///< k-means sums, null without a palette
+    cl_mem palette_buffer_;                     ///< Palette in constant memory, null without a palette
+    cl_mem cube_buffer_;                        ///< Candidate lists of the palette cube, null without a palette
+    size_t reduction_lws_;                      ///< Work group size of the histogram and k-means kernels
+    size_t reduction_gws_;                      ///< Global size of the histogram and k-means kernels
+    std::vector<palette::Color> palette_;       ///< Adaptive palette of the current frames
+    palette::PaletteSchedule schedule_;         ///< Decides when the palette is rebuilt
+    size_t batch_frames_;                       ///< Frames per kernel launch
+    std::vector<Slot> slots_;                   ///< Device buffers of the batches in flight, reused across batches
+    Slot* current_;                             ///< Slot of the batch the commands are enqueued for
+    size_t next_slot_;                          ///< Slot of the next batch
+    bool batch_open_;                           ///< Whether the current slot collects submitted frames not launched yet
+    uint64_t batch_count_;                      ///< Batches opened so far
+    std::deque<PendingFrame> pending_;          ///< Submitted frames not completed yet, oldest first
+    cl_ulong last_readback_end_;                ///< Device time at which the readback of the last completed frame ended
+    double last_frame_ms_;                      ///< Device time taken by the last completed frame
+};
@@ -0,0 +1,195 @@
+/**
+ * @file Palette.cpp
+ * @brief Implementation of the palette building functions.
+ */
+#include "Palette.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <utility>
+
+namespace palette {
+
+namespace {
+    constexpr int BIN_SHIFT = 8 - HISTOGRAM_BITS;
+    constexpr int BIN_MASK = (1 << HISTOGRAM_BITS) - 1;
+
+    /**
+     * @brief Gets a channel (0 = R, 1 = G, 2 = B) of the color at the center of a bin.
+     */
+    inline int bin_channel(size_t bin, int channel) {
+        const int value = static_cast<int>(bin >> ((2 - channel) * HISTOGRAM_BITS)) & BIN_MASK;
+        return (value << BIN_SHIFT) + (1 << (BIN_SHIFT - 1));
+    }
+
+    /**
+     * @struct Box
+     * @brief A set of populated bins, a range of the sorted bin list.
+     */
+    struct Box {
+        size_t begin;       ///< First bin of the box in the bin list
+        size_t end;         ///< One past the last bin of the box
+        int widest_channel; ///< Channel with the widest range
+        int range;          ///< Range of the widest channel
+    };
+
+    /**
+     * @brief Computes the widest channel of a box.
+     */
+    void measure(Box& box, const std::vector<size_t>& bins) {
+        std::array<int, 3> low = { 255, 255, 255 };
+        std::array<int, 3> high = { 0, 0, 0 };
+        for (size_t i = box.begin; i < box.end; i++) {
+            for (int c = 0; c < 3; c++) {
+                low[c] = std::min(low[c], bin_channel(bins[i], c));
+                high[c] = std::max(high[c], bin_channel(bins[i], c));
+            }
+        }
+        box.widest_channel = 0;
+        for (int c = 1; c < 3; c++) {
+            if (high[c] - low[c] > high[box.widest_channel] - low[box.widest_channel]) {
+                box.widest_channel = c;
+            }
+        }
+        box.range = high[box.widest_channel] - low[box.widest_channel];
+    }
+}
+
+std::vector<Color> median_cut(const std::vector<uint32_t>& histogram, size_t colors) {
+    std::vector<size_t> bins;
+    for (size_t bin = 0; bin < histogram.size(); bin++) {
+        if (histogram[bin] > 0) {
+            bins.push_back(bin);
+        }
+    }
+    if (bins.empty()) {
+        return { Color{ 0, 0, 0, 255 } };
+    }
+
+    std::vector<Box> boxes;
+    boxes.push_back({ 0, bins.size(), 0, 0 });
+    measure(boxes.back(), bins);
+    while (boxes.size() < std::min(colors, MAX_COLORS)) {
+        // split the box with the widest range, the first one on ties so the result is deterministic
+        auto widest = std::max_element(boxes.begin(), boxes.end(),
+            [](const Box& a, const Box& b) { return a.range < b.range; });
+        if (widest->range == 0) {
+            break; // every box is a single bin
+        }
+        Box& box = *widest;
+        const int channel = box.widest_channel;
+        std::sort(bins.begin() + box.begin, bins.begin() + box.end, [&](size_t a, size_t b) {
+            return bin_channel(a, channel) < bin_channel(b, channel) || (bin_channel(a, channel) == bin_channel(b, channel) && a < b);
+        });
+        // the split point is the median pixel, never leaving one side empty
+        uint64_t population = 0;
+        for (size_t i = box.begin; i < box.end; i++) {
+            population += histogram[bins[i]];
+        }
+        uint64_t accumulated = 0;
+        size_t split = box.begin + 1;
+        for (size_t i = box.begin; i < box.end - 1; i++) {
+            accumulated += histogram[bins[i]];
+            split = i + 1;
+            if (2 * accumulated >= population) {
+                break;
+            }
+        }
+        Box upper = { split, box.end, 0, 0 };
+        box.end = split;
+        measure(box, bins);
+        measure(upper, bins);
+        boxes.push_back(upper);
+    }
+
+    // every entry is the population-weighted mean of the bin centers of its box
+    std::vector<Color> result;
+    for (const Box& box : boxes) {
+        std::array<uint64_t, 3> sums = { 0, 0, 0 };
+        uint64_t count = 0;
+        for (size_t i = box.begin; i < box.end; i++) {
+            for (int c = 0; c < 3; c++) {
+                sums[c] += static_cast<uint64_t>(bin_channel(bins[i], c)) * histogram[bins[i]];
+            }
+            count += histogram[bins[i]];
+        }
+        result.push_back({ static_cast<uint8_t>((sums[0] + count / 2) / count), static_cast<uint8_t>((sums[1] + count / 2) / count),
+            static_cast<uint8_t>((sums[2] + count / 2) / count), 255 });
+    }
+    return result;
+}
+
+void update_centroids(std::vector<Color>& palette, const std::vector<uint32_t>& sums) {
+    for (size_t i = 0; i < palette.size(); i++) {
+        const uint32_t count = sums[4 * i + 3];
+        if (count == 0) {
+            continue;
+        }
+        palette[i].r = static_cast<uint8_t>((sums[4 * i] + count / 2) / count);
+        palette[i].g = static_cast<uint8_t>((sums[4 * i + 1] + count / 2) / count);
+        palette[i].b = static_cast<uint8_t>((sums[4 * i + 2] + count / 2) / count);
+    }
+}
+
+void remove_duplicates(std::vector<Color>& palette) {
+    std::vector<Color> unique;
+    for (const Color& color : palette) {
+        const bool duplicate = std::any_of(unique.begin(), unique.end(), [&](const Color& other) {
+            return other.r == color.r && other.g == color.g && other.b == color.b;
+        });
+        if (!duplicate) {
+            unique.push_back(color);
+        }
+    }
+    palette = std::move(unique);
+}
+
+double signature_distance(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+    uint64_t total_a = 0;
+    uint64_t total_b = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        total_a += a[i];
+        total_b += b[i];
+    }
+    if (total_a == 0 || total_b == 0) {
+        return total_a == total_b ? 0.0 : 1.0;
+    }
+    double distance = 0.0;
+    for (size_t i = 0; i < a.size(); i++) {
+        distance += std::abs(static_cast<double>(a[i]) / total_a - static_cast<double>(b[i]) / total_b);
+    }
+    return distance / 2.0;
+}
+
+PaletteSchedule::PaletteSchedule(double scene_threshold, int max_age)
+    : scene_threshold_(scene_threshold), max_age_(max_age), age_(0), has_palette_(false), scene_cuts_(0) {
+    // without scene detection and without a limit the palette would never change, so it follows every frame
+    if (scene_threshold_ <= 0.0 && max_age_ <= 0) {
+        max_age_ = 1;
+    }
+}
+
+PaletteSchedule::Decision PaletteSchedule::next_frame(const std::vector<uint32_t>& signature) {
+    Decision decision = KEEP;
+    if (!has_palette_) {
+        decision = REBUILD;
+    } else if (needs_signature() && signature_distance(signature, reference_) > scene_threshold_) {
+        decision = REBUILD;
+        scene_cuts_++;
+    } else if (max_age_ > 0 && age_ >= max_age_) {
+        // the same shot is going on, start from the current palette so that the colors do not jump
+        decision = REFINE;
+    }
+    if (decision != KEEP) {
+        has_palette_ = true;
+        age_ = 0;
+        if (needs_signature()) {
+            reference_ = signature;
+        }
+    }
+    age_++;
+    return decision;
+}
+
+} // namespace palette
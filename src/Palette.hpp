@@ -0,0 +1,147 @@
+/**
+ * @file Palette.hpp
+ * @brief Host side of the adaptive palette quantization: median cut on a color histogram and k-means refinement.
+ *
+ * The backends compute the histogram and the k-means sums over the frame (see the palette kernels in
+ * uniformQuantization.cl and cpu_kernels.hpp), the functions here turn them into a palette.
+ * All the steps use integer arithmetic, so every backend builds the same palette for the same frame.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace palette {
+    // keep in sync with the HISTOGRAM_* and palette defines in uniformQuantization.cl
+    constexpr int HISTOGRAM_BITS = 4;                                   ///< Bits per channel of a histogram bin
+    constexpr size_t HISTOGRAM_BINS = size_t(1) << (3 * HISTOGRAM_BITS); ///< Number of histogram bins
+    constexpr size_t MAX_COLORS = 256;                                  ///< Largest supported palette
+    constexpr size_t KMEANS_SAMPLE_STEP = 4;                            ///< Only one pixel out of this many feeds k-means
+    constexpr int SIGNATURE_BITS = 3;                                   ///< Bits per channel of a scene signature bin
+    constexpr size_t SIGNATURE_BINS = size_t(1) << (3 * SIGNATURE_BITS); ///< Number of scene signature bins
+    constexpr size_t SIGNATURE_SAMPLE_STEP = 16;                        ///< Only one pixel out of this many feeds the signature
+    constexpr int CUBE_BITS = 5;                                        ///< Bits per channel of a palette cube cell
+    constexpr size_t CUBE_CELLS = size_t(1) << (3 * CUBE_BITS);         ///< Number of cells of the palette cube
+    constexpr size_t CUBE_CELL_SIZE = 16;                               ///< Bytes of a cell: the candidate count and up to 15 candidates
+    constexpr uint8_t CUBE_FULL_SEARCH = 255;                           ///< Candidate count of the cells that search the whole palette
+
+    /**
+     * @brief Gets the palette cube cell of a color.
+     */
+    inline size_t cube_cell(int r, int g, int b) {
+        constexpr int shift = 8 - CUBE_BITS;
+        return (static_cast<size_t>(r >> shift) << (2 * CUBE_BITS))
+            | (static_cast<size_t>(g >> shift) << CUBE_BITS) | static_cast<size_t>(b >> shift);
+    }
+
+    /**
+     * @struct Color
+     * @brief A palette entry, laid out like an OpenCL uchar4 in RGBA order.
+     */
+    struct Color {
+        uint8_t r;  ///< Red
+        uint8_t g;  ///< Green
+        uint8_t b;  ///< Blue
+        uint8_t a;  ///< Unused, kept for the uchar4 layout
+    };
+
+    /**
+     * @brief Gets the histogram bin of a color.
+     */
+    inline size_t histogram_bin(int r, int g, int b) {
+        constexpr int shift = 8 - HISTOGRAM_BITS;
+        return (static_cast<size_t>(r >> shift) << (2 * HISTOGRAM_BITS))
+            | (static_cast<size_t>(g >> shift) << HISTOGRAM_BITS) | static_cast<size_t>(b >> shift);
+    }
+
+    /**
+     * @brief Gets the scene signature bin of a color.
+     */
+    inline size_t signature_bin(int r, int g, int b) {
+        constexpr int shift = 8 - SIGNATURE_BITS;
+        return (static_cast<size_t>(r >> shift) << (2 * SIGNATURE_BITS))
+            | (static_cast<size_t>(g >> shift) << SIGNATURE_BITS) | static_cast<size_t>(b >> shift);
+    }
+
+    /**
+     * @brief Computes the distance between two scene signatures, half the L1 distance of the normalized histograms.
+     * @return 0 for the same color distribution, 1 for distributions without any color in common.
+     */
+    double signature_distance(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b);
+
+    /**
+     * @class PaletteSchedule
+     * @brief Decides, frame by frame, whether the palette can be reused or must be rebuilt.
+     *
+     * Consecutive frames of a shot share their colors, so the palette is only rebuilt from scratch when
+     * the scene signature moves away from the one of the frame the palette was built from, i.e. at a scene cut.
+     * A palette that reaches the largest age is refined with k-means starting from itself instead, which keeps
+     * the colors stable within the shot.
+     */
+    class PaletteSchedule {
+    public:
+        /**
+         * @brief What to do with the palette for a frame.
+         */
+        enum Decision {
+            KEEP,       ///< Reuse the palette as it is
+            REFINE,     ///< Run the k-means iterations starting from the current palette
+            REBUILD     ///< Build a new palette with median cut and k-means
+        };
+
+        /**
+         * @brief Constructs the schedule.
+         * @param scene_threshold The signature distance above which a frame starts a new scene, 0 disables the detection.
+         * @param max_age The largest number of frames sharing a palette, 0 for no limit (every frame without scene detection).
+         */
+        PaletteSchedule(double scene_threshold, int max_age);
+
+        /**
+         * @brief Tells whether the decisions need the signature of the frames.
+         */
+        bool needs_signature() const { return scene_threshold_ > 0.0; }
+
+        /**
+         * @brief Decides what to do for the next frame.
+         * @param signature The signature of the frame, ignored when needs_signature() is false.
+         * @return The decision, the reference signature is updated when the palette changes.
+         */
+        Decision next_frame(const std::vector<uint32_t>& signature);
+
+        /**
+         * @brief Gets the number of scene cuts detected so far.
+         */
+        size_t scene_cuts() const { return scene_cuts_; }
+
+    private:
+        double scene_threshold_;            ///< Signature distance starting a new scene
+        int max_age_;                       ///< Largest number of frames sharing a palette, 0 for no limit
+        int age_;                           ///< Frames that used the current palette
+        bool has_palette_;                  ///< A palette has been built
+        size_t scene_cuts_;                 ///< Number of scene cuts detected
+        std::vector<uint32_t> reference_;   ///< Signature of the frame the palette was built from
+    };
+
+    /**
+     * @brief Builds a palette by recursively splitting the populated histogram bins at the median of their widest channel.
+     * @param histogram HISTOGRAM_BINS pixel counts.
+     * @param colors The number of colors wanted, at most MAX_COLORS.
+     * @return The palette, smaller than requested when the frame has fewer populated bins.
+     */
+    std::vector<Color> median_cut(const std::vector<uint32_t>& histogram, size_t colors);
+
+    /**
+     * @brief Moves every palette entry to the mean of the pixels assigned to it, one k-means iteration.
+     * @param palette The palette to refine, entries without pixels are left unchanged.
+     * @param sums Four values per entry: the sums of R, G and B and the number of pixels assigned to the entry.
+     */
+    void update_centroids(std::vector<Color>& palette, const std::vector<uint32_t>& sums);
+
+    /**
+     * @brief Removes the entries equal to an earlier one, e.g. k-means centroids that converged to the same color.
+     * A duplicate is never the nearest entry, and dropping it keeps the candidate lists of the palette cube short.
+     * @param palette The palette to compact, the order of the remaining entries is kept.
+     */
+    void remove_duplicates(std::vector<Color>& palette);
+} // namespace palette
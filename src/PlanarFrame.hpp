@@ -0,0 +1,79 @@
+/**
+ * @file PlanarFrame.hpp
+ * @brief Lightweight view over the planes of a YUV 4:2:0 frame, and helpers to pack and copy them.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @struct PlanarFrame
+ * @brief Non-owning view over the Y, U and V planes of a frame.
+ */
+struct PlanarFrame {
+    uint8_t* data[3] = { nullptr, nullptr, nullptr };  ///< Pointers to the Y, U and V planes
+    int linesize[3] = { 0, 0, 0 };                      ///< Size in bytes of a row of each plane
+};
+
+/**
+ * @brief Gets the width of the chroma planes of a 4:2:0 frame.
+ */
+inline int yuv420_chroma_width(int width) {
+    return (width + 1) / 2;
+}
+
+/**
+ * @brief Gets the height of the chroma planes of a 4:2:0 frame.
+ */
+inline int yuv420_chroma_height(int height) {
+    return (height + 1) / 2;
+}
+
+/**
+ * @brief Gets the size in bytes of a 4:2:0 frame with tightly packed planes (Y, then U, then V).
+ */
+inline size_t yuv420_frame_size(int width, int height) {
+    return static_cast<size_t>(width) * height
+        + 2 * static_cast<size_t>(yuv420_chroma_width(width)) * yuv420_chroma_height(height);
+}
+
+/**
+ * @brief Builds the view of a 4:2:0 frame with tightly packed planes stored in contiguous memory.
+ * @param base The start of the frame, yuv420_frame_size() bytes.
+ * @param width The width of the frame.
+ * @param height The height of the frame.
+ * @return The view over the planes.
+ */
+inline PlanarFrame make_packed_yuv420(uint8_t* base, int width, int height) {
+    const int chroma_width = yuv420_chroma_width(width);
+    const size_t luma_size = static_cast<size_t>(width) * height;
+    const size_t chroma_size = static_cast<size_t>(chroma_width) * yuv420_chroma_height(height);
+    PlanarFrame frame;
+    frame.data[0] = base;
+    frame.data[1] = base + luma_size;
+    frame.data[2] = base + luma_size + chroma_size;
+    frame.linesize[0] = width;
+    frame.linesize[1] = chroma_width;
+    frame.linesize[2] = chroma_width;
+    return frame;
+}
+
+/**
+ * @brief Copies the planes of a 4:2:0 frame row by row, honouring the line sizes of both sides.
+ * @param source The frame to copy.
+ * @param destination The frame receiving the copy.
+ * @param width The width of the frame.
+ * @param height The height of the frame.
+ */
+inline void copy_yuv420(const PlanarFrame& source, const PlanarFrame& destination, int width, int height) {
+    for (int plane = 0; plane < 3; plane++) {
+        const int plane_width = plane == 0 ? width : yuv420_chroma_width(width);
+        const int plane_height = plane == 0 ? height : yuv420_chroma_height(height);
+        for (int row = 0; row < plane_height; row++) {
+            std::memcpy(destination.data[plane] + static_cast<size_t>(row) * destination.linesize[plane],
+                source.data[plane] + static_cast<size_t>(row) * source.linesize[plane], plane_width);
+        }
+    }
+}
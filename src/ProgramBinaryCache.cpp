@@ -0,0 +1,197 @@
+/**
+ * @file ProgramBinaryCache.cpp
+ * @brief Implementation of the ProgramBinaryCache class.
+ */
+#include "ProgramBinaryCache.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    /// First line of every entry, to be bumped when the layout of the entries changes
+    const char* const MAGIC = "video-color-quantizer-program 1\n";
+
+    /**
+     * @brief Hashes bytes with 64-bit FNV-1a, enough to name entries and detect corrupted ones.
+     */
+    uint64_t fnv1a(const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        uint64_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    std::string to_hex(uint64_t value) {
+        std::ostringstream oss;
+        oss << std::hex << std::setw(16) << std::setfill('0') << value;
+        return oss.str();
+    }
+
+    /**
+     * @brief Gets a string property of a platform.
+     */
+    std::string platform_string(cl_platform_id platform, cl_platform_info param) {
+        size_t size = 0;
+        ocl::check(clGetPlatformInfo(platform, param, 0, nullptr, &size), "Getting platform property size");
+        std::vector<char> value(size + 1, '\0');
+        ocl::check(clGetPlatformInfo(platform, param, size, value.data(), nullptr), "Getting platform property");
+        return value.data();
+    }
+
+    /**
+     * @brief Removes an invalid entry, so that the next store replaces it.
+     */
+    void discard(const std::string& file, const char* reason) {
+        LOG_WARNING("Discarding cached program " << file << ": " << reason);
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+    }
+}
+
+ProgramBinaryCache::ProgramBinaryCache(std::string directory) : directory_(std::move(directory)) {
+}
+
+std::string ProgramBinaryCache::default_directory() {
+    const char* env = std::getenv("VCQ_PROGRAM_CACHE");
+    if (env && env[0] != '\0') {
+        return env;
+    }
+    env = std::getenv("XDG_CACHE_HOME");
+    if (env && env[0] != '\0') {
+        return std::string(env) + "/video-color-quantizer";
+    }
+    env = std::getenv("HOME");
+    if (env && env[0] != '\0') {
+        return std::string(env) + "/.cache/video-color-quantizer";
+    }
+    return "";
+}
+
+std::string ProgramBinaryCache::key(const std::string& source, cl_device_id device, const std::string& options) const {
+    cl_platform_id platform;
+    ocl::check(clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr), "Getting device platform");
+    std::ostringstream oss;
+    oss << MAGIC
+        << "platform " << platform_string(platform, CL_PLATFORM_NAME) << " / " << platform_string(platform, CL_PLATFORM_VERSION) << "\n"
+        << "device " << ocl::device_string(device, CL_DEVICE_NAME) << " / " << ocl::device_string(device, CL_DEVICE_VERSION) << "\n"
+        << "driver " << ocl::device_string(device, CL_DRIVER_VERSION) << "\n"
+        << "options " << options << "\n"
+        << "source " << to_hex(fnv1a(source.data(), source.size())) << " " << source.size() << "\n";
+    return oss.str();
+}
+
+std::string ProgramBinaryCache::path(const std::string& key) const {
+    return directory_ + "/" + to_hex(fnv1a(key.data(), key.size())) + ".clbin";
+}
+
+cl_program ProgramBinaryCache::load(const std::string& source, cl_context context, cl_device_id device,
+    const std::string& options) const {
+    if (!enabled()) {
+        return nullptr;
+    }
+    const std::string expected = key(source, device, options);
+    const std::string file = path(expected);
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        return nullptr;
+    }
+    // the key is compared in full, a collision of the file names only costs a build from source
+    std::string found(expected.size(), '\0');
+    if (!in.read(&found[0], found.size()) || found != expected) {
+        discard(file, "the key does not match");
+        return nullptr;
+    }
+    std::string label;
+    size_t size = 0;
+    std::string checksum;
+    if (!(in >> label >> size >> checksum) || label != "binary" || size == 0 || in.get() != '\n') {
+        discard(file, "the header is invalid");
+        return nullptr;
+    }
+    std::vector<unsigned char> binary(size);
+    if (!in.read(reinterpret_cast<char*>(binary.data()), size) || in.peek() != std::ifstream::traits_type::eof()
+        || to_hex(fnv1a(binary.data(), size)) != checksum) {
+        discard(file, "the binary is truncated or corrupted");
+        return nullptr;
+    }
+
+    const unsigned char* binary_ptr = binary.data();
+    cl_int status, err;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, &binary_ptr, &status, &err);
+    if (err != CL_SUCCESS || status != CL_SUCCESS) {
+        if (program) {
+            clReleaseProgram(program);
+        }
+        discard(file, "the driver rejected the binary");
+        return nullptr;
+    }
+    err = clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+    if (err != CL_SUCCESS) {
+        clReleaseProgram(program);
+        discard(file, "the binary does not build");
+        return nullptr;
+    }
+    LOG_DEBUG("Loaded cached program " << file);
+    return program;
+}
+
+void ProgramBinaryCache::store(cl_program program, const std::string& source, cl_device_id device,
+    const std::string& options) const {
+    if (!enabled()) {
+        return;
+    }
+    cl_uint devices = 0;
+    ocl::check(clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(devices), &devices, nullptr), "Getting program devices");
+    if (devices != 1) {
+        return;
+    }
+    size_t size = 0;
+    ocl::check(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr), "Getting program binary size");
+    if (size == 0) {
+        return;
+    }
+    std::vector<unsigned char> binary(size);
+    unsigned char* binary_ptr = binary.data();
+    ocl::check(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary_ptr), &binary_ptr, nullptr), "Getting program binary");
+
+    const std::string entry_key = key(source, device, options);
+    const std::string file = path(entry_key);
+    std::error_code ec;
+    std::filesystem::create_directories(directory_, ec);
+    if (ec) {
+        LOG_WARNING("Could not create the program cache " << directory_ << ": " << ec.message());
+        return;
+    }
+    // the temporary name is unique per thread, the rename then replaces the entry atomically
+    const std::string temporary = file + "." + to_hex(std::hash<std::thread::id>()(std::this_thread::get_id())
+        ^ static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())) + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out << entry_key << "binary " << size << " " << to_hex(fnv1a(binary.data(), size)) << "\n";
+        out.write(reinterpret_cast<const char*>(binary.data()), size);
+        if (!out.flush()) {
+            LOG_WARNING("Could not write the cached program " << temporary);
+            out.close();
+            std::filesystem::remove(temporary, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary, file, ec);
+    if (ec) {
+        LOG_WARNING("Could not store the cached program " << file << ": " << ec.message());
+        std::filesystem::remove(temporary, ec);
+        return;
+    }
+    LOG_DEBUG("Stored cached program " << file);
+}
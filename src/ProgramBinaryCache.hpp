@@ -0,0 +1,73 @@
+/**
+ * @file ProgramBinaryCache.hpp
+ * @brief On-disk cache of compiled OpenCL program binaries, skipping the source compilation of later runs.
+ */
+#pragma once
+
+#include "ocl_utility.hpp"
+
+#include <string>
+
+/**
+ * @class ProgramBinaryCache
+ * @brief Stores the binaries of built programs in a directory and builds later programs from them.
+ *
+ * An entry is keyed by the platform, the device, its driver version, the build options and a hash of the
+ * source, so a driver update or an edited kernel never picks up a stale binary. Every file starts with
+ * the full key and ends with a checksum of the binary: an entry whose key does not match, which is
+ * truncated, or which the driver rejects is removed and the program is built from source again.
+ * Entries are written to a temporary file and renamed, so concurrent processes never read a partial one.
+ * Failures of the cache are logged and never fatal.
+ */
+class ProgramBinaryCache {
+public:
+    /**
+     * @brief Constructs a cache stored in a directory, created on the first store.
+     * @param directory The directory of the entries, empty to disable the cache.
+     */
+    explicit ProgramBinaryCache(std::string directory);
+
+    /**
+     * @brief Gets the directory used when none is given: $VCQ_PROGRAM_CACHE, else
+     * $XDG_CACHE_HOME/video-color-quantizer, else ~/.cache/video-color-quantizer.
+     * @return The directory, empty when none of the variables is set.
+     */
+    static std::string default_directory();
+
+    /**
+     * @brief Tells whether the cache reads and writes entries.
+     */
+    bool enabled() const { return !directory_.empty(); }
+
+    /**
+     * @brief Builds a program from its cached binary.
+     * @param source The source code of the program.
+     * @param context The OpenCL context.
+     * @param device The target device.
+     * @param options The build options.
+     * @return The built program, or nullptr if there is no valid entry.
+     */
+    cl_program load(const std::string& source, cl_context context, cl_device_id device, const std::string& options) const;
+
+    /**
+     * @brief Stores the binary of a program built from source.
+     * @param program The built program.
+     * @param source The source code of the program.
+     * @param device The device the program was built for.
+     * @param options The build options.
+     */
+    void store(cl_program program, const std::string& source, cl_device_id device, const std::string& options) const;
+
+private:
+    /**
+     * @brief Describes everything the binary depends on, written at the start of the entry.
+     */
+    std::string key(const std::string& source, cl_device_id device, const std::string& options) const;
+
+    /**
+     * @brief Gets the file of the entry with a key.
+     */
+    std::string path(const std::string& key) const;
+
+    std::string directory_;     ///< Directory of the entries, empty when disabled
+};
@@ -0,0 +1,53 @@
+/**
+ * @file ProgramCache.cpp
+ * @brief Implementation of the ProgramCache class.
+ */
+#include "ProgramCache.hpp"
+#include "EmbeddedKernels.hpp"
+
+ProgramCache::ProgramCache(cl_context context, cl_device_id device, const std::string& kernel_file,
+    const std::string& binary_directory)
+    : context_(context), device_(device), binaries_(binary_directory) {
+    if (kernel_file.empty()) {
+        source_.assign(reinterpret_cast<const char*>(embedded_kernels::uniform_quantization), embedded_kernels::uniform_quantization_size);
+    } else {
+        source_ = ocl::read_source(kernel_file);
+    }
+}
+
+ProgramCache::~ProgramCache() {
+    for (auto& entry : kernels_) {
+        clReleaseKernel(entry.second);
+    }
+    for (auto& entry : programs_) {
+        clReleaseProgram(entry.second);
+    }
+}
+
+cl_program ProgramCache::program(int levels) {
+    auto it = programs_.find(levels);
+    if (it != programs_.end()) {
+        return it->second;
+    }
+    const std::string options = levels > 0 ? "-I. -D LEVELS=" + std::to_string(levels) : "-I.";
+    cl_program built = binaries_.load(source_, context_, device_, options);
+    if (!built) {
+        built = ocl::build_program(source_, context_, device_, options);
+        binaries_.store(built, source_, device_, options);
+    }
+    programs_.emplace(levels, built);
+    return built;
+}
+
+cl_kernel ProgramCache::kernel(const std::string& name, int levels) {
+    const auto key = std::make_pair(name, levels);
+    auto it = kernels_.find(key);
+    if (it != kernels_.end()) {
+        return it->second;
+    }
+    cl_int err;
+    cl_kernel created = clCreateKernel(program(levels), name.c_str(), &err);
+    ocl::check(err, "Creating kernel %s for %d levels", name.c_str(), levels);
+    kernels_.emplace(key, created);
+    return created;
+}
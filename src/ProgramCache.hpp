@@ -0,0 +1,71 @@
+/**
+ * @file ProgramCache.hpp
+ * @brief In-process cache of OpenCL programs specialized for a number of quantization levels.
+ */
+#pragma once
+
+#include "ProgramBinaryCache.hpp"
+#include "ocl_utility.hpp"
+
+#include <map>
+#include <string>
+#include <utility>
+
+/**
+ * @class ProgramCache
+ * @brief Builds the kernel source once per number of levels and hands out the kernels of every variant.
+ *
+ * Each variant is built with -D LEVELS=n, so the quantization step is a compile-time constant and the
+ * divisions by it become multiplications, or shifts for power-of-two steps. A level count of 0 builds
+ * the generic program, which reads the levels from the kernel arguments.
+ * Programs are cached per number of levels and kernels per (kernel, levels), both are owned by the cache.
+ * A program is first looked up in the on-disk binary cache, and stored there once built from source.
+ */
+class ProgramCache {
+public:
+    /**
+     * @brief Constructs an empty cache.
+     * @param context The OpenCL context of the programs.
+     * @param device The device the programs are built for.
+     * @param kernel_file The file containing the OpenCL kernels, empty for the kernels embedded in the executable.
+     * @param binary_directory The directory of the compiled program binaries, empty to always build from source.
+     */
+    ProgramCache(cl_context context, cl_device_id device, const std::string& kernel_file,
+        const std::string& binary_directory = "");
+
+    /**
+     * @brief Destructor that releases every cached kernel and program.
+     */
+    ~ProgramCache();
+
+    ProgramCache(const ProgramCache&) = delete;
+    ProgramCache& operator=(const ProgramCache&) = delete;
+
+    /**
+     * @brief Gets the program specialized for a number of levels, building it on first use.
+     * @param levels The number of levels baked into the program, 0 for the generic program.
+     * @return The built program, owned by the cache.
+     */
+    cl_program program(int levels);
+
+    /**
+     * @brief Gets a kernel of the program specialized for a number of levels, creating it on first use.
+     * @param name The name of the kernel.
+     * @param levels The number of levels baked into the program, 0 for the generic program.
+     * @return The kernel, owned by the cache.
+     */
+    cl_kernel kernel(const std::string& name, int levels);
+
+    /**
+     * @brief Gets how many programs have been built, useful to verify that the variants are reused.
+     */
+    size_t build_count() const { return programs_.size(); }
+
+private:
+    cl_context context_;                                        ///< Context of the programs
+    cl_device_id device_;                                       ///< Device the programs are built for
+    std::string source_;                                        ///< Source code of the kernels
+    ProgramBinaryCache binaries_;                               ///< Compiled programs of previous runs
+    std::map<int, cl_program> programs_;                        ///< Built programs by number of levels
+    std::map<std::pair<std::string, int>, cl_kernel> kernels_;  ///< Created kernels by (name, levels)
+};
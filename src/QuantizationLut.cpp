@@ -0,0 +1,107 @@
+/**
+ * @file QuantizationLut.cpp
+ * @brief Implementation of the lookup table builders.
+ */
+#include "QuantizationLut.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace lut {
+
+namespace {
+    /**
+     * @brief Repeats the mapping of one channel for the three channels.
+     */
+    std::vector<uint8_t> replicate(const std::vector<uint8_t>& channel) {
+        std::vector<uint8_t> table(TABLE_SIZE);
+        for (size_t c = 0; c < 3; c++) {
+            std::copy(channel.begin(), channel.end(), table.begin() + c * CHANNEL_SIZE);
+        }
+        return table;
+    }
+}
+
+std::vector<uint8_t> build_uniform(const QuantizationSettings& settings) {
+    const int step = 256 / settings.levels;
+    std::vector<uint8_t> channel(CHANNEL_SIZE);
+    for (int value = 0; value < static_cast<int>(CHANNEL_SIZE); value++) {
+        // same arithmetic as quantize_channel in uniformQuantization.cl, including the uchar truncation
+        int quantized;
+        switch (settings.mode) {
+            case QUANTIZE_LOWER_BOUND:
+                quantized = (value / step) * step;
+                break;
+            case QUANTIZE_UPPER_BOUND:
+                quantized = ((value + step - 1) / step) * step;
+                break;
+            case QUANTIZE_BINARY:
+                quantized = (value >> 7) * 255;
+                break;
+            default:
+                quantized = ((value + step / 2) / step) * step;
+                break;
+        }
+        channel[value] = static_cast<uint8_t>(quantized);
+    }
+    return replicate(channel);
+}
+
+std::vector<uint8_t> build_gamma(const QuantizationSettings& settings, double gamma) {
+    // the binary mode is two levels rounded to the nearest one
+    const int levels = settings.mode == QUANTIZE_BINARY ? 2 : settings.levels;
+    const double last_level = levels - 1;
+    std::vector<uint8_t> channel(CHANNEL_SIZE);
+    for (size_t value = 0; value < CHANNEL_SIZE; value++) {
+        const double linear = std::pow(value / 255.0, gamma) * last_level;
+        double level;
+        switch (settings.mode) {
+            case QUANTIZE_LOWER_BOUND:
+                level = std::floor(linear);
+                break;
+            case QUANTIZE_UPPER_BOUND:
+                level = std::ceil(linear);
+                break;
+            default:
+                level = std::round(linear);
+                break;
+        }
+        const double encoded = std::pow(level / last_level, 1.0 / gamma) * 255.0;
+        channel[value] = static_cast<uint8_t>(std::clamp(std::lround(encoded), 0l, 255l));
+    }
+    return replicate(channel);
+}
+
+std::vector<uint8_t> load(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        throw std::runtime_error("[THROW] lut::load: Could not open lookup table file " + filename);
+    }
+    std::vector<uint8_t> values;
+    int value;
+    while (file >> value) {
+        if (value < 0 || value > 255) {
+            throw std::runtime_error("[THROW] lut::load: Lookup table values must be between 0 and 255");
+        }
+        values.push_back(static_cast<uint8_t>(value));
+    }
+    if (!file.eof()) {
+        throw std::runtime_error("[THROW] lut::load: Lookup table file contains something that is not a number");
+    }
+    if (values.size() == CHANNEL_SIZE) {
+        return replicate(values);
+    }
+    if (values.size() != TABLE_SIZE) {
+        throw std::runtime_error("[THROW] lut::load: Lookup table file must hold 256 or 768 values");
+    }
+    return values;
+}
+
+bool is_shared(const std::vector<uint8_t>& table) {
+    return std::equal(table.begin(), table.begin() + CHANNEL_SIZE, table.begin() + CHANNEL_SIZE)
+        && std::equal(table.begin(), table.begin() + CHANNEL_SIZE, table.begin() + 2 * CHANNEL_SIZE);
+}
+
+} // namespace lut
@@ -0,0 +1,50 @@
+/**
+ * @file QuantizationLut.hpp
+ * @brief Builders of the per-channel lookup tables applied by the LUT quantization path.
+ *
+ * A table holds 3 x 256 entries, the mapping of the R, G and B channels one after the other.
+ * Any per-channel curve can be expressed as a table, so new curves do not need new kernels.
+ */
+#pragma once
+
+#include "FrameProcessor.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lut {
+    constexpr size_t CHANNEL_SIZE = 256;                ///< Entries of the table of one channel
+    constexpr size_t TABLE_SIZE = 3 * CHANNEL_SIZE;     ///< Entries of a full table, R then G then B
+
+    /**
+     * @brief Builds the table of the uniform quantization, bit-exact with the arithmetic kernels.
+     * @param settings The number of levels and the rounding mode.
+     * @return The table, the same mapping for the three channels.
+     */
+    std::vector<uint8_t> build_uniform(const QuantizationSettings& settings);
+
+    /**
+     * @brief Builds a table whose levels are evenly spaced in linear light instead of in the encoded values.
+     * The values are linearized with the power curve, quantized with the rounding mode and encoded back.
+     * @param settings The number of levels and the rounding mode.
+     * @param gamma The exponent of the power curve, e.g. 2.2.
+     * @return The table, the same mapping for the three channels.
+     */
+    std::vector<uint8_t> build_gamma(const QuantizationSettings& settings, double gamma);
+
+    /**
+     * @brief Loads a custom table from a text file of whitespace-separated values between 0 and 255.
+     * A file of 256 values applies the same mapping to the three channels, one of 768 values holds R, G and B.
+     * @param filename The file to load.
+     * @return The table.
+     * @throws std::runtime_error if the file cannot be read or does not hold a valid table.
+     */
+    std::vector<uint8_t> load(const std::string& filename);
+
+    /**
+     * @brief Tells whether the three channels of a table use the same mapping.
+     */
+    bool is_shared(const std::vector<uint8_t>& table);
+} // namespace lut
@@ -0,0 +1,289 @@
+/**
+ * @file RawVideoStream.cpp
+ * @brief Implementation of the RawVideoReader and RawVideoWriter classes.
+ */
+#include "RawVideoStream.hpp"
+#include "Log.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+    /// Capacity asked for the pipes, a few frames of a small video, the kernel caps it at /proc/sys/fs/pipe-max-size
+    const int PIPE_SIZE = 1 << 20;
+
+    /// Longest header or FRAME line accepted, the tags are a few dozen bytes
+    const size_t MAX_LINE = 4096;
+
+    /**
+     * @brief Enlarges the pipe behind a stream, so that every read or write moves more data at once.
+     * Files and terminals are left alone, and a refusal only keeps the default capacity.
+     */
+    void enlarge_pipe(std::FILE* file) {
+#ifdef F_SETPIPE_SZ
+        const int fd = fileno(file);
+        struct stat status;
+        if (fstat(fd, &status) == 0 && S_ISFIFO(status.st_mode) && fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE) < 0) {
+            LOG_DEBUG("Keeping the default pipe capacity");
+        }
+#else
+        (void)file;
+#endif
+    }
+
+    /**
+     * @brief Reads a line without its newline.
+     * @return False if the stream ends before the first character.
+     */
+    bool read_line(std::FILE* file, std::string& line, const char* caller) {
+        line.clear();
+        int c = std::getc(file);
+        if (c == EOF) {
+            return false;
+        }
+        while (c != '\n') {
+            if (c == EOF || line.size() == MAX_LINE) {
+                throw std::runtime_error(std::string("[THROW] ") + caller + ": Truncated or oversized Y4M line");
+            }
+            line.push_back(static_cast<char>(c));
+            c = std::getc(file);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Swaps the red and blue channels of 4-byte pixels, RGBA to BGRA and back.
+     */
+    void swap_red_blue(const uint8_t* source, uint8_t* destination, size_t pixels) {
+        for (size_t i = 0; i < pixels; i++) {
+            const uint8_t red = source[4 * i];
+            destination[4 * i] = source[4 * i + 2];
+            destination[4 * i + 1] = source[4 * i + 1];
+            destination[4 * i + 2] = red;
+            destination[4 * i + 3] = source[4 * i + 3];
+        }
+    }
+
+    /**
+     * @brief Gets the size in bytes of a frame.
+     */
+    size_t frame_bytes(RawFormat format, int width, int height) {
+        return is_planar_format(format) ? yuv420_frame_size(width, height) : static_cast<size_t>(width) * height * 4;
+    }
+}
+
+bool parse_raw_format(const std::string& name, RawFormat& format) {
+    if (name == "y4m") {
+        format = RAW_Y4M;
+    } else if (name == "rgba") {
+        format = RAW_RGBA;
+    } else if (name == "bgra") {
+        format = RAW_BGRA;
+    } else if (name == "yuv420p") {
+        format = RAW_YUV420P;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+RawVideoReader::RawVideoReader(const std::string& path, RawFormat format, int width, int height)
+    : path_(path == "-" ? "stdin" : path), format_(format), file_(path == "-" ? stdin : std::fopen(path.c_str(), "rb")),
+    width_(width), height_(height), full_range_(false), stats_(nullptr) {
+    if (!file_) {
+        throw std::runtime_error("[THROW] RawVideoReader::RawVideoReader: Cannot open " + path);
+    }
+    enlarge_pipe(file_);
+    if (format_ == RAW_Y4M) {
+        try {
+            read_y4m_header();
+        } catch (...) {
+            if (file_ != stdin) {
+                std::fclose(file_);
+            }
+            throw;
+        }
+    }
+    if (width_ <= 0 || height_ <= 0) {
+        if (file_ != stdin) {
+            std::fclose(file_);
+        }
+        throw std::runtime_error("[THROW] RawVideoReader::RawVideoReader: The size of the raw frames of " + path_ + " is missing");
+    }
+    if (has_yuv420_frames()) {
+        frame_.resize(frame_bytes(format_, width_, height_));
+    }
+}
+
+RawVideoReader::~RawVideoReader() {
+    if (file_ != stdin) {
+        std::fclose(file_);
+    }
+}
+
+void RawVideoReader::read_y4m_header() {
+    std::string line;
+    if (!read_line(file_, line, "RawVideoReader::read_y4m_header") || line.compare(0, 9, "YUV4MPEG2") != 0) {
+        throw std::runtime_error("[THROW] RawVideoReader::read_y4m_header: " + path_ + " is not a YUV4MPEG2 stream");
+    }
+    std::istringstream tags(line.substr(9));
+    std::string tag;
+    while (tags >> tag) {
+        if (tag[0] == 'W') {
+            width_ = std::atoi(tag.c_str() + 1);
+        } else if (tag[0] == 'H') {
+            height_ = std::atoi(tag.c_str() + 1);
+        } else if (tag[0] == 'C' && tag != "C420jpeg" && tag != "C420paldv" && tag != "C420mpeg2" && tag != "C420") {
+            // the chroma siting of the 4:2:0 variants does not change the layout of the planes
+            throw std::runtime_error("[THROW] RawVideoReader::read_y4m_header: Unsupported Y4M chroma " + tag.substr(1)
+                + ", expected 4:2:0");
+        } else if (tag.compare(0, 12, "XCOLORRANGE=") == 0) {
+            // the range of the output depends on the processing, y4m_parameters() writes it again
+            full_range_ = tag == "XCOLORRANGE=FULL";
+            continue;
+        }
+        y4m_tags_.push_back(tag);
+    }
+    LOG_INFO("Y4M stream " << width_ << "x" << height_ << (full_range_ ? ", full range" : ""));
+}
+
+std::string RawVideoReader::y4m_parameters(bool full_range) const {
+    std::string parameters;
+    for (const std::string& tag : y4m_tags_) {
+        parameters += " " + tag;
+    }
+    if (full_range) {
+        parameters += " XCOLORRANGE=FULL";
+    } else if (full_range_) {
+        parameters += " XCOLORRANGE=LIMITED";
+    }
+    return parameters;
+}
+
+bool RawVideoReader::read_frame_header() {
+    std::string line;
+    if (!read_line(file_, line, "RawVideoReader::read_frame_header")) {
+        return false;
+    }
+    // the per-frame tags are optional and not carried over
+    if (line.compare(0, 5, "FRAME") != 0) {
+        throw std::runtime_error("[THROW] RawVideoReader::read_frame_header: Invalid Y4M frame header in " + path_);
+    }
+    return true;
+}
+
+bool RawVideoReader::read_frame(uint8_t* destination, size_t size) {
+    const size_t read = std::fread(destination, 1, size, file_);
+    if (read == size) {
+        return true;
+    }
+    if (std::ferror(file_)) {
+        throw std::runtime_error("[THROW] RawVideoReader::read_frame: Error reading " + path_);
+    }
+    if (read > 0) {
+        LOG_WARNING("The last frame of " << path_ << " is truncated (" << read << " of " << size << " bytes), it is dropped");
+    }
+    return false;
+}
+
+bool RawVideoReader::read_next_frame(uint8_t* destination, int destination_linesize) {
+    if (has_yuv420_frames()) {
+        throw std::runtime_error("[THROW] RawVideoReader::read_next_frame: The frames of " + path_ + " are planar");
+    }
+    const size_t row_size = static_cast<size_t>(width_) * 4;
+    const size_t linesize = destination_linesize > 0 ? static_cast<size_t>(destination_linesize) : row_size;
+    {
+        StageTimer timer(stats_, "read");
+        // a whole frame in one read when the rows are packed, which is how the frame loops hand them
+        bool complete = true;
+        if (linesize == row_size) {
+            complete = read_frame(destination, row_size * height_);
+        } else {
+            for (int row = 0; row < height_ && complete; row++) {
+                complete = read_frame(destination + row * linesize, row_size);
+            }
+        }
+        if (!complete) {
+            timer.discard();
+            return false;
+        }
+    }
+    if (format_ == RAW_RGBA) {
+        // the backends take BGRA, the swap is undone by their BGRA to RGBA output
+        StageTimer timer(stats_, "convert_bgra");
+        for (int row = 0; row < height_; row++) {
+            swap_red_blue(destination + row * linesize, destination + row * linesize, width_);
+        }
+    }
+    return true;
+}
+
+bool RawVideoReader::read_next_frame_planar(PlanarFrame& planes) {
+    if (!has_yuv420_frames()) {
+        throw std::runtime_error("[THROW] RawVideoReader::read_next_frame_planar: The frames of " + path_ + " are not planar");
+    }
+    StageTimer timer(stats_, "read");
+    if ((format_ == RAW_Y4M && !read_frame_header()) || !read_frame(frame_.data(), frame_.size())) {
+        timer.discard();
+        return false;
+    }
+    planes = make_packed_yuv420(frame_.data(), width_, height_);
+    return true;
+}
+
+RawVideoWriter::RawVideoWriter(const std::string& path, RawFormat format, int width, int height, const std::string& y4m_parameters)
+    : path_(path == "-" ? "stdout" : path), format_(format), file_(path == "-" ? stdout : std::fopen(path.c_str(), "wb")),
+    width_(width), height_(height), frame_(frame_bytes(format, width, height)), stats_(nullptr) {
+    if (!file_) {
+        throw std::runtime_error("[THROW] RawVideoWriter::RawVideoWriter: Cannot open " + path);
+    }
+    enlarge_pipe(file_);
+    if (format_ == RAW_Y4M) {
+        const std::string parameters = y4m_parameters.empty()
+            ? " W" + std::to_string(width_) + " H" + std::to_string(height_) + " F25:1 Ip A1:1 C420jpeg" : y4m_parameters;
+        std::fprintf(file_, "YUV4MPEG2%s\n", parameters.c_str());
+    }
+}
+
+RawVideoWriter::~RawVideoWriter() {
+    if (std::fflush(file_) != 0) {
+        LOG_ERROR("Error flushing " << path_);
+    }
+    if (file_ != stdout) {
+        std::fclose(file_);
+    }
+}
+
+void RawVideoWriter::write(const uint8_t* data, size_t size) {
+    StageTimer timer(stats_, "write");
+    if ((format_ == RAW_Y4M && std::fputs("FRAME\n", file_) == EOF) || std::fwrite(data, 1, size, file_) != size) {
+        throw std::runtime_error("[THROW] RawVideoWriter::write: Error writing to " + path_);
+    }
+}
+
+void RawVideoWriter::write_frame(const uint8_t* rgba_data) {
+    if (is_planar_format(format_)) {
+        throw std::runtime_error("[THROW] RawVideoWriter::write_frame: The frames of " + path_ + " are planar");
+    }
+    if (format_ == RAW_BGRA) {
+        {
+            StageTimer timer(stats_, "convert_bgra");
+            swap_red_blue(rgba_data, frame_.data(), static_cast<size_t>(width_) * height_);
+        }
+        write(frame_.data(), frame_.size());
+    } else {
+        write(rgba_data, frame_.size());
+    }
+}
+
+PlanarFrame RawVideoWriter::acquire_frame() {
+    return make_packed_yuv420(frame_.data(), width_, height_);
+}
+
+void RawVideoWriter::submit_frame() {
+    write(frame_.data(), frame_.size());
+}
@@ -0,0 +1,205 @@
+/**
+ * @file RawVideoStream.hpp
+ * @brief Uncompressed frames read from and written to pipes, so that the quantizer can run as a filter between two tools.
+ */
+#pragma once
+
+#include "FrameStats.hpp"
+#include "PlanarFrame.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Layouts of the frames of a raw stream.
+ */
+enum RawFormat : int32_t {
+    RAW_Y4M = 0,        ///< YUV4MPEG2: a header line, then every 4:2:0 frame after a FRAME line
+    RAW_RGBA = 1,       ///< Headerless RGBA frames, 4 bytes per pixel
+    RAW_BGRA = 2,       ///< Headerless BGRA frames, 4 bytes per pixel
+    RAW_YUV420P = 3     ///< Headerless 4:2:0 frames with packed planes: Y, then U, then V
+};
+
+/**
+ * @brief Parses a raw format name: y4m, rgba, bgra or yuv420p.
+ * @param name The name.
+ * @param format Receives the format.
+ * @return Whether the name is valid.
+ */
+bool parse_raw_format(const std::string& name, RawFormat& format);
+
+/**
+ * @brief Tells whether the frames of a format are YUV 4:2:0 planes rather than packed pixels.
+ */
+inline bool is_planar_format(RawFormat format) {
+    return format == RAW_Y4M || format == RAW_YUV420P;
+}
+
+/**
+ * @class RawVideoReader
+ * @brief Reads uncompressed frames from a file, a FIFO or stdin, with the reading interface of VideoReaderFFMPEG.
+ *
+ * There is no container or codec: a frame is a single read of the whole frame, which stdio hands to the
+ * kernel without going through its own buffer, straight into the destination for the packed formats.
+ * A pipe is enlarged so that the writer and the reader switch less often. The stream only goes forward,
+ * so it cannot be split into segments.
+ */
+class RawVideoReader {
+public:
+    /**
+     * @brief Opens the stream and, for Y4M, reads its header.
+     * @param path The file or FIFO to read, "-" for stdin.
+     * @param format The layout of the frames.
+     * @param width The width of the frames, ignored for Y4M which gives it in its header.
+     * @param height The height of the frames, ignored for Y4M.
+     * @throws std::runtime_error if the stream cannot be opened, the header is invalid or the size is missing.
+     */
+    RawVideoReader(const std::string& path, RawFormat format, int width = 0, int height = 0);
+
+    /**
+     * @brief Destructor that closes the stream, unless it is stdin.
+     */
+    ~RawVideoReader();
+
+    RawVideoReader(const RawVideoReader&) = delete;
+    RawVideoReader& operator=(const RawVideoReader&) = delete;
+
+    /**
+     * @brief Reads the next frame of a packed format as BGRA, the layout the backends take.
+     * @param destination Memory receiving the BGRA frame, at least destination_linesize * height bytes.
+     * @param destination_linesize The size in bytes of a row of the destination, 0 for tightly packed rows (4 * width).
+     * @return True if a frame was read, false at the end of the stream.
+     * @throws std::runtime_error if the format is planar or the stream fails.
+     */
+    bool read_next_frame(uint8_t* destination, int destination_linesize = 0);
+
+    /**
+     * @brief Reads the next frame of a planar format.
+     * @param planes Output parameter receiving the view over the planes, valid until the next read.
+     * @return True if a frame was read, false at the end of the stream.
+     * @throws std::runtime_error if the format is packed or the stream fails.
+     */
+    bool read_next_frame_planar(PlanarFrame& planes);
+
+    /**
+     * @brief Tells whether the frames are YUV 4:2:0 planes.
+     */
+    bool has_yuv420_frames() const { return is_planar_format(format_); }
+
+    /**
+     * @brief Tells whether the YUV samples use the full range, as given by the XCOLORRANGE tag of a Y4M header.
+     */
+    bool is_full_range() const { return full_range_; }
+
+    /**
+     * @brief Gets the parameters of the Y4M header for the processed stream, with the color range of the output.
+     * @param full_range Whether the processed samples use the full range.
+     * @return The parameters following "YUV4MPEG2", e.g. " W320 H180 F30:1 Ip A1:1 C420jpeg".
+     */
+    std::string y4m_parameters(bool full_range) const;
+
+    int get_width() const { return width_; }
+
+    int get_height() const { return height_; }
+
+    /**
+     * @brief Records the read time of every frame into a collector.
+     * @param stats The collector, null to stop recording.
+     */
+    void set_stats(FrameStats* stats) { stats_ = stats; }
+
+private:
+    /**
+     * @brief Reads the header of a Y4M stream.
+     */
+    void read_y4m_header();
+
+    /**
+     * @brief Skips the FRAME line preceding a Y4M frame.
+     * @return False at the end of the stream.
+     */
+    bool read_frame_header();
+
+    /**
+     * @brief Reads a whole frame.
+     * @return False at the end of the stream, or if the last frame is truncated.
+     */
+    bool read_frame(uint8_t* destination, size_t size);
+
+    std::string path_;                      ///< Name of the stream, for the messages
+    RawFormat format_;                      ///< Layout of the frames
+    std::FILE* file_;                       ///< The stream
+    int width_;                             ///< Frame width
+    int height_;                            ///< Frame height
+    bool full_range_;                       ///< Whether the YUV samples use the full range
+    std::vector<std::string> y4m_tags_;     ///< Parameters of the Y4M header, XCOLORRANGE excluded
+    std::vector<uint8_t> frame_;            ///< The last planar frame
+    FrameStats* stats_;                     ///< Collector of the stage timings, null when not recording
+};
+
+/**
+ * @class RawVideoWriter
+ * @brief Writes uncompressed frames to a file, a FIFO or stdout, with the writing interface of VideoWriterFFMPEG.
+ */
+class RawVideoWriter {
+public:
+    /**
+     * @brief Opens the stream and, for Y4M, writes its header.
+     * @param path The file or FIFO to write, "-" for stdout.
+     * @param format The layout of the frames, the same as the input for a filter.
+     * @param width The width of the frames.
+     * @param height The height of the frames.
+     * @param y4m_parameters The parameters of the Y4M header, see RawVideoReader::y4m_parameters().
+     * @throws std::runtime_error if the stream cannot be opened.
+     */
+    RawVideoWriter(const std::string& path, RawFormat format, int width, int height, const std::string& y4m_parameters = "");
+
+    /**
+     * @brief Destructor that flushes the stream and closes it, unless it is stdout.
+     */
+    ~RawVideoWriter();
+
+    RawVideoWriter(const RawVideoWriter&) = delete;
+    RawVideoWriter& operator=(const RawVideoWriter&) = delete;
+
+    /**
+     * @brief Writes an RGBA frame coming out of a backend, in the packed format of the stream.
+     * @param rgba_data A pointer to the RGBA pixels.
+     * @throws std::runtime_error if the format is planar or the stream fails.
+     */
+    void write_frame(const uint8_t* rgba_data);
+
+    /**
+     * @brief Gets the planes of the next frame, so that the backend writes straight into them.
+     * The frame is written by submit_frame().
+     */
+    PlanarFrame acquire_frame();
+
+    /**
+     * @brief Writes the frame written into the planes returned by acquire_frame().
+     * @throws std::runtime_error if the stream fails.
+     */
+    void submit_frame();
+
+    /**
+     * @brief Records the write time of every frame into a collector.
+     * @param stats The collector, null to stop recording.
+     */
+    void set_stats(FrameStats* stats) { stats_ = stats; }
+
+private:
+    /**
+     * @brief Writes a whole frame, preceded by its FRAME line for Y4M.
+     */
+    void write(const uint8_t* data, size_t size);
+
+    std::string path_;                      ///< Name of the stream, for the messages
+    RawFormat format_;                      ///< Layout of the frames
+    std::FILE* file_;                       ///< The stream
+    int width_;                             ///< Frame width
+    int height_;                            ///< Frame height
+    std::vector<uint8_t> frame_;            ///< Planes of the next frame, or the BGRA conversion of a packed one
+    FrameStats* stats_;                     ///< Collector of the stage timings, null when not recording
+};
@@ -0,0 +1,387 @@
+/**
+ * @file Segments.cpp
+ * @brief Implementation of the keyframe-aligned segmentation and of the segment concatenation.
+ */
+#include "Segments.hpp"
+#include "Log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+KeyframeIndex scan_keyframes(const std::string& filename) {
+    AVFormatContext* format_ctx = nullptr;
+    if (avformat_open_input(&format_ctx, filename.c_str(), nullptr, nullptr) < 0) {
+        throw std::runtime_error("[THROW] scan_keyframes: Failed to open video file: " + filename);
+    }
+    if (avformat_find_stream_info(format_ctx, nullptr) < 0) {
+        avformat_close_input(&format_ctx);
+        throw std::runtime_error("[THROW] scan_keyframes: Failed to retrieve stream info");
+    }
+    int video_stream_index = -1;
+    for (unsigned i = 0; i < format_ctx->nb_streams; i++) {
+        if (format_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            video_stream_index = i;
+            break;
+        }
+    }
+    if (video_stream_index == -1) {
+        avformat_close_input(&format_ctx);
+        throw std::runtime_error("[THROW] scan_keyframes: No video stream found");
+    }
+
+    KeyframeIndex index;
+    index.time_base = format_ctx->streams[video_stream_index]->time_base;
+    // only the packet headers are read, nothing is decoded
+    AVPacket* packet = av_packet_alloc();
+    int64_t leading_packets = 0;
+    while (av_read_frame(format_ctx, packet) >= 0) {
+        if (packet->stream_index == video_stream_index) {
+            const int64_t timestamp = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+            if ((packet->flags & AV_PKT_FLAG_KEY) && timestamp != AV_NOPTS_VALUE
+                && (index.keyframes.empty() || timestamp > index.keyframes.back())) {
+                index.keyframes.push_back(timestamp);
+                index.gop_frames.push_back(0);
+            }
+            if (index.gop_frames.empty()) {
+                leading_packets++;
+            } else {
+                index.gop_frames.back()++;
+            }
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    avformat_close_input(&format_ctx);
+    if (index.keyframes.empty()) {
+        throw std::runtime_error("[THROW] scan_keyframes: No keyframe found in " + filename);
+    }
+    // packets before the first keyframe belong to the first segment
+    index.gop_frames.front() += leading_packets;
+    return index;
+}
+
+std::vector<Segment> plan_segments(const KeyframeIndex& index, int segment_count) {
+    const size_t gop_count = index.keyframes.size();
+    segment_count = std::max(1, std::min(segment_count, static_cast<int>(gop_count)));
+    int64_t total_frames = 0;
+    for (int64_t frames : index.gop_frames) {
+        total_frames += frames;
+    }
+
+    std::vector<Segment> segments;
+    size_t gop = 0;
+    int64_t covered_frames = 0;
+    for (int s = 0; s < segment_count; s++) {
+        Segment segment;
+        segment.index = s;
+        segment.start_pts = s == 0 ? std::numeric_limits<int64_t>::min() : index.keyframes[gop];
+        // every segment takes at least one GOP, and leaves at least one to each of the following segments
+        const int64_t target = total_frames * (s + 1) / segment_count;
+        const size_t last_gop = gop_count - (segment_count - s - 1);
+        do {
+            segment.expected_frames += index.gop_frames[gop];
+            covered_frames += index.gop_frames[gop];
+            gop++;
+        } while (gop < last_gop && covered_frames + index.gop_frames[gop] / 2 <= target);
+        if (s == segment_count - 1) {
+            while (gop < gop_count) {
+                segment.expected_frames += index.gop_frames[gop];
+                gop++;
+            }
+        }
+        segment.end_pts = gop < gop_count ? index.keyframes[gop] : std::numeric_limits<int64_t>::max();
+        segments.push_back(segment);
+    }
+    return segments;
+}
+
+std::string segment_path(const std::string& output, int index) {
+    const size_t slash = output.find_last_of('/');
+    const size_t dot = output.find_last_of('.');
+    const bool has_extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    const std::string stem = has_extension ? output.substr(0, dot) : output;
+    const std::string extension = has_extension ? output.substr(dot) : "";
+    char number[16];
+    std::snprintf(number, sizeof(number), "%03d", index);
+    return stem + ".segment" + number + extension;
+}
+
+std::vector<int64_t> run_segments(const std::vector<Segment>& segments, int worker_count,
+    const std::function<int64_t(const Segment&)>& process_segment) {
+    std::vector<int64_t> frames(segments.size(), 0);
+    std::atomic<size_t> next_segment(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]() {
+        // the segments are taken in order, so the longest running ones start first when they are balanced
+        for (size_t s = next_segment++; s < segments.size(); s = next_segment++) {
+            try {
+                frames[s] = process_segment(segments[s]);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                // the other workers stop at their next segment
+                next_segment = segments.size();
+                return;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    const size_t thread_count = std::min<size_t>(std::max(1, worker_count), segments.size());
+    for (size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back(worker);
+    }
+    for (std::thread& thread : workers) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return frames;
+}
+
+void concat_segments(const std::vector<SegmentFile>& segments, const std::string& output, int fps) {
+    if (segments.empty()) {
+        throw std::runtime_error("[THROW] concat_segments: No segment to concatenate");
+    }
+    // same container choice as VideoWriterFFMPEG
+    AVFormatContext* output_ctx = nullptr;
+    avformat_alloc_output_context2(&output_ctx, output.find(".webm") != std::string::npos
+        ? av_guess_format("webm", nullptr, nullptr) : av_guess_format("mp4", nullptr, nullptr), nullptr, output.c_str());
+    if (!output_ctx) {
+        throw std::runtime_error("[THROW] concat_segments: Could not allocate output format context");
+    }
+    AVStream* output_stream = nullptr;
+    AVPacket* packet = av_packet_alloc();
+    int64_t frames_before = 0;
+    int64_t last_dts = std::numeric_limits<int64_t>::min();
+    try {
+        for (const SegmentFile& segment : segments) {
+            AVFormatContext* input_ctx = nullptr;
+            if (avformat_open_input(&input_ctx, segment.path.c_str(), nullptr, nullptr) < 0
+                || avformat_find_stream_info(input_ctx, nullptr) < 0 || input_ctx->nb_streams == 0) {
+                avformat_close_input(&input_ctx);
+                throw std::runtime_error("[THROW] concat_segments: Could not read segment " + segment.path);
+            }
+            AVStream* input_stream = input_ctx->streams[0];
+            if (!output_stream) {
+                // the first segment gives the stream parameters, the others were encoded with the same settings
+                output_stream = avformat_new_stream(output_ctx, nullptr);
+                if (!output_stream || avcodec_parameters_copy(output_stream->codecpar, input_stream->codecpar) < 0) {
+                    avformat_close_input(&input_ctx);
+                    throw std::runtime_error("[THROW] concat_segments: Could not create output stream");
+                }
+                output_stream->codecpar->codec_tag = 0;
+                output_stream->time_base = input_stream->time_base;
+                if (!(output_ctx->oformat->flags & AVFMT_NOFILE) && avio_open(&output_ctx->pb, output.c_str(), AVIO_FLAG_WRITE) < 0) {
+                    avformat_close_input(&input_ctx);
+                    throw std::runtime_error("[THROW] concat_segments: Could not open output file " + output);
+                }
+                if (avformat_write_header(output_ctx, nullptr) < 0) {
+                    avformat_close_input(&input_ctx);
+                    throw std::runtime_error("[THROW] concat_segments: Error occurred when writing header");
+                }
+            }
+            // the writer numbers the frames of every segment from 0, so the segment is shifted by the frames before it
+            const int64_t offset = av_rescale_q(frames_before, AVRational{1, fps}, output_stream->time_base);
+            int64_t packets = 0;
+            while (av_read_frame(input_ctx, packet) >= 0) {
+                if (packet->stream_index != 0) {
+                    av_packet_unref(packet);
+                    continue;
+                }
+                av_packet_rescale_ts(packet, input_stream->time_base, output_stream->time_base);
+                if (packet->pts != AV_NOPTS_VALUE) {
+                    packet->pts += offset;
+                }
+                if (packet->dts != AV_NOPTS_VALUE) {
+                    packet->dts += offset;
+                    // same strictly increasing DTS guarantee as the writer
+                    if (packet->dts <= last_dts) {
+                        packet->dts = last_dts + 1;
+                        packet->pts = std::max(packet->pts, packet->dts);
+                    }
+                    last_dts = packet->dts;
+                }
+                packet->stream_index = output_stream->index;
+                packet->pos = -1;
+                if (av_interleaved_write_frame(output_ctx, packet) < 0) {
+                    av_packet_unref(packet);
+                    avformat_close_input(&input_ctx);
+                    throw std::runtime_error("[THROW] concat_segments: Error writing packet");
+                }
+                av_packet_unref(packet);
+                packets++;
+            }
+            avformat_close_input(&input_ctx);
+            // the encoder writes a packet per frame, a missing one would shift every following timestamp
+            if (packets != segment.frames) {
+                throw std::runtime_error("[THROW] concat_segments: Segment " + segment.path + " holds " + std::to_string(packets)
+                    + " packets instead of " + std::to_string(segment.frames) + " frames");
+            }
+            frames_before += segment.frames;
+            LOG_INFO("Concatenated " << segment.path << ", " << segment.frames << " frames");
+        }
+        av_write_trailer(output_ctx);
+    } catch (...) {
+        av_packet_free(&packet);
+        if (output_ctx->pb) {
+            avio_closep(&output_ctx->pb);
+        }
+        avformat_free_context(output_ctx);
+        throw;
+    }
+    av_packet_free(&packet);
+    if (!(output_ctx->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&output_ctx->pb);
+    }
+    avformat_free_context(output_ctx);
+}
+
+std::string manifest_path(const std::string& output, int shard, int shard_count) {
+    const size_t slash = output.find_last_of('/');
+    const size_t dot = output.find_last_of('.');
+    const bool has_extension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    const std::string stem = has_extension ? output.substr(0, dot) : output;
+    return stem + ".shard" + std::to_string(shard) + "of" + std::to_string(shard_count) + ".manifest";
+}
+
+void write_manifest(const std::string& path, const SegmentManifest& manifest) {
+    const std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream file(temporary_path);
+        if (!file) {
+            throw std::runtime_error("[THROW] write_manifest: Could not create " + temporary_path);
+        }
+        // one record per line, the paths come last so they can hold spaces
+        file << "video-color-quantizer-manifest 1\n";
+        file << "input " << manifest.input << "\n";
+        file << "fps " << manifest.fps << "\n";
+        file << "time_base " << manifest.time_base.num << " " << manifest.time_base.den << "\n";
+        file << "plan " << manifest.segment_count << "\n";
+        file << "shard " << manifest.shard << " " << manifest.shard_count << "\n";
+        for (size_t i = 0; i < manifest.segments.size(); i++) {
+            const Segment& segment = manifest.segments[i];
+            file << "segment " << segment.index << " " << segment.start_pts << " " << segment.end_pts << " "
+                << manifest.files[i].frames << " " << manifest.files[i].path << "\n";
+        }
+        if (!file.flush()) {
+            throw std::runtime_error("[THROW] write_manifest: Could not write " + temporary_path);
+        }
+    }
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("[THROW] write_manifest: Could not rename " + temporary_path + " to " + path);
+    }
+}
+
+SegmentManifest read_manifest(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("[THROW] read_manifest: Could not open " + path);
+    }
+    SegmentManifest manifest;
+    std::string line;
+    int line_number = 0;
+    bool has_header = false;
+    while (std::getline(file, line)) {
+        line_number++;
+        std::istringstream record(line);
+        std::string key;
+        record >> key;
+        bool valid = true;
+        if (key.empty()) {
+            continue;
+        } else if (key == "video-color-quantizer-manifest") {
+            int version = 0;
+            valid = static_cast<bool>(record >> version) && version == 1;
+            has_header = valid;
+        } else if (key == "input") {
+            std::getline(record >> std::ws, manifest.input);
+        } else if (key == "fps") {
+            valid = static_cast<bool>(record >> manifest.fps);
+        } else if (key == "time_base") {
+            valid = static_cast<bool>(record >> manifest.time_base.num >> manifest.time_base.den);
+        } else if (key == "plan") {
+            valid = static_cast<bool>(record >> manifest.segment_count);
+        } else if (key == "shard") {
+            valid = static_cast<bool>(record >> manifest.shard >> manifest.shard_count);
+        } else if (key == "segment") {
+            Segment segment;
+            SegmentFile segment_file;
+            valid = static_cast<bool>(record >> segment.index >> segment.start_pts >> segment.end_pts >> segment_file.frames);
+            std::getline(record >> std::ws, segment_file.path);
+            valid = valid && !segment_file.path.empty();
+            segment.expected_frames = segment_file.frames;
+            manifest.segments.push_back(segment);
+            manifest.files.push_back(segment_file);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            throw std::runtime_error("[THROW] read_manifest: Malformed line " + std::to_string(line_number) + " of " + path);
+        }
+    }
+    if (!has_header) {
+        throw std::runtime_error("[THROW] read_manifest: " + path + " is not a segment manifest");
+    }
+    return manifest;
+}
+
+std::vector<SegmentFile> validate_manifests(const std::vector<SegmentManifest>& manifests) {
+    if (manifests.empty()) {
+        throw std::runtime_error("[THROW] validate_manifests: No manifest given");
+    }
+    const SegmentManifest& first = manifests.front();
+    if (first.segment_count < 1 || first.fps < 1) {
+        throw std::runtime_error("[THROW] validate_manifests: The manifest of shard " + std::to_string(first.shard) + " has no valid plan");
+    }
+    std::vector<const Segment*> segments(first.segment_count, nullptr);
+    std::vector<const SegmentFile*> files(first.segment_count, nullptr);
+    for (const SegmentManifest& manifest : manifests) {
+        const std::string shard = "shard " + std::to_string(manifest.shard) + "/" + std::to_string(manifest.shard_count);
+        if (manifest.input != first.input || manifest.fps != first.fps || manifest.segment_count != first.segment_count
+            || manifest.shard_count != first.shard_count || manifest.time_base.num != first.time_base.num
+            || manifest.time_base.den != first.time_base.den) {
+            throw std::runtime_error("[THROW] validate_manifests: The manifest of " + shard + " comes from a different input or plan");
+        }
+        for (size_t i = 0; i < manifest.segments.size(); i++) {
+            const int index = manifest.segments[i].index;
+            if (index < 0 || index >= first.segment_count) {
+                throw std::runtime_error("[THROW] validate_manifests: The manifest of " + shard + " has segment " + std::to_string(index)
+                    + " outside of the plan");
+            }
+            if (segments[index]) {
+                throw std::runtime_error("[THROW] validate_manifests: Segment " + std::to_string(index) + " appears twice");
+            }
+            segments[index] = &manifest.segments[i];
+            files[index] = &manifest.files[i];
+        }
+    }
+    std::vector<SegmentFile> ordered;
+    for (int index = 0; index < first.segment_count; index++) {
+        if (!segments[index]) {
+            throw std::runtime_error("[THROW] validate_manifests: Segment " + std::to_string(index) + " is missing, is a shard manifest missing?");
+        }
+        // the ranges must tile the whole timeline, with no gap and no overlap
+        const int64_t expected_start = index == 0 ? std::numeric_limits<int64_t>::min() : segments[index - 1]->end_pts;
+        if (segments[index]->start_pts != expected_start || segments[index]->end_pts <= segments[index]->start_pts) {
+            throw std::runtime_error("[THROW] validate_manifests: The timestamps of segment " + std::to_string(index)
+                + " do not follow the ones of the previous segment");
+        }
+        ordered.push_back(*files[index]);
+    }
+    if (segments.back()->end_pts != std::numeric_limits<int64_t>::max()) {
+        throw std::runtime_error("[THROW] validate_manifests: The last segment does not reach the end of the video");
+    }
+    return ordered;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file Segments.hpp
+ * @brief Splitting of a video into keyframe-aligned segments processed independently, and lossless concatenation of the results.
+ *
+ * Every segment starts at a keyframe, so it can be decoded without the frames before it and a
+ * separate reader, backend and encoder can process each one. The encoded segments share the
+ * encoder settings, so their packets are remuxed one after the other without re-encoding.
+ */
+#pragma once
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @struct KeyframeIndex
+ * @brief The keyframes of the video stream of a file, found from the packets without decoding.
+ */
+struct KeyframeIndex {
+    AVRational time_base = AVRational{1, 1};   ///< Time base of the timestamps
+    std::vector<int64_t> keyframes;             ///< Timestamps of the keyframes, ascending
+    std::vector<int64_t> gop_frames;            ///< Number of packets from every keyframe to the next one
+};
+
+/**
+ * @struct Segment
+ * @brief A run of whole GOPs, the frames whose timestamps are in [start_pts, end_pts).
+ */
+struct Segment {
+    int index = 0;                  ///< Position of the segment in the video
+    int64_t start_pts = 0;          ///< Timestamp of the keyframe starting the segment, INT64_MIN for the first one
+    int64_t end_pts = 0;            ///< Timestamp of the keyframe starting the next segment, INT64_MAX for the last one
+    int64_t expected_frames = 0;    ///< Number of packets in the segment, an estimate of its frames
+};
+
+/**
+ * @struct SegmentFile
+ * @brief An encoded segment ready to be concatenated.
+ */
+struct SegmentFile {
+    std::string path;       ///< File holding the encoded segment
+    int64_t frames = 0;     ///< Number of frames encoded in it
+};
+
+/**
+ * @struct SegmentManifest
+ * @brief The segments encoded by one shard, written next to them so that a merge can find and check them.
+ *
+ * Shards only coordinate through these files: every shard derives the same segment plan from the
+ * input, encodes its share and writes its manifest, and the merge stitches the segments once all
+ * the manifests are there.
+ */
+struct SegmentManifest {
+    std::string input;                      ///< The input video the segments come from
+    int fps = 0;                            ///< Frame rate the segments were encoded with
+    AVRational time_base = AVRational{1, 1};    ///< Time base of the segment timestamps
+    int segment_count = 0;                  ///< Number of segments of the whole plan
+    int shard = 0;                          ///< Index of the shard that wrote the manifest
+    int shard_count = 1;                    ///< Number of shards sharing the plan
+    std::vector<Segment> segments;          ///< The segments of the shard, in order
+    std::vector<SegmentFile> files;         ///< The encoded file of every segment
+};
+
+/**
+ * @brief Reads the packets of the video stream of a file and records where its keyframes are.
+ * @param filename The video file.
+ * @return The keyframe index.
+ * @throws std::runtime_error if the file cannot be read or has no video stream.
+ */
+KeyframeIndex scan_keyframes(const std::string& filename);
+
+/**
+ * @brief Groups the GOPs into segments with about the same number of frames.
+ * The plan only depends on the index and the count, so separate processes computing it agree on it.
+ * @param index The keyframe index of the video.
+ * @param segment_count The number of segments wanted, fewer are returned when the video has fewer GOPs.
+ * @return The segments, in order, covering the whole video.
+ */
+std::vector<Segment> plan_segments(const KeyframeIndex& index, int segment_count);
+
+/**
+ * @brief Gets the path of the file holding a segment, next to the output: out.mp4 gives out.segment003.mp4.
+ * The extension is kept, so the segment is encoded with the codec of the output.
+ */
+std::string segment_path(const std::string& output, int index);
+
+/**
+ * @brief Processes the segments on a number of worker threads, each segment on one worker.
+ * @param segments The segments to process.
+ * @param worker_count The number of segments processed at the same time.
+ * @param process_segment Processes a segment and returns the number of frames it encoded.
+ * @return The number of frames encoded for every segment, in the order of the segments.
+ * @throws The first exception thrown by process_segment, once all the workers are done.
+ */
+std::vector<int64_t> run_segments(const std::vector<Segment>& segments, int worker_count,
+    const std::function<int64_t(const Segment&)>& process_segment);
+
+/**
+ * @brief Concatenates encoded segments into a single file, copying their packets without re-encoding.
+ * The timestamps of every segment are shifted by the frames of the segments before it.
+ * @param segments The segments, in order, encoded with the same settings.
+ * @param output The output file, its extension selects the container like for VideoWriterFFMPEG.
+ * @param fps The frame rate the segments were encoded with.
+ * @throws std::runtime_error if a segment cannot be read or the output cannot be written.
+ */
+void concat_segments(const std::vector<SegmentFile>& segments, const std::string& output, int fps);
+
+/**
+ * @brief Gets the path of the manifest of a shard, next to the output: out.mp4 gives out.shard1of4.manifest.
+ */
+std::string manifest_path(const std::string& output, int shard, int shard_count);
+
+/**
+ * @brief Writes a manifest, through a temporary file renamed at the end so that a reader never sees a partial one.
+ * @param path The manifest file.
+ * @param manifest The manifest.
+ * @throws std::runtime_error if the file cannot be written.
+ */
+void write_manifest(const std::string& path, const SegmentManifest& manifest);
+
+/**
+ * @brief Reads a manifest written by write_manifest().
+ * @param path The manifest file.
+ * @return The manifest.
+ * @throws std::runtime_error if the file cannot be read or is malformed.
+ */
+SegmentManifest read_manifest(const std::string& path);
+
+/**
+ * @brief Checks that the manifests of all the shards describe one complete plan and puts their segments in order.
+ * The manifests must agree on the input, frame rate, time base and plan, every segment must appear exactly once,
+ * and the timestamp range of every segment must start where the previous one ends.
+ * @param manifests The manifests, in any order.
+ * @return The encoded segments in the order of the video.
+ * @throws std::runtime_error describing the first inconsistency found.
+ */
+std::vector<SegmentFile> validate_manifests(const std::vector<SegmentManifest>& manifests);
@@ -0,0 +1,77 @@
+/**
+ * @file SpscQueue.hpp
+ * @brief Bounded lock-free single-producer single-consumer queue.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @class SpscQueue
+ * @brief A bounded ring buffer safe for exactly one producer thread and one consumer thread.
+ *
+ * The producer only writes the tail index and the consumer only writes the head index,
+ * so no locks are needed. Both operations are non-blocking and report whether they succeeded.
+ * @tparam T The type of the stored elements, usually a pointer.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    /**
+     * @brief Constructs a queue able to hold up to capacity elements.
+     * @param capacity The maximum number of elements in the queue.
+     */
+    explicit SpscQueue(size_t capacity)
+        : slots_(capacity + 1), head_(0), tail_(0) {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    /**
+     * @brief Pushes an element, called only by the producer thread.
+     * @param value The element to push.
+     * @return True if the element was pushed, false if the queue is full.
+     */
+    bool try_push(const T& value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t next = increment(tail);
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots_[tail] = value;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pops an element, called only by the consumer thread.
+     * @param value Output parameter receiving the popped element.
+     * @return True if an element was popped, false if the queue is empty.
+     */
+    bool try_pop(T& value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = slots_[head];
+        head_.store(increment(head), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Gets the maximum number of elements in the queue.
+     */
+    size_t capacity() const { return slots_.size() - 1; }
+
+private:
+    size_t increment(size_t index) const {
+        return (index + 1 == slots_.size()) ? 0 : index + 1;
+    }
+
+    std::vector<T> slots_;                      ///< Ring storage, one slot is always kept empty
+    alignas(64) std::atomic<size_t> head_;      ///< Next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail_;      ///< Next slot to push, written by the producer
+};
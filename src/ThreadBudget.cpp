@@ -0,0 +1,45 @@
+/**
+ * @file ThreadBudget.cpp
+ * @brief Implementation of the thread budget.
+ */
+#include "ThreadBudget.hpp"
+
+#include <algorithm>
+#include <thread>
+
+ThreadBudget plan_thread_budget(size_t core_count, int decode_threads, size_t compute_threads, int encode_threads, bool cpu_backend) {
+    if (core_count == 0) {
+        core_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // the cores not taken by the explicit counts, and the stages sharing them
+    int free_cores = static_cast<int>(core_count);
+    int open_stages = 0;
+    if (decode_threads > 0) {
+        free_cores -= decode_threads;
+    } else {
+        open_stages++;
+    }
+    if (!cpu_backend) {
+        free_cores -= 1;
+    } else if (compute_threads > 0) {
+        free_cores -= static_cast<int>(compute_threads);
+    } else {
+        open_stages++;
+    }
+    if (encode_threads > 0) {
+        free_cores -= encode_threads;
+    } else {
+        open_stages++;
+    }
+    const int share = open_stages > 0 ? std::max(1, free_cores / open_stages) : 1;
+
+    ThreadBudget budget;
+    budget.decode_threads = decode_threads > 0 ? decode_threads : std::min(share, MAX_DECODE_THREADS);
+    budget.compute_threads = !cpu_backend ? 1 : compute_threads > 0 ? compute_threads : static_cast<size_t>(share);
+    budget.encode_threads = encode_threads > 0 ? encode_threads : share;
+    // the remainder of the even split goes to the encoder, usually the slowest stage
+    if (encode_threads <= 0 && open_stages > 0 && free_cores > share * open_stages) {
+        budget.encode_threads += free_cores - share * open_stages;
+    }
+    return budget;
+}
@@ -0,0 +1,33 @@
+/**
+ * @file ThreadBudget.hpp
+ * @brief Sharing of the cores between the decoder, the processing backend and the encoder.
+ */
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @struct ThreadBudget
+ * @brief The number of threads given to every stage, so that together they do not oversubscribe the cores.
+ */
+struct ThreadBudget {
+    int decode_threads = 1;     ///< Threads of the decoder, frame and slice threading
+    size_t compute_threads = 1; ///< Threads of the CPU backend, the OpenCL backend only needs the host thread driving the device
+    int encode_threads = 1;     ///< Threads of the encoder
+};
+
+/// Largest number of decoder threads, libavcodec frame threading does not scale past it.
+constexpr int MAX_DECODE_THREADS = 16;
+
+/**
+ * @brief Shares the cores between decoding, processing and encoding, honouring the counts given explicitly.
+ * The cores left by the explicit counts are split evenly between the other stages. The OpenCL backend
+ * only takes the core driving the device, so decoding and encoding share the rest.
+ * @param core_count The number of cores to share, 0 uses the number of cores of the machine.
+ * @param decode_threads The requested decoder threads, 0 to derive them from the budget.
+ * @param compute_threads The requested threads of the CPU backend, 0 to derive them from the budget.
+ * @param encode_threads The requested encoder threads, 0 to derive them from the budget.
+ * @param cpu_backend Whether the frames are processed by the CPU backend.
+ * @return The threads of every stage.
+ */
+ThreadBudget plan_thread_budget(size_t core_count, int decode_threads, size_t compute_threads, int encode_threads, bool cpu_backend);
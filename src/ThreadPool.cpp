@@ -0,0 +1,83 @@
+/**
+ * @file ThreadPool.cpp
+ * @brief Implementation of the ThreadPool class.
+ */
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t thread_count)
+    : function_(nullptr), count_(0), generation_(0), pending_(0), stop_(false) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 1; i < thread_count; i++) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, const RangeFunction& function) {
+    if (count == 0) {
+        return;
+    }
+    if (workers_.empty() || count == 1) {
+        function(0, count);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        function_ = &function;
+        count_ = count;
+        pending_ = workers_.size();
+        generation_++;
+    }
+    start_cv_.notify_all();
+
+    run_chunk(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return pending_ == 0; });
+    function_ = nullptr;
+}
+
+void ThreadPool::run_chunk(size_t thread_index) {
+    const size_t threads = thread_count();
+    const size_t begin = count_ * thread_index / threads;
+    const size_t end = count_ * (thread_index + 1) / threads;
+    if (begin < end) {
+        (*function_)(begin, end);
+    }
+}
+
+void ThreadPool::worker_loop(size_t worker_index) {
+    size_t seen_generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_cv_.wait(lock, [&]() { return stop_ || generation_ != seen_generation; });
+            if (stop_) {
+                return;
+            }
+            seen_generation = generation_;
+        }
+
+        run_chunk(worker_index);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_--;
+        }
+        done_cv_.notify_one();
+    }
+}
@@ -0,0 +1,73 @@
+/**
+ * @file ThreadPool.hpp
+ * @brief Persistent worker threads for data-parallel loops.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class ThreadPool
+ * @brief A fixed set of worker threads that split a range of indices between them.
+ *
+ * The workers are created once and sleep between loops, so a per-frame parallel loop
+ * does not pay for thread creation. The calling thread takes part in the work.
+ */
+class ThreadPool {
+public:
+    /// Processes the indices in [begin, end).
+    using RangeFunction = std::function<void(size_t begin, size_t end)>;
+
+    /**
+     * @brief Constructs the pool.
+     * @param thread_count The total number of threads working on a loop, including the caller. 0 uses the number of cores.
+     */
+    explicit ThreadPool(size_t thread_count = 0);
+
+    /**
+     * @brief Destructor that stops and joins the workers.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * @brief Splits [0, count) in contiguous chunks and processes them on all threads, returning when all are done.
+     * @param count The number of indices.
+     * @param function The function processing a chunk of indices.
+     */
+    void parallel_for(size_t count, const RangeFunction& function);
+
+    /**
+     * @brief Gets the total number of threads working on a loop, including the caller.
+     */
+    size_t thread_count() const { return workers_.size() + 1; }
+
+private:
+    /**
+     * @brief Body of a worker thread.
+     * @param worker_index The index of the worker, the caller has index 0 and workers start from 1.
+     */
+    void worker_loop(size_t worker_index);
+
+    /**
+     * @brief Processes the chunk of the current loop assigned to a thread.
+     */
+    void run_chunk(size_t thread_index);
+
+    std::vector<std::thread> workers_;      ///< Worker threads
+    std::mutex mutex_;                      ///< Protects the loop state below
+    std::condition_variable start_cv_;      ///< Wakes the workers when a loop starts
+    std::condition_variable done_cv_;       ///< Wakes the caller when the workers are done
+    const RangeFunction* function_;         ///< Function of the current loop
+    size_t count_;                          ///< Number of indices of the current loop
+    size_t generation_;                     ///< Incremented for every loop
+    size_t pending_;                        ///< Workers still running the current loop
+    bool stop_;                             ///< Set when the pool is destroyed
+};
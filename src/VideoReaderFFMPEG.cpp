@@ -4,14 +4,17 @@
  */
 
 #include "VideoReaderFFMPEG.hpp"
+#include "Log.hpp"
 #include <stdexcept>
-#include <iostream>
+#include <limits>
 
-VideoReaderFFMPEG::VideoReaderFFMPEG(const std::string& filename)
+VideoReaderFFMPEG::VideoReaderFFMPEG(const std::string& filename, int thread_count)
     : filename_(filename), format_ctx_(nullptr), codec_ctx_(nullptr),
     codecpar_(nullptr), codec_(nullptr), frame_(nullptr),
-    rgba_frame_(nullptr), packet_(nullptr), sws_ctx_(nullptr),
-    video_stream_index_(-1), width_(0), height_(0), frame_count_(0) {
+    packet_(nullptr), sws_ctx_(nullptr),
+    video_stream_index_(-1), width_(0), height_(0), frame_count_(0),
+    range_start_(std::numeric_limits<int64_t>::min()), range_end_(std::numeric_limits<int64_t>::max()), stats_(nullptr),
+    progress_("Reading frame") {
 
     if (avformat_open_input(&format_ctx_, filename.c_str(), nullptr, nullptr) < 0) {
         throw std::runtime_error("Failed to open video file: " + filename);
@@ -43,7 +46,14 @@ VideoReaderFFMPEG::VideoReaderFFMPEG(const std::string& filename)
 
     codec_ctx_ = avcodec_alloc_context3(codec_);
     avcodec_parameters_to_context(codec_ctx_, codecpar_);
-    avcodec_open2(codec_ctx_, codec_, nullptr);
+    // frame threading decodes several frames at once, slice threading splits a frame, the codec uses what it supports
+    codec_ctx_->thread_count = thread_count;
+    codec_ctx_->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    if (avcodec_open2(codec_ctx_, codec_, nullptr) < 0) {
+        avcodec_free_context(&codec_ctx_);
+        avformat_close_input(&format_ctx_);
+        throw std::runtime_error("Failed to open the decoder");
+    }
 
     width_ = codec_ctx_->width;
     height_ = codec_ctx_->height;
@@ -51,47 +61,32 @@ VideoReaderFFMPEG::VideoReaderFFMPEG(const std::string& filename)
     current_frame_ = 0;
 
     frame_ = av_frame_alloc();
-    rgba_frame_ = av_frame_alloc();
     packet_ = av_packet_alloc();
 
     // read fps and duration
     fps_ = av_q2d(format_ctx_->streams[video_stream_index_]->avg_frame_rate);
     duration_ = format_ctx_->duration;
-    std::cout << "[LOG] Video opened: " << filename_ << "\n";
-    std::cout << "[LOG] Video stream index: " << video_stream_index_ << "\n";
-    std::cout << "[LOG] Video width: " << width_ << "\n";
-    std::cout << "[LOG] Video height: " << height_ << "\n";
-    std::cout << "[LOG] Video frame count: " << frame_count_ << "\n";
-    std::cout << "[LOG] Video fps: " << fps_ << "\n";
+    LOG_INFO("Video opened: " << filename_);
+    LOG_INFO("Video stream index: " << video_stream_index_);
+    LOG_INFO("Video width: " << width_);
+    LOG_INFO("Video height: " << height_);
+    LOG_INFO("Video frame count: " << frame_count_);
+    LOG_INFO("Video fps: " << fps_);
+    LOG_INFO("Decoder threads: " << codec_ctx_->thread_count);
     double duration_in_seconds = static_cast<double>(duration_) / AV_TIME_BASE;
-    std::cout << "[LOG] Video duration: " << duration_in_seconds << " seconds\n";
-    // additional logging for debugging
-    AVColorSpace color_space = codecpar_->color_space;
-    AVColorPrimaries color_primaries = codecpar_->color_primaries;
-    AVColorTransferCharacteristic color_trc = codecpar_->color_trc;
-    AVColorRange color_range = codecpar_->color_range;
-    std::cout << "[DEBUG] Color Space: " << av_color_space_name(color_space) << "\n";
-    std::cout << "[DEBUG] Color Primaries: " << av_color_primaries_name(color_primaries) << "\n";
-    std::cout << "[DEBUG] Transfer Characteristics: " << av_color_transfer_name(color_trc) << "\n";
-    std::cout << "[DEBUG] Color Range: " << av_color_range_name(color_range) << "\n";
-    // get pixel format
-    int pixel_format = codecpar_->format;
-    auto pixel_format_name = av_get_pix_fmt_name(static_cast<AVPixelFormat>(pixel_format));
-    // print pixel format
-    std::cout << "[DEBUG] Pixel Format: " << pixel_format_name << "\n";
+    LOG_INFO("Video duration: " << duration_in_seconds << " seconds");
+    // additional logging for debugging, compiled out of release builds
+    LOG_DEBUG("Color Space: " << logging::or_unknown(av_color_space_name(codecpar_->color_space)));
+    LOG_DEBUG("Color Primaries: " << logging::or_unknown(av_color_primaries_name(codecpar_->color_primaries)));
+    LOG_DEBUG("Transfer Characteristics: " << logging::or_unknown(av_color_transfer_name(codecpar_->color_trc)));
+    LOG_DEBUG("Color Range: " << logging::or_unknown(av_color_range_name(codecpar_->color_range)));
+    LOG_DEBUG("Pixel Format: " << logging::or_unknown(av_get_pix_fmt_name(static_cast<AVPixelFormat>(codecpar_->format))));
 
     // Compute the expected frame count
     expected_frame_count_ = static_cast<int64_t>(fps_) * duration_in_seconds;
-    std::cout << "[LOG] Expected frame count: " << expected_frame_count_ << "\n";
-
-    int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_RGB32, width_, height_, 1); // RGBA format, will be stored as BGRA on little-endian systems, and as ARGB on big-endian systems
-    // int num_bytes = av_image_get_buffer_size(AV_PIX_FMT_YUV444P, width_, height_, 1); // YUV444P format
-    // int num_bytes = av_image_get_buffer_size(av_get_pix_fmt(pixel_format_name), width_, height_, 1); // original format
-    buffer_.resize(num_bytes);
-    av_image_fill_arrays(rgba_frame_->data, rgba_frame_->linesize, buffer_.data(), AV_PIX_FMT_RGB32, width_, height_, 1);
-    // av_image_fill_arrays(rgba_frame_->data, rgba_frame_->linesize, buffer_.data(), AV_PIX_FMT_YUV444P, width_, height_, 1);
-    // av_image_fill_arrays(rgba_frame_->data, rgba_frame_->linesize, buffer_.data(), av_get_pix_fmt(pixel_format_name), width_, height_, 1);
+    LOG_INFO("Expected frame count: " << expected_frame_count_);
 
+    // the frames are converted by sws_scale straight into the memory provided by the caller, RGB32 is stored as BGRA on little-endian systems, and as ARGB on big-endian systems
     sws_ctx_ = sws_getContext(
         width_, height_, codec_ctx_->pix_fmt,
         width_, height_, 
@@ -105,34 +100,116 @@ VideoReaderFFMPEG::VideoReaderFFMPEG(const std::string& filename)
 VideoReaderFFMPEG::~VideoReaderFFMPEG() {
     av_packet_free(&packet_);
     av_frame_free(&frame_);
-    av_frame_free(&rgba_frame_);
     sws_freeContext(sws_ctx_);
     avcodec_free_context(&codec_ctx_);
     avformat_close_input(&format_ctx_);
 }
 
 bool VideoReaderFFMPEG::read_next_frame(std::vector<uint8_t>& output_buffer) {
-    while (av_read_frame(format_ctx_, packet_) >= 0) {
-        if (packet_->stream_index == video_stream_index_) {
-            if (avcodec_send_packet(codec_ctx_, packet_) == 0) {
-                while (avcodec_receive_frame(codec_ctx_, frame_) == 0) {
-                    sws_scale(
-                        sws_ctx_,
-                        frame_->data, frame_->linesize,
-                        0, height_,
-                        rgba_frame_->data, rgba_frame_->linesize
-                    );
-                    output_buffer.assign(buffer_.begin(), buffer_.end());
-                    av_packet_unref(packet_);
-                    current_frame_++;
-                    std::cout << "[LOG] Reading frame " << current_frame_ << " of " << frame_count_ << "\n";
-                    return true;
-                }
+    output_buffer.resize(static_cast<size_t>(width_) * height_ * 4);
+    return read_next_frame(output_buffer.data());
+}
+
+bool VideoReaderFFMPEG::read_next_frame(uint8_t* destination, int destination_linesize) {
+    {
+        StageTimer timer(stats_, "decode");
+        if (!decode_next_frame()) {
+            timer.discard();
+            return false;
+        }
+    }
+    StageTimer timer(stats_, "convert_rgb");
+    uint8_t* destination_data[4] = { destination, nullptr, nullptr, nullptr };
+    int destination_linesizes[4] = { destination_linesize > 0 ? destination_linesize : 4 * width_, 0, 0, 0 };
+    sws_scale(
+        sws_ctx_,
+        frame_->data, frame_->linesize,
+        0, height_,
+        destination_data, destination_linesizes
+    );
+    return true;
+}
+
+bool VideoReaderFFMPEG::read_next_frame_planar(PlanarFrame& planes) {
+    StageTimer timer(stats_, "decode");
+    if (!decode_next_frame()) {
+        timer.discard();
+        return false;
+    }
+    for (int plane = 0; plane < 3; plane++) {
+        planes.data[plane] = frame_->data[plane];
+        planes.linesize[plane] = frame_->linesize[plane];
+    }
+    return true;
+}
+
+bool VideoReaderFFMPEG::decode_next_frame() {
+    // a threaded decoder returns the frames a few packets late, so a frame is asked for before sending a new packet
+    while (true) {
+        const int ret = avcodec_receive_frame(codec_ctx_, frame_);
+        if (ret == 0) {
+            const int64_t timestamp = frame_->best_effort_timestamp;
+            if (timestamp != AV_NOPTS_VALUE && timestamp < range_start_) {
+                // shown before the range, e.g. the leading frames of an open GOP
+                continue;
+            }
+            if (timestamp != AV_NOPTS_VALUE && timestamp >= range_end_) {
+                return false;
             }
+            current_frame_++;
+            progress_.update(current_frame_, frame_count_);
+            return true;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            // AVERROR_EOF once the buffered frames are drained
+            return false;
+        }
+        if (av_read_frame(format_ctx_, packet_) < 0) {
+            // end of the file, the null packet makes the decoder output the frames it still holds
+            avcodec_send_packet(codec_ctx_, nullptr);
+            continue;
+        }
+        if (packet_->stream_index == video_stream_index_) {
+            avcodec_send_packet(codec_ctx_, packet_);
         }
         av_packet_unref(packet_);
     }
-    return false;
+}
+
+bool VideoReaderFFMPEG::has_yuv420_frames() const {
+    return codec_ctx_->pix_fmt == AV_PIX_FMT_YUV420P || codec_ctx_->pix_fmt == AV_PIX_FMT_YUVJ420P;
+}
+
+bool VideoReaderFFMPEG::is_full_range() const {
+    return codec_ctx_->pix_fmt == AV_PIX_FMT_YUVJ420P || codec_ctx_->color_range == AVCOL_RANGE_JPEG;
+}
+
+AVPixelFormat VideoReaderFFMPEG::get_pixel_format() const {
+    return codec_ctx_->pix_fmt;
+}
+
+void VideoReaderFFMPEG::seek_range(int64_t start_pts, int64_t end_pts) {
+    range_start_ = start_pts;
+    range_end_ = end_pts;
+    if (start_pts == std::numeric_limits<int64_t>::min()) {
+        return;
+    }
+    if (av_seek_frame(format_ctx_, video_stream_index_, start_pts, AVSEEK_FLAG_BACKWARD) < 0) {
+        throw std::runtime_error("Failed to seek to timestamp " + std::to_string(start_pts));
+    }
+    avcodec_flush_buffers(codec_ctx_);
+}
+
+AVRational VideoReaderFFMPEG::get_time_base() const {
+    return format_ctx_->streams[video_stream_index_]->time_base;
+}
+
+int VideoReaderFFMPEG::get_thread_count() const {
+    return codec_ctx_->thread_count;
+}
+
+void VideoReaderFFMPEG::set_stats(FrameStats* stats) {
+    stats_ = stats;
 }
 
 int VideoReaderFFMPEG::get_width() const {
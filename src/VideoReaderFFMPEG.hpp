@@ -12,6 +12,10 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "FrameStats.hpp"
+#include "Log.hpp"
+#include "PlanarFrame.hpp"
+
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -25,8 +29,9 @@ public:
     /**
      * @brief Constructs the VideoReaderFFMPEG object and opens the video file.
      * @param filename The path to the input video file.
+     * @param thread_count The number of decoder threads, with frame and slice threading, 0 lets libavcodec pick it from the cores.
      */
-    explicit VideoReaderFFMPEG(const std::string& filename);
+    explicit VideoReaderFFMPEG(const std::string& filename, int thread_count = 0);
 
     /**
      * @brief Destructor that releases FFmpeg resources.
@@ -40,6 +45,63 @@ public:
      */
     bool read_next_frame(std::vector<uint8_t>& output_buffer);
 
+    /**
+     * @brief Reads the next frame, converting it straight into caller-provided memory without intermediate copies.
+     * The destination can be a pooled frame, or a mapped device buffer so that the decoded pixels reach the device with at most one copy.
+     * @param destination Memory receiving the BGRA frame, at least destination_linesize * height bytes.
+     * @param destination_linesize The size in bytes of a row of the destination, 0 for tightly packed rows (4 * width).
+     * @return True if a frame was successfully read, false if end of stream.
+     */
+    bool read_next_frame(uint8_t* destination, int destination_linesize = 0);
+
+    /**
+     * @brief Reads the next frame in the native planar format of the decoder, without any conversion or copy.
+     * Only meaningful when has_yuv420_frames() is true.
+     * @param planes Output parameter receiving the view over the decoded planes, valid until the next read.
+     * @return True if a frame was successfully read, false if end of stream.
+     */
+    bool read_next_frame_planar(PlanarFrame& planes);
+
+    /**
+     * @brief Tells whether the decoder outputs planar YUV 4:2:0 frames, that read_next_frame_planar() can expose directly.
+     */
+    bool has_yuv420_frames() const;
+
+    /**
+     * @brief Tells whether the decoded YUV samples use the full (0-255) range instead of the limited (16-235) one.
+     */
+    bool is_full_range() const;
+
+    /**
+     * @brief Gets the pixel format of the decoded frames.
+     */
+    AVPixelFormat get_pixel_format() const;
+
+    /**
+     * @brief Restricts the reads to the frames whose timestamp is in [start_pts, end_pts), seeking to the keyframe at start_pts.
+     * Frames decoded from the keyframe but shown before start_pts are dropped, the reads end at the first frame shown at or after end_pts.
+     * @param start_pts The first timestamp, in the time base of the video stream, INT64_MIN to start from the beginning.
+     * @param end_pts One past the last timestamp, INT64_MAX to read until the end.
+     * @throws std::runtime_error if the seek fails.
+     */
+    void seek_range(int64_t start_pts, int64_t end_pts);
+
+    /**
+     * @brief Gets the time base of the timestamps of the video stream.
+     */
+    AVRational get_time_base() const;
+
+    /**
+     * @brief Gets the number of threads used by the decoder.
+     */
+    int get_thread_count() const;
+
+    /**
+     * @brief Records the decoding and conversion time of every frame into a collector.
+     * @param stats The collector, null to stop recording.
+     */
+    void set_stats(FrameStats* stats);
+
     /**
      * @brief Gets the width of the video frames.
      * @return The width of the video.
@@ -89,13 +151,18 @@ public:
     SwsContext* get_sws_context() const;
 
 private:
+    /**
+     * @brief Decodes the next video frame into frame_, draining the frames buffered by the decoder at the end of the file.
+     * @return True if a frame was decoded, false if end of stream.
+     */
+    bool decode_next_frame();
+
     std::string filename_;               ///< Path to the video file
     AVFormatContext* format_ctx_;       ///< Format context
     AVCodecContext* codec_ctx_;         ///< Codec context
     AVCodecParameters* codecpar_;       ///< Codec parameters
     const AVCodec* codec_;              ///< Codec
     AVFrame* frame_;                    ///< Original frame
-    AVFrame* rgba_frame_;               ///< Converted RGBA frame
     AVPacket* packet_;                  ///< Packet
     SwsContext* sws_ctx_;               ///< Software scaler context
 
@@ -107,7 +174,9 @@ private:
     int64_t current_frame_;             ///< Current frame index
     int fps_;                          ///< Frame per second
     int64_t duration_;                  ///< Duration of the video in microseconds
-
-    std::vector<uint8_t> buffer_;       ///< Buffer for RGBA frame data
+    int64_t range_start_;               ///< First timestamp returned by the reads
+    int64_t range_end_;                 ///< One past the last timestamp returned by the reads
+    FrameStats* stats_;                 ///< Collector of the stage timings, null when not recording
+    logging::Progress progress_;        ///< Rate-limited report of the frames read
 };
  
\ No newline at end of file
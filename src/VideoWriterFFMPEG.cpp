@@ -3,13 +3,13 @@
  * @brief Implementation of the VideoWriterFFMPEG class using FFmpeg.
  */
 #include "VideoWriterFFMPEG.hpp"
+#include "Log.hpp"
 #include <stdexcept>
-#include <iostream>
 
-VideoWriterFFMPEG::VideoWriterFFMPEG(const std::string& filename, int width, int height, int fps)
+VideoWriterFFMPEG::VideoWriterFFMPEG(const std::string& filename, int width, int height, int fps, const EncoderOptions& options)
     : filename_(filename), width_(width), height_(height), fps_(fps), frame_index_(0), last_dts(0),
     format_ctx_(nullptr), video_stream_(nullptr), codec_ctx_(nullptr), codec_(nullptr),
-    frame_(nullptr), pkt_(nullptr), sws_ctx_(nullptr) {
+    frame_(nullptr), pkt_(nullptr), sws_ctx_(nullptr), stats_(nullptr) {
 
 
     // choose the codec based on the output file name, if it is webm, use VP9. Otherwise, use H.264
@@ -57,10 +57,10 @@ VideoWriterFFMPEG::VideoWriterFFMPEG(const std::string& filename, int width, int
     codec_ctx_->height = height_;
     codec_ctx_->time_base = AVRational{1, fps_};
     codec_ctx_->framerate = AVRational{fps_, 1};
-    codec_ctx_->gop_size = 12;
+    codec_ctx_->gop_size = options.gop_size;
     // codec_ctx_->pix_fmt = AV_PIX_FMT_RGB32; // not supported by H264
     // codec_ctx_->pix_fmt = AV_PIX_FMT_YUV420P;
-    codec_ctx_->pix_fmt = AV_PIX_FMT_YUV444P; // use YUV444P 
+    codec_ctx_->pix_fmt = options.pix_fmt; // YUV444P by default, YUV420P when the frames are converted on the device
     // codec_ctx_->max_b_frames = 2; // seems to create problems probably, setting to 0 to simplify DTS and PTS management
     codec_ctx_->max_b_frames = 0;
 
@@ -68,9 +68,41 @@ VideoWriterFFMPEG::VideoWriterFFMPEG(const std::string& filename, int width, int
         codec_ctx_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
-    if (avcodec_open2(codec_ctx_, codec_, nullptr) < 0) {
+    // 0 lets the encoder pick the threads from the cores
+    codec_ctx_->thread_count = options.threads;
+    const bool vp9 = codec_ctx_->codec_id == AV_CODEC_ID_VP9;
+    AVDictionary* codec_options = nullptr;
+    if (!options.preset.empty()) {
+        // libvpx has no presets, its closest knob is the deadline
+        av_dict_set(&codec_options, vp9 ? "deadline" : "preset", options.preset.c_str(), 0);
+    }
+    if (vp9 && options.speed >= 0) {
+        av_dict_set_int(&codec_options, "cpu-used", options.speed, 0);
+    }
+    if (vp9) {
+        av_dict_set_int(&codec_options, "row-mt", options.row_mt ? 1 : 0, 0);
+    }
+    if (options.crf >= 0) {
+        av_dict_set_int(&codec_options, "crf", options.crf, 0);
+    }
+    // without a bitrate libvpx would fall back to its 200 kb/s default, a zero bitrate makes the CRF a constant quality target
+    codec_ctx_->bit_rate = options.bit_rate;
+    for (const auto& option : options.extra) {
+        av_dict_set(&codec_options, option.first.c_str(), option.second.c_str(), 0);
+    }
+
+    const int open_result = avcodec_open2(codec_ctx_, codec_, &codec_options);
+    // the options left in the dictionary were not recognized by the encoder
+    AVDictionaryEntry* unused = nullptr;
+    while ((unused = av_dict_get(codec_options, "", unused, AV_DICT_IGNORE_SUFFIX))) {
+        LOG_WARNING("Encoder option not recognized by " << codec_->name << ": " << unused->key);
+    }
+    av_dict_free(&codec_options);
+    if (open_result < 0) {
         throw std::runtime_error("[THROW] VideoWriterFFMPEG::VideoWriterFFMPEG: Could not open codec");
     }
+    LOG_INFO("Encoder: " << codec_->name << ", " << logging::or_unknown(av_get_pix_fmt_name(codec_ctx_->pix_fmt))
+        << ", GOP " << codec_ctx_->gop_size << ", threads " << codec_ctx_->thread_count);
 
     if (avcodec_parameters_from_context(video_stream_->codecpar, codec_ctx_) < 0) {
         throw std::runtime_error("[THROW] VideoWriterFFMPEG::VideoWriterFFMPEG: Could not copy codec parameters");
@@ -162,20 +194,38 @@ VideoWriterFFMPEG::~VideoWriterFFMPEG() {
 }
 
 void VideoWriterFFMPEG::write_frame(const uint8_t* rgba_data) {
-    if (av_frame_make_writable(frame_) < 0) {
-        throw std::runtime_error("[THROW] VideoWriterFFMPEG::write_frame: Frame not writable");
-    }
+    PlanarFrame planes = acquire_frame();
 
     const uint8_t* in_data[1] = { rgba_data };
     int in_linesize[1] = { 4 * width_ };
 
-    sws_scale(sws_ctx_, in_data, in_linesize, 0, height_, frame_->data, frame_->linesize);
+    {
+        StageTimer timer(stats_, "convert_yuv");
+        sws_scale(sws_ctx_, in_data, in_linesize, 0, height_, planes.data, planes.linesize);
+    }
 
+    submit_frame();
+}
+
+PlanarFrame VideoWriterFFMPEG::acquire_frame() {
+    if (av_frame_make_writable(frame_) < 0) {
+        throw std::runtime_error("[THROW] VideoWriterFFMPEG::acquire_frame: Frame not writable");
+    }
+    PlanarFrame planes;
+    for (int plane = 0; plane < 3; plane++) {
+        planes.data[plane] = frame_->data[plane];
+        planes.linesize[plane] = frame_->linesize[plane];
+    }
+    return planes;
+}
+
+void VideoWriterFFMPEG::submit_frame() {
+    StageTimer timer(stats_, "encode");
     frame_->pts = av_rescale_q(frame_index_, AVRational{1, fps_}, codec_ctx_->time_base);
     frame_index_++;
 
     if (avcodec_send_frame(codec_ctx_, frame_) < 0) {
-        throw std::runtime_error("[THROW] VideoWriterFFMPEG::write_frame: Error sending frame to encoder");
+        throw std::runtime_error("[THROW] VideoWriterFFMPEG::submit_frame: Error sending frame to encoder");
     }
 
     while (avcodec_receive_packet(codec_ctx_, pkt_) == 0) {
@@ -190,8 +240,12 @@ void VideoWriterFFMPEG::write_frame(const uint8_t* rgba_data) {
         last_dts = pkt_->dts;
 
         if (av_interleaved_write_frame(format_ctx_, pkt_) < 0) {
-            throw std::runtime_error("[THROW] VideoWriterFFMPEG::write_frame: Error writing packet");
+            throw std::runtime_error("[THROW] VideoWriterFFMPEG::submit_frame: Error writing packet");
         }
         av_packet_unref(pkt_);
     }
 }
+
+void VideoWriterFFMPEG::set_stats(FrameStats* stats) {
+    stats_ = stats;
+}
@@ -11,10 +11,33 @@ extern "C" {
 #include <libavutil/imgutils.h>
 }
 
+#include "FrameStats.hpp"
+#include "PlanarFrame.hpp"
+
 #include <string>
+#include <utility>
 #include <vector>
 #include <cstdint>
 
+/**
+ * @struct EncoderOptions
+ * @brief Settings of the encoder, trading quality for encoding speed.
+ *
+ * The codec specific settings are passed to avcodec_open2() through an options dictionary,
+ * so the private options of libx264 and libvpx-vp9 can be reached without touching the codec context.
+ */
+struct EncoderOptions {
+    AVPixelFormat pix_fmt = AV_PIX_FMT_YUV444P; ///< Pixel format given to the encoder, 4:2:0 encodes much faster than 4:4:4
+    std::string preset;                         ///< libx264 preset (ultrafast ... veryslow) or libvpx deadline (realtime, good, best), empty for the default
+    int speed = -1;                             ///< libvpx cpu-used (0 slowest to 8 fastest), -1 for the default, ignored by H.264
+    int crf = -1;                               ///< Constant rate factor, -1 for the default
+    int64_t bit_rate = 0;                       ///< Target bitrate in bits per second, 0 for constant quality
+    int threads = 0;                            ///< Encoder threads, 0 lets the encoder pick them from the cores
+    bool row_mt = true;                         ///< Row-based multithreading of VP9, which lets its threads scale past the tile columns
+    int gop_size = 12;                          ///< Distance between keyframes
+    std::vector<std::pair<std::string, std::string>> extra; ///< Further key=value options passed to the encoder as they are
+};
+
 /**
  * @class VideoWriterFFMPEG
  * @brief A class for writing video frames to a file using FFmpeg.
@@ -27,8 +50,10 @@ public:
      * @param width The width of the video frames.
      * @param height The height of the video frames.
      * @param fps The frame rate of the output video.
+     * @param options The settings of the encoder, including the pixel format it is given.
      */
-    VideoWriterFFMPEG(const std::string& filename, int width, int height, int fps);
+    VideoWriterFFMPEG(const std::string& filename, int width, int height, int fps,
+        const EncoderOptions& options = EncoderOptions());
 
     /**
      * @brief Destructor that finalizes the video file and releases resources.
@@ -41,6 +66,24 @@ public:
      */
     void write_frame(const uint8_t* rgba_data);
 
+    /**
+     * @brief Gets the planes of the encoder frame, so that the next frame can be written straight into them.
+     * The frame is encoded by submit_frame().
+     * @return The view over the planes of the encoder frame, in the pixel format given to the constructor.
+     */
+    PlanarFrame acquire_frame();
+
+    /**
+     * @brief Encodes the frame written into the planes returned by acquire_frame().
+     */
+    void submit_frame();
+
+    /**
+     * @brief Records the conversion and encoding time of every frame into a collector.
+     * @param stats The collector, null to stop recording.
+     */
+    void set_stats(FrameStats* stats);
+
 private:
     std::string filename_;
     int width_;
@@ -56,5 +99,5 @@ private:
     AVFrame* frame_; // AVFrame is used to store decoded data
     AVPacket* pkt_; // AVPacket is used to store encoded data
     SwsContext* sws_ctx_;
-    
+    FrameStats* stats_; // collector of the stage timings, null when not recording
 };
@@ -0,0 +1,711 @@
+/**
+ * @file cpu_kernels.cpp
+ * @brief Implementation of the native CPU kernels and of their runtime dispatch.
+ */
+#include "cpu_kernels.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace cpu {
+
+QuantizeParams make_params(const QuantizationSettings& settings) {
+    QuantizeParams params;
+    params.mode = settings.mode;
+    params.step = 256 / settings.levels;
+    params.grayscale = settings.grayscale;
+    params.identity = false;
+    switch (settings.mode) {
+        case QUANTIZE_BINARY:
+            // (value >> 7) * 255
+            params.bias = 0;
+            params.multiplier = 65536 / 128;
+            params.scale = 255;
+            return params;
+        case QUANTIZE_LOWER_BOUND:
+            params.bias = 0;
+            break;
+        case QUANTIZE_UPPER_BOUND:
+            params.bias = static_cast<uint16_t>(params.step - 1);
+            break;
+        default:
+            params.bias = static_cast<uint16_t>(params.step / 2);
+            break;
+    }
+    // a step of 1 leaves every value unchanged, and its reciprocal does not fit in 16 bits
+    params.identity = params.step == 1;
+    params.multiplier = params.identity ? 0 : static_cast<uint16_t>((65536 + params.step - 1) / params.step);
+    params.scale = static_cast<uint16_t>(params.step);
+    return params;
+}
+
+namespace {
+    /**
+     * @brief Quantizes a single channel value, with the same arithmetic (and the same uchar truncation) as the OpenCL kernels.
+     */
+    inline uint8_t quantize_value(int value, const QuantizeParams& params) {
+        const int step = params.step;
+        switch (params.mode) {
+            case QUANTIZE_LOWER_BOUND:
+                return static_cast<uint8_t>((value / step) * step);
+            case QUANTIZE_UPPER_BOUND:
+                return static_cast<uint8_t>(((value + step - 1) / step) * step);
+            case QUANTIZE_BINARY:
+                return static_cast<uint8_t>((value >> 7) * 255);
+            default:
+                return static_cast<uint8_t>(((value + step / 2) / step) * step);
+        }
+    }
+}
+
+void quantize_pixels_scalar(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const QuantizeParams& params) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* in = bgra + 4 * i;
+        uint8_t* out = rgba + 4 * i;
+        int r = in[2];
+        int g = in[1];
+        int b = in[0];
+        if (params.grayscale) {
+            const int gray = (GRAY_WEIGHT_R * r + GRAY_WEIGHT_G * g + GRAY_WEIGHT_B * b) >> GRAY_SHIFT;
+            r = gray;
+            g = gray;
+            b = gray;
+        }
+        out[0] = quantize_value(r, params);
+        out[1] = quantize_value(g, params);
+        out[2] = quantize_value(b, params);
+        out[3] = in[3];
+    }
+}
+
+void apply_lut_scalar(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const uint8_t* lut, bool grayscale) {
+    const uint8_t* lut_r = lut;
+    const uint8_t* lut_g = lut + 256;
+    const uint8_t* lut_b = lut + 512;
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* in = bgra + 4 * i;
+        uint8_t* out = rgba + 4 * i;
+        int r = in[2];
+        int g = in[1];
+        int b = in[0];
+        if (grayscale) {
+            const int gray = (GRAY_WEIGHT_R * r + GRAY_WEIGHT_G * g + GRAY_WEIGHT_B * b) >> GRAY_SHIFT;
+            r = gray;
+            g = gray;
+            b = gray;
+        }
+        out[0] = lut_r[r];
+        out[1] = lut_g[g];
+        out[2] = lut_b[b];
+        out[3] = in[3];
+    }
+}
+
+namespace {
+    inline int clamp_channel(int value) {
+        return std::min(std::max(value, 0), 255);
+    }
+}
+
+void quantize_yuv420_rows(const PlanarFrame& input, const PlanarFrame& output, int width, int height,
+    int first_chroma_row, int last_chroma_row, const QuantizeParams& params, bool full_range) {
+    const int chroma_width = yuv420_chroma_width(width);
+    for (int cy = first_chroma_row; cy < last_chroma_row; cy++) {
+        for (int cx = 0; cx < chroma_width; cx++) {
+            const int d = input.data[1][cy * input.linesize[1] + cx] - 128;
+            const int e = input.data[2][cy * input.linesize[2] + cx] - 128;
+            int u_sum = 0;
+            int v_sum = 0;
+            int count = 0;
+            for (int y = 2 * cy; y < std::min(2 * cy + 2, height); y++) {
+                for (int x = 2 * cx; x < std::min(2 * cx + 2, width); x++) {
+                    const int luma = input.data[0][y * input.linesize[0] + x];
+                    int r, g, b;
+                    if (full_range) {
+                        r = luma + ((359 * e + 128) >> 8);
+                        g = luma - ((88 * d + 183 * e + 128) >> 8);
+                        b = luma + ((454 * d + 128) >> 8);
+                    } else {
+                        const int c = 298 * (luma - 16);
+                        r = (c + 409 * e + 128) >> 8;
+                        g = (c - 100 * d - 208 * e + 128) >> 8;
+                        b = (c + 516 * d + 128) >> 8;
+                    }
+                    r = clamp_channel(r);
+                    g = clamp_channel(g);
+                    b = clamp_channel(b);
+                    if (params.grayscale) {
+                        const int gray = (GRAY_WEIGHT_R * r + GRAY_WEIGHT_G * g + GRAY_WEIGHT_B * b) >> GRAY_SHIFT;
+                        r = gray;
+                        g = gray;
+                        b = gray;
+                    }
+                    r = quantize_value(r, params);
+                    g = quantize_value(g, params);
+                    b = quantize_value(b, params);
+                    output.data[0][y * output.linesize[0] + x] =
+                        static_cast<uint8_t>(clamp_channel(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16));
+                    u_sum += ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+                    v_sum += ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+                    count++;
+                }
+            }
+            output.data[1][cy * output.linesize[1] + cx] = static_cast<uint8_t>(clamp_channel((u_sum + count / 2) / count));
+            output.data[2][cy * output.linesize[2] + cx] = static_cast<uint8_t>(clamp_channel((v_sum + count / 2) / count));
+        }
+    }
+}
+
+void quantize_plane_rows(const uint8_t* input, int input_linesize, uint8_t* output, int output_linesize,
+    int width, int first_row, int last_row, const QuantizeParams& params) {
+    const int step = params.step;
+    // the rounding of every mode is value + bias, the bias of the binary mode is unused
+    const int bias = params.mode == QUANTIZE_UPPER_BOUND ? step - 1 : params.mode == QUANTIZE_NEAREST ? step / 2 : 0;
+    for (int y = first_row; y < last_row; y++) {
+        const uint8_t* in = input + static_cast<size_t>(y) * input_linesize;
+        uint8_t* out = output + static_cast<size_t>(y) * output_linesize;
+        if (params.grayscale) {
+            std::fill(out, out + width, static_cast<uint8_t>(128));
+            continue;
+        }
+        for (int x = 0; x < width; x++) {
+            const int value = in[x];
+            const int quantized = params.mode == QUANTIZE_BINARY ? (value >> 7) * 255 : ((value + bias) / step) * step;
+            // saturate instead of wrapping like the RGB kernels, a wrapped chroma sample would flip the hue
+            out[x] = static_cast<uint8_t>(std::min(quantized, 255));
+        }
+    }
+}
+
+#ifdef CPU_KERNELS_X86
+/*
+ * The vector kernels work on 32-bit pixels (B | G << 8 | R << 16 | A << 24 on little-endian) split in two
+ * vectors of 16-bit lanes: x holds B and R, y holds G and A. The quantization is done on the 16-bit lanes,
+ * then R and B are swapped by rotating x by 16 bits and the pixel is reassembled as R | G << 8 | B << 16 | A << 24.
+ */
+namespace {
+    __attribute__((target("sse2")))
+    inline __m128i quantize_lanes_sse2(__m128i values, __m128i bias, __m128i multiplier, __m128i scale, bool identity) {
+        if (identity) {
+            return values;
+        }
+        const __m128i quotient = _mm_mulhi_epu16(_mm_add_epi16(values, bias), multiplier);
+        return _mm_and_si128(_mm_mullo_epi16(quotient, scale), _mm_set1_epi16(0x00FF));
+    }
+
+    __attribute__((target("sse2")))
+    void quantize_pixels_sse2(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const QuantizeParams& params) {
+        const __m128i channel_mask = _mm_set1_epi32(0x00FF00FF);
+        const __m128i low_lane_mask = _mm_set1_epi32(0x0000FFFF);
+        const __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+        const __m128i gray_weights_br = _mm_set1_epi32((GRAY_WEIGHT_R << 16) | GRAY_WEIGHT_B);
+        const __m128i gray_weights_ga = _mm_set1_epi32(GRAY_WEIGHT_G);
+        const __m128i bias = _mm_set1_epi16(static_cast<short>(params.bias));
+        const __m128i multiplier = _mm_set1_epi16(static_cast<short>(params.multiplier));
+        const __m128i scale = _mm_set1_epi16(static_cast<short>(params.scale));
+
+        size_t i = 0;
+        for (; i + 4 <= pixel_count; i += 4) {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bgra + 4 * i));
+            const __m128i x = _mm_and_si128(pixels, channel_mask);
+            const __m128i y = _mm_and_si128(_mm_srli_epi32(pixels, 8), channel_mask);
+            __m128i result;
+            if (params.grayscale) {
+                __m128i gray = _mm_add_epi32(_mm_madd_epi16(x, gray_weights_br), _mm_madd_epi16(y, gray_weights_ga));
+                gray = quantize_lanes_sse2(_mm_srli_epi32(gray, GRAY_SHIFT), bias, multiplier, scale, params.identity);
+                gray = _mm_and_si128(gray, low_lane_mask);
+                result = _mm_or_si128(_mm_or_si128(gray, _mm_slli_epi32(gray, 8)), _mm_slli_epi32(gray, 16));
+                result = _mm_or_si128(result, _mm_and_si128(pixels, alpha_mask));
+            } else {
+                const __m128i qx = quantize_lanes_sse2(x, bias, multiplier, scale, params.identity);
+                __m128i qy = quantize_lanes_sse2(y, bias, multiplier, scale, params.identity);
+                qy = _mm_or_si128(_mm_and_si128(qy, low_lane_mask), _mm_andnot_si128(low_lane_mask, y)); // keep alpha
+                const __m128i swapped = _mm_or_si128(_mm_srli_epi32(qx, 16), _mm_slli_epi32(qx, 16));
+                result = _mm_or_si128(swapped, _mm_slli_epi32(qy, 8));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + 4 * i), result);
+        }
+        quantize_pixels_scalar(bgra + 4 * i, rgba + 4 * i, pixel_count - i, params);
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i quantize_lanes_avx2(__m256i values, __m256i bias, __m256i multiplier, __m256i scale, bool identity) {
+        if (identity) {
+            return values;
+        }
+        const __m256i quotient = _mm256_mulhi_epu16(_mm256_add_epi16(values, bias), multiplier);
+        return _mm256_and_si256(_mm256_mullo_epi16(quotient, scale), _mm256_set1_epi16(0x00FF));
+    }
+
+    __attribute__((target("avx2")))
+    void quantize_pixels_avx2(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const QuantizeParams& params) {
+        const __m256i channel_mask = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i low_lane_mask = _mm256_set1_epi32(0x0000FFFF);
+        const __m256i alpha_mask = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+        const __m256i gray_weights_br = _mm256_set1_epi32((GRAY_WEIGHT_R << 16) | GRAY_WEIGHT_B);
+        const __m256i gray_weights_ga = _mm256_set1_epi32(GRAY_WEIGHT_G);
+        const __m256i bias = _mm256_set1_epi16(static_cast<short>(params.bias));
+        const __m256i multiplier = _mm256_set1_epi16(static_cast<short>(params.multiplier));
+        const __m256i scale = _mm256_set1_epi16(static_cast<short>(params.scale));
+
+        size_t i = 0;
+        for (; i + 8 <= pixel_count; i += 8) {
+            const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bgra + 4 * i));
+            const __m256i x = _mm256_and_si256(pixels, channel_mask);
+            const __m256i y = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), channel_mask);
+            __m256i result;
+            if (params.grayscale) {
+                __m256i gray = _mm256_add_epi32(_mm256_madd_epi16(x, gray_weights_br), _mm256_madd_epi16(y, gray_weights_ga));
+                gray = quantize_lanes_avx2(_mm256_srli_epi32(gray, GRAY_SHIFT), bias, multiplier, scale, params.identity);
+                gray = _mm256_and_si256(gray, low_lane_mask);
+                result = _mm256_or_si256(_mm256_or_si256(gray, _mm256_slli_epi32(gray, 8)), _mm256_slli_epi32(gray, 16));
+                result = _mm256_or_si256(result, _mm256_and_si256(pixels, alpha_mask));
+            } else {
+                const __m256i qx = quantize_lanes_avx2(x, bias, multiplier, scale, params.identity);
+                __m256i qy = quantize_lanes_avx2(y, bias, multiplier, scale, params.identity);
+                qy = _mm256_or_si256(_mm256_and_si256(qy, low_lane_mask), _mm256_andnot_si256(low_lane_mask, y)); // keep alpha
+                const __m256i swapped = _mm256_or_si256(_mm256_srli_epi32(qx, 16), _mm256_slli_epi32(qx, 16));
+                result = _mm256_or_si256(swapped, _mm256_slli_epi32(qy, 8));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + 4 * i), result);
+        }
+        quantize_pixels_sse2(bgra + 4 * i, rgba + 4 * i, pixel_count - i, params);
+    }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+// some GCC versions report false positives inside their own AVX-512 intrinsic headers
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+    __attribute__((target("avx512f,avx512bw")))
+    inline __m512i quantize_lanes_avx512(__m512i values, __m512i bias, __m512i multiplier, __m512i scale, bool identity) {
+        if (identity) {
+            return values;
+        }
+        const __m512i quotient = _mm512_mulhi_epu16(_mm512_add_epi16(values, bias), multiplier);
+        return _mm512_and_si512(_mm512_mullo_epi16(quotient, scale), _mm512_set1_epi16(0x00FF));
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    void quantize_pixels_avx512(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const QuantizeParams& params) {
+        const __m512i channel_mask = _mm512_set1_epi32(0x00FF00FF);
+        const __m512i low_lane_mask = _mm512_set1_epi32(0x0000FFFF);
+        const __m512i alpha_mask = _mm512_set1_epi32(static_cast<int>(0xFF000000u));
+        const __m512i gray_weights_br = _mm512_set1_epi32((GRAY_WEIGHT_R << 16) | GRAY_WEIGHT_B);
+        const __m512i gray_weights_ga = _mm512_set1_epi32(GRAY_WEIGHT_G);
+        const __m512i bias = _mm512_set1_epi16(static_cast<short>(params.bias));
+        const __m512i multiplier = _mm512_set1_epi16(static_cast<short>(params.multiplier));
+        const __m512i scale = _mm512_set1_epi16(static_cast<short>(params.scale));
+
+        size_t i = 0;
+        for (; i + 16 <= pixel_count; i += 16) {
+            const __m512i pixels = _mm512_loadu_si512(bgra + 4 * i);
+            const __m512i x = _mm512_and_si512(pixels, channel_mask);
+            const __m512i y = _mm512_and_si512(_mm512_srli_epi32(pixels, 8), channel_mask);
+            __m512i result;
+            if (params.grayscale) {
+                __m512i gray = _mm512_add_epi32(_mm512_madd_epi16(x, gray_weights_br), _mm512_madd_epi16(y, gray_weights_ga));
+                gray = quantize_lanes_avx512(_mm512_srli_epi32(gray, GRAY_SHIFT), bias, multiplier, scale, params.identity);
+                gray = _mm512_and_si512(gray, low_lane_mask);
+                result = _mm512_or_si512(_mm512_or_si512(gray, _mm512_slli_epi32(gray, 8)), _mm512_slli_epi32(gray, 16));
+                result = _mm512_or_si512(result, _mm512_and_si512(pixels, alpha_mask));
+            } else {
+                const __m512i qx = quantize_lanes_avx512(x, bias, multiplier, scale, params.identity);
+                __m512i qy = quantize_lanes_avx512(y, bias, multiplier, scale, params.identity);
+                qy = _mm512_or_si512(_mm512_and_si512(qy, low_lane_mask), _mm512_andnot_si512(low_lane_mask, y)); // keep alpha
+                const __m512i swapped = _mm512_or_si512(_mm512_srli_epi32(qx, 16), _mm512_slli_epi32(qx, 16));
+                result = _mm512_or_si512(swapped, _mm512_slli_epi32(qy, 8));
+            }
+            _mm512_storeu_si512(rgba + 4 * i, result);
+        }
+        quantize_pixels_avx2(bgra + 4 * i, rgba + 4 * i, pixel_count - i, params);
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+    /*
+     * The lookup table kernels swap R and B with a byte shuffle, look up every byte of the pixels in the shared
+     * 256-entry table and put the original alpha back. With grayscale the gray level is computed like above,
+     * looked up and replicated in the three channels.
+     */
+    __attribute__((target("avx2")))
+    inline __m256i lookup_avx2(__m256i values, const __m256i* tables) {
+        // pshufb looks up 16 entries, so each of the 16 sub-tables is selected by the high nibble of the value
+        const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+        const __m256i low = _mm256_and_si256(values, nibble_mask);
+        const __m256i high = _mm256_and_si256(_mm256_srli_epi16(values, 4), nibble_mask);
+        __m256i result = _mm256_setzero_si256();
+        for (int k = 0; k < 16; k++) {
+            const __m256i selected = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(static_cast<char>(k)));
+            result = _mm256_or_si256(result, _mm256_and_si256(_mm256_shuffle_epi8(tables[k], low), selected));
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2")))
+    void apply_lut_avx2(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const uint8_t* lut, bool grayscale) {
+        __m256i tables[16];
+        for (int k = 0; k < 16; k++) {
+            tables[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lut + 16 * k)));
+        }
+        const __m256i swap_rb = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        const __m256i channel_mask = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i low_byte_mask = _mm256_set1_epi32(0x000000FF);
+        const __m256i alpha_mask = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+        const __m256i gray_weights_br = _mm256_set1_epi32((GRAY_WEIGHT_R << 16) | GRAY_WEIGHT_B);
+        const __m256i gray_weights_ga = _mm256_set1_epi32(GRAY_WEIGHT_G);
+
+        size_t i = 0;
+        for (; i + 8 <= pixel_count; i += 8) {
+            const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bgra + 4 * i));
+            __m256i result;
+            if (grayscale) {
+                const __m256i x = _mm256_and_si256(pixels, channel_mask);
+                const __m256i y = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), channel_mask);
+                __m256i gray = _mm256_add_epi32(_mm256_madd_epi16(x, gray_weights_br), _mm256_madd_epi16(y, gray_weights_ga));
+                gray = _mm256_and_si256(lookup_avx2(_mm256_srli_epi32(gray, GRAY_SHIFT), tables), low_byte_mask);
+                result = _mm256_or_si256(_mm256_or_si256(gray, _mm256_slli_epi32(gray, 8)), _mm256_slli_epi32(gray, 16));
+            } else {
+                result = lookup_avx2(_mm256_shuffle_epi8(pixels, swap_rb), tables);
+            }
+            result = _mm256_blendv_epi8(result, pixels, alpha_mask); // keep alpha
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + 4 * i), result);
+        }
+        apply_lut_scalar(bgra + 4 * i, rgba + 4 * i, pixel_count - i, lut, grayscale);
+    }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+    __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+    inline __m512i lookup_avx512(__m512i values, __m512i table0, __m512i table1, __m512i table2, __m512i table3) {
+        // vpermi2b looks up 128 entries from two registers, the high bit of the value picks the half of the table
+        const __m512i low_half = _mm512_permutex2var_epi8(table0, values, table1);
+        const __m512i high_half = _mm512_permutex2var_epi8(table2, values, table3);
+        return _mm512_mask_blend_epi8(_mm512_movepi8_mask(values), low_half, high_half);
+    }
+
+    __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+    void apply_lut_avx512(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const uint8_t* lut, bool grayscale) {
+        const __m512i table0 = _mm512_loadu_si512(lut);
+        const __m512i table1 = _mm512_loadu_si512(lut + 64);
+        const __m512i table2 = _mm512_loadu_si512(lut + 128);
+        const __m512i table3 = _mm512_loadu_si512(lut + 192);
+        const __m512i swap_rb = _mm512_set4_epi32(0x0F0C0D0E, 0x0B08090A, 0x07040506, 0x03000102);
+        const __m512i channel_mask = _mm512_set1_epi32(0x00FF00FF);
+        const __m512i low_byte_mask = _mm512_set1_epi32(0x000000FF);
+        const __mmask64 alpha_mask = 0x8888888888888888ull;
+        const __m512i gray_weights_br = _mm512_set1_epi32((GRAY_WEIGHT_R << 16) | GRAY_WEIGHT_B);
+        const __m512i gray_weights_ga = _mm512_set1_epi32(GRAY_WEIGHT_G);
+
+        size_t i = 0;
+        for (; i + 16 <= pixel_count; i += 16) {
+            const __m512i pixels = _mm512_loadu_si512(bgra + 4 * i);
+            __m512i result;
+            if (grayscale) {
+                const __m512i x = _mm512_and_si512(pixels, channel_mask);
+                const __m512i y = _mm512_and_si512(_mm512_srli_epi32(pixels, 8), channel_mask);
+                __m512i gray = _mm512_add_epi32(_mm512_madd_epi16(x, gray_weights_br), _mm512_madd_epi16(y, gray_weights_ga));
+                gray = lookup_avx512(_mm512_srli_epi32(gray, GRAY_SHIFT), table0, table1, table2, table3);
+                gray = _mm512_and_si512(gray, low_byte_mask);
+                result = _mm512_or_si512(_mm512_or_si512(gray, _mm512_slli_epi32(gray, 8)), _mm512_slli_epi32(gray, 16));
+            } else {
+                result = lookup_avx512(_mm512_shuffle_epi8(pixels, swap_rb), table0, table1, table2, table3);
+            }
+            result = _mm512_mask_blend_epi8(alpha_mask, result, pixels); // keep alpha
+            _mm512_storeu_si512(rgba + 4 * i, result);
+        }
+        apply_lut_avx2(bgra + 4 * i, rgba + 4 * i, pixel_count - i, lut, grayscale);
+    }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+}
+#endif // CPU_KERNELS_X86
+
+KernelInfo select_kernel() {
+    // an optional cap on the instruction set, mostly useful to compare the variants
+    const char* env = std::getenv("VCQ_CPU_ISA");
+    const std::string cap = (env && env[0] != '\0') ? env : "avx512";
+    if (cap == "scalar") {
+        return { "scalar", quantize_pixels_scalar };
+    }
+#ifdef CPU_KERNELS_X86
+    __builtin_cpu_init();
+    if (cap == "avx512" && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return { "avx512", quantize_pixels_avx512 };
+    }
+    if ((cap == "avx512" || cap == "avx2") && __builtin_cpu_supports("avx2")) {
+        return { "avx2", quantize_pixels_avx2 };
+    }
+    return { "sse2", quantize_pixels_sse2 };
+#else
+    return { "scalar", quantize_pixels_scalar };
+#endif
+}
+
+void color_histogram(const uint8_t* bgra, size_t pixel_count, uint32_t* histogram) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* in = bgra + 4 * i;
+        histogram[palette::histogram_bin(in[2], in[1], in[0])]++;
+    }
+}
+
+void color_signature(const uint8_t* bgra, size_t first_pixel, size_t last_pixel, uint32_t* signature) {
+    const size_t step = palette::SIGNATURE_SAMPLE_STEP;
+    for (size_t i = (first_pixel + step - 1) / step * step; i < last_pixel; i += step) {
+        const uint8_t* in = bgra + 4 * i;
+        signature[palette::signature_bin(in[2], in[1], in[0])]++;
+    }
+}
+
+namespace {
+    /**
+     * @brief Gets the nearest palette entry in squared RGB distance, the first one on ties like nearest_palette_entry.
+     */
+    inline size_t nearest_entry(int r, int g, int b, const palette::Color* entries, size_t entry_count) {
+        size_t best = 0;
+        int best_distance = std::numeric_limits<int>::max();
+        for (size_t i = 0; i < entry_count; i++) {
+            const int dr = r - entries[i].r;
+            const int dg = g - entries[i].g;
+            const int db = b - entries[i].b;
+            const int distance = dr * dr + dg * dg + db * db;
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = i;
+            }
+        }
+        return best;
+    }
+}
+
+void accumulate_palette(const uint8_t* bgra, size_t first_pixel, size_t last_pixel,
+    const palette::Color* entries, size_t entry_count, uint32_t* sums) {
+    // same sampling as the kernel, the pixels whose index is a multiple of the step
+    const size_t step = palette::KMEANS_SAMPLE_STEP;
+    for (size_t i = (first_pixel + step - 1) / step * step; i < last_pixel; i += step) {
+        const uint8_t* in = bgra + 4 * i;
+        const size_t entry = nearest_entry(in[2], in[1], in[0], entries, entry_count);
+        sums[4 * entry] += in[2];
+        sums[4 * entry + 1] += in[1];
+        sums[4 * entry + 2] += in[0];
+        sums[4 * entry + 3]++;
+    }
+}
+
+void map_to_palette(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const palette::Color* entries, size_t entry_count) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* in = bgra + 4 * i;
+        uint8_t* out = rgba + 4 * i;
+        const palette::Color& entry = entries[nearest_entry(in[2], in[1], in[0], entries, entry_count)];
+        out[0] = entry.r;
+        out[1] = entry.g;
+        out[2] = entry.b;
+        out[3] = in[3];
+    }
+}
+
+namespace {
+    /**
+     * @brief Squared distances from an entry to the nearest and to the farthest color of a cube cell, like cell_distances.
+     */
+    inline std::pair<int, int> cell_distances(const palette::Color& entry, const int low[3]) {
+        constexpr int last = (1 << (8 - palette::CUBE_BITS)) - 1;
+        const int value[3] = { entry.r, entry.g, entry.b };
+        int nearest = 0;
+        int farthest = 0;
+        for (int c = 0; c < 3; c++) {
+            const int high = low[c] + last;
+            const int near = value[c] < low[c] ? low[c] - value[c] : value[c] > high ? value[c] - high : 0;
+            const int far = std::max(std::abs(value[c] - low[c]), std::abs(value[c] - high));
+            nearest += near * near;
+            farthest += far * far;
+        }
+        return { nearest, farthest };
+    }
+}
+
+void build_palette_cube(const palette::Color* entries, size_t entry_count, size_t first_cell, size_t last_cell, uint8_t* cube) {
+    constexpr int mask = (1 << palette::CUBE_BITS) - 1;
+    constexpr int shift = 8 - palette::CUBE_BITS;
+    for (size_t cell = first_cell; cell < last_cell; cell++) {
+        const int low[3] = { static_cast<int>((cell >> (2 * palette::CUBE_BITS)) & mask) << shift,
+            static_cast<int>((cell >> palette::CUBE_BITS) & mask) << shift, static_cast<int>(cell & mask) << shift };
+        int bound = std::numeric_limits<int>::max();
+        for (size_t i = 0; i < entry_count; i++) {
+            bound = std::min(bound, cell_distances(entries[i], low).second);
+        }
+        uint8_t* entry_list = cube + cell * palette::CUBE_CELL_SIZE;
+        size_t count = 0;
+        for (size_t i = 0; i < entry_count; i++) {
+            if (cell_distances(entries[i], low).first > bound) {
+                continue;
+            }
+            if (count == palette::CUBE_CELL_SIZE - 1) {
+                count = palette::CUBE_FULL_SEARCH;
+                break;
+            }
+            entry_list[1 + count] = static_cast<uint8_t>(i);
+            count++;
+        }
+        entry_list[0] = static_cast<uint8_t>(count);
+    }
+}
+
+void map_to_palette_cube(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count,
+    const palette::Color* entries, size_t entry_count, const uint8_t* cube) {
+    for (size_t i = 0; i < pixel_count; i++) {
+        const uint8_t* in = bgra + 4 * i;
+        uint8_t* out = rgba + 4 * i;
+        const int r = in[2];
+        const int g = in[1];
+        const int b = in[0];
+        const uint8_t* entry_list = cube + palette::cube_cell(r, g, b) * palette::CUBE_CELL_SIZE;
+        const size_t count = entry_list[0];
+        size_t best = entry_list[1];
+        if (count == palette::CUBE_FULL_SEARCH) {
+            best = nearest_entry(r, g, b, entries, entry_count);
+        } else if (count > 1) {
+            int best_distance = std::numeric_limits<int>::max();
+            for (size_t k = 0; k < count; k++) {
+                const palette::Color& entry = entries[entry_list[1 + k]];
+                const int dr = r - entry.r;
+                const int dg = g - entry.g;
+                const int db = b - entry.b;
+                const int distance = dr * dr + dg * dg + db * db;
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = entry_list[1 + k];
+                }
+            }
+        }
+        const palette::Color& entry = entries[best];
+        out[0] = entry.r;
+        out[1] = entry.g;
+        out[2] = entry.b;
+        out[3] = in[3];
+    }
+}
+
+namespace {
+    /**
+     * @brief Reads the RGB channels of a BGRA pixel, converted to grayscale if asked, like the dithering kernels.
+     */
+    inline void read_rgb(const uint8_t* in, bool grayscale, int* rgb) {
+        rgb[0] = in[2];
+        rgb[1] = in[1];
+        rgb[2] = in[0];
+        if (grayscale) {
+            const int gray = (GRAY_WEIGHT_R * rgb[0] + GRAY_WEIGHT_G * rgb[1] + GRAY_WEIGHT_B * rgb[2]) >> GRAY_SHIFT;
+            rgb[0] = gray;
+            rgb[1] = gray;
+            rgb[2] = gray;
+        }
+    }
+
+    /**
+     * @brief Nearest level of a channel corrected by the diffused error, saturated at 255, like dither_level().
+     */
+    inline int dither_level(int value, const QuantizeParams& params) {
+        if (params.mode == QUANTIZE_BINARY) {
+            return (value >> 7) * 255;
+        }
+        return std::min(((value + params.step / 2) / params.step) * params.step, 255);
+    }
+}
+
+void dither_ordered_rows(const uint8_t* bgra, uint8_t* rgba, int width, int first_row, int last_row,
+    const QuantizeParams& params, const uint8_t* matrix, int matrix_bits) {
+    const int mask = (1 << matrix_bits) - 1;
+    // the binary mode dithers the whole 0-255 range in a single step of 256
+    const int step = params.mode == QUANTIZE_BINARY ? 256 : params.step;
+    for (int y = first_row; y < last_row; y++) {
+        const uint8_t* matrix_row = matrix + ((y & mask) << matrix_bits);
+        for (int x = 0; x < width; x++) {
+            const size_t idx = static_cast<size_t>(y) * width + x;
+            const uint8_t* in = bgra + 4 * idx;
+            uint8_t* out = rgba + 4 * idx;
+            int rgb[3];
+            read_rgb(in, params.grayscale, rgb);
+            // rank t of the cell gives the offset (t + 0.5) / cells of a step
+            const int offset = ((2 * matrix_row[x & mask] + 1) * step) >> (2 * matrix_bits + 1);
+            for (int c = 0; c < 3; c++) {
+                const int level = (rgb[c] + offset) / step;
+                out[c] = static_cast<uint8_t>(params.mode == QUANTIZE_BINARY ? level * 255 : std::min(level * step, 255));
+            }
+            out[3] = in[3];
+        }
+    }
+}
+
+void dither_error_diffusion_tiles(const uint8_t* bgra, uint8_t* rgba, int width, int height,
+    int first_tile, int last_tile, const QuantizeParams& params) {
+    const int tiles_x = (width + dither::TILE_WIDTH - 1) / dither::TILE_WIDTH;
+    // error received by the pixels of the current and of the next row, in 1/16, with a column of padding on each side
+    int current[dither::TILE_WIDTH + 2][3];
+    int next[dither::TILE_WIDTH + 2][3];
+    for (int tile = first_tile; tile < last_tile; tile++) {
+        const int x0 = (tile % tiles_x) * dither::TILE_WIDTH;
+        const int y0 = (tile / tiles_x) * dither::TILE_HEIGHT;
+        const int tile_width = std::min(dither::TILE_WIDTH, width - x0);
+        const int tile_height = std::min(dither::TILE_HEIGHT, height - y0);
+        std::fill(&next[0][0], &next[0][0] + sizeof(next) / sizeof(int), 0);
+        // the pixels are visited in plain raster order, the sums reaching every pixel are the same as in the wavefront of the kernel
+        for (int row = 0; row < tile_height; row++) {
+            std::copy(&next[0][0], &next[0][0] + sizeof(next) / sizeof(int), &current[0][0]);
+            std::fill(&next[0][0], &next[0][0] + sizeof(next) / sizeof(int), 0);
+            int carry[3] = { 0, 0, 0 };
+            for (int x = 0; x < tile_width; x++) {
+                const size_t idx = static_cast<size_t>(y0 + row) * width + x0 + x;
+                const uint8_t* in = bgra + 4 * idx;
+                uint8_t* out = rgba + 4 * idx;
+                int rgb[3];
+                read_rgb(in, params.grayscale, rgb);
+                for (int c = 0; c < 3; c++) {
+                    const int corrected = std::clamp(rgb[c] + ((carry[c] + current[x + 1][c] + 8) >> 4), 0, 255);
+                    const int quantized = dither_level(corrected, params);
+                    const int error = corrected - quantized;
+                    carry[c] = 7 * error;
+                    next[x][c] += 3 * error;
+                    next[x + 1][c] += 5 * error;
+                    next[x + 2][c] += error;
+                    out[c] = static_cast<uint8_t>(quantized);
+                }
+                out[3] = in[3];
+            }
+        }
+    }
+}
+
+LutKernelInfo select_lut_kernel(bool shared_table) {
+    const char* env = std::getenv("VCQ_CPU_ISA");
+    const std::string cap = (env && env[0] != '\0') ? env : "avx512";
+    if (cap == "scalar" || !shared_table) {
+        return { "scalar", apply_lut_scalar };
+    }
+#ifdef CPU_KERNELS_X86
+    __builtin_cpu_init();
+    if (cap == "avx512" && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi")) {
+        return { "avx512vbmi", apply_lut_avx512 };
+    }
+    if ((cap == "avx512" || cap == "avx2") && __builtin_cpu_supports("avx2")) {
+        return { "avx2", apply_lut_avx2 };
+    }
+#endif
+    // there is no SSE2 byte shuffle, the scalar lookups are as fast
+    return { "scalar", apply_lut_scalar };
+}
+
+} // namespace cpu
@@ -0,0 +1,236 @@
+/**
+ * @file cpu_kernels.hpp
+ * @brief Native CPU implementations of the operations in uniformQuantization.cl.
+ *
+ * Every kernel performs the BGRA to RGBA channel swap, the optional grayscale conversion and the
+ * quantization in a single pass over a run of pixels, and is bit-exact with the OpenCL kernels.
+ * SSE2, AVX2 and AVX-512 variants are compiled with target attributes and picked at runtime.
+ */
+#pragma once
+
+#include "Dither.hpp"
+#include "FrameProcessor.hpp"
+#include "Palette.hpp"
+#include "PlanarFrame.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cpu {
+    /**
+     * @brief Fixed-point weights of the luminosity grayscale conversion, they sum to 1 << GRAY_SHIFT.
+     * Same values as the GRAY_WEIGHT_* defines in uniformQuantization.cl.
+     */
+    constexpr int GRAY_WEIGHT_R = 9798;
+    constexpr int GRAY_WEIGHT_G = 19235;
+    constexpr int GRAY_WEIGHT_B = 3735;
+    constexpr int GRAY_SHIFT = 15;
+
+    /**
+     * @struct QuantizeParams
+     * @brief Per-frame constants of the quantization, precomputed from the settings.
+     *
+     * The vector kernels replace the division by the step with a multiplication by a 16-bit
+     * reciprocal: for every value they can see (at most 255 + step - 1) the result is exact.
+     */
+    struct QuantizeParams {
+        QuantizationMode mode;  ///< Rounding mode
+        int step;               ///< Width of a quantization interval, 256 / levels
+        bool grayscale;         ///< Convert to grayscale before quantizing
+        bool identity;          ///< The quantization does not change the values (step of 1)
+        uint16_t bias;          ///< Added to the value before the division, depends on the rounding
+        uint16_t multiplier;    ///< ceil(65536 / divisor), the division becomes (value * multiplier) >> 16
+        uint16_t scale;         ///< Multiplies the quotient back into a channel value
+    };
+
+    /**
+     * @brief Precomputes the kernel constants for a set of quantization settings.
+     * @param settings The quantization settings.
+     * @return The kernel constants.
+     */
+    QuantizeParams make_params(const QuantizationSettings& settings);
+
+    /**
+     * @brief Signature of a kernel processing a run of contiguous pixels.
+     * @param bgra Input pixels in BGRA order.
+     * @param rgba Output pixels in RGBA order.
+     * @param pixel_count Number of pixels to process.
+     * @param params The kernel constants.
+     */
+    using PixelKernel = void (*)(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const QuantizeParams& params);
+
+    /**
+     * @struct KernelInfo
+     * @brief A kernel together with the name of the instruction set it uses.
+     */
+    struct KernelInfo {
+        const char* isa;        ///< Name of the instruction set
+        PixelKernel kernel;     ///< The kernel
+    };
+
+    /**
+     * @brief Picks the fastest kernel supported by the running CPU.
+     * The VCQ_CPU_ISA environment variable (scalar, sse2, avx2, avx512) can force a lower instruction set.
+     * @return The selected kernel.
+     */
+    KernelInfo select_kernel();
+
+    /**
+     * @brief Portable reference kernel, used for the tails of the vector kernels.
+     */
+    void quantize_pixels_scalar(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const QuantizeParams& params);
+
+    /**
+     * @brief Signature of a kernel applying a lookup table to a run of contiguous pixels, like bgra_lut_fused.
+     * @param bgra Input pixels in BGRA order.
+     * @param rgba Output pixels in RGBA order.
+     * @param pixel_count Number of pixels to process.
+     * @param lut The 3 x 256 table, R then G then B.
+     * @param grayscale Convert to grayscale before applying the table.
+     */
+    using LutKernel = void (*)(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const uint8_t* lut, bool grayscale);
+
+    /**
+     * @struct LutKernelInfo
+     * @brief A lookup table kernel together with the name of the instruction set it uses.
+     */
+    struct LutKernelInfo {
+        const char* isa;        ///< Name of the instruction set
+        LutKernel kernel;       ///< The kernel
+    };
+
+    /**
+     * @brief Picks the fastest lookup table kernel supported by the running CPU, honouring VCQ_CPU_ISA like select_kernel().
+     * The vector kernels shuffle a single 256-entry table, so they are only used when the three channels share it.
+     * @param shared_table Whether the three channels of the table use the same mapping.
+     * @return The selected kernel.
+     */
+    LutKernelInfo select_lut_kernel(bool shared_table);
+
+    /**
+     * @brief Portable lookup table kernel, handling per-channel tables.
+     */
+    void apply_lut_scalar(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const uint8_t* lut, bool grayscale);
+
+    /**
+     * @brief Converts a range of chroma rows of a YUV 4:2:0 frame to RGB, quantizes it and converts it back.
+     * Same BT.601 fixed-point arithmetic as the yuv420p_quantize_fused kernel, the output is always limited range.
+     * @param input The decoded frame.
+     * @param output The processed frame, it must not alias the input.
+     * @param width The width of the frame.
+     * @param height The height of the frame.
+     * @param first_chroma_row The first chroma row to process, covering luma rows 2 * first_chroma_row and the next one.
+     * @param last_chroma_row One past the last chroma row to process.
+     * @param params The kernel constants.
+     * @param full_range Whether the input uses the full (0-255) range.
+     */
+    void quantize_yuv420_rows(const PlanarFrame& input, const PlanarFrame& output, int width, int height,
+        int first_chroma_row, int last_chroma_row, const QuantizeParams& params, bool full_range);
+
+    /**
+     * @brief Quantizes a range of rows of a single plane, like the yuv420p_quantize_planes kernel.
+     * The quantized values saturate at 255 instead of wrapping, with grayscale every sample is set to 128.
+     * @param input The first row of the plane.
+     * @param input_linesize Size in bytes of a row of the input.
+     * @param output The first row of the processed plane, it can be the input itself.
+     * @param output_linesize Size in bytes of a row of the output.
+     * @param width The width of the plane.
+     * @param first_row The first row to process.
+     * @param last_row One past the last row to process.
+     * @param params The kernel constants, callers set the grayscale flag only for the chroma planes.
+     */
+    void quantize_plane_rows(const uint8_t* input, int input_linesize, uint8_t* output, int output_linesize,
+        int width, int first_row, int last_row, const QuantizeParams& params);
+
+    /**
+     * @brief Adds the pixels of a run to a color histogram, like the bgra_color_histogram kernel.
+     * @param bgra Input pixels in BGRA order.
+     * @param pixel_count Number of pixels to count.
+     * @param histogram palette::HISTOGRAM_BINS counters.
+     */
+    void color_histogram(const uint8_t* bgra, size_t pixel_count, uint32_t* histogram);
+
+    /**
+     * @brief Adds the sampled pixels of a range of the frame to a scene signature, like the bgra_color_signature kernel.
+     * Only the pixels whose index is a multiple of palette::SIGNATURE_SAMPLE_STEP are used.
+     * @param bgra The whole frame in BGRA order.
+     * @param first_pixel The first pixel of the range.
+     * @param last_pixel One past the last pixel of the range.
+     * @param signature palette::SIGNATURE_BINS counters.
+     */
+    void color_signature(const uint8_t* bgra, size_t first_pixel, size_t last_pixel, uint32_t* signature);
+
+    /**
+     * @brief Adds the sampled pixels of a range of the frame to the k-means sums, like the bgra_palette_accumulate kernel.
+     * Only the pixels whose index is a multiple of palette::KMEANS_SAMPLE_STEP are used.
+     * @param bgra The whole frame in BGRA order.
+     * @param first_pixel The first pixel of the range.
+     * @param last_pixel One past the last pixel of the range.
+     * @param entries The palette.
+     * @param entry_count The number of palette entries.
+     * @param sums The sums of R, G, B and the pixel count of every entry.
+     */
+    void accumulate_palette(const uint8_t* bgra, size_t first_pixel, size_t last_pixel,
+        const palette::Color* entries, size_t entry_count, uint32_t* sums);
+
+    /**
+     * @brief Maps every pixel of a run to its nearest palette entry, like the bgra_palette_map kernel.
+     * @param bgra Input pixels in BGRA order.
+     * @param rgba Output pixels in RGBA order.
+     * @param pixel_count Number of pixels to process.
+     * @param entries The palette.
+     * @param entry_count The number of palette entries.
+     */
+    void map_to_palette(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count, const palette::Color* entries, size_t entry_count);
+
+    /**
+     * @brief Builds the candidate lists of a range of cells of the palette cube, like the build_palette_cube kernel.
+     * @param entries The palette.
+     * @param entry_count The number of palette entries.
+     * @param first_cell The first cell to build.
+     * @param last_cell One past the last cell to build.
+     * @param cube palette::CUBE_CELLS cells of palette::CUBE_CELL_SIZE bytes.
+     */
+    void build_palette_cube(const palette::Color* entries, size_t entry_count, size_t first_cell, size_t last_cell, uint8_t* cube);
+
+    /**
+     * @brief Maps every pixel of a run to its nearest palette entry through the palette cube, like the bgra_palette_map_cube kernel.
+     * The result is the same as map_to_palette().
+     * @param bgra Input pixels in BGRA order.
+     * @param rgba Output pixels in RGBA order.
+     * @param pixel_count Number of pixels to process.
+     * @param entries The palette.
+     * @param entry_count The number of palette entries.
+     * @param cube The palette cube built for the palette.
+     */
+    void map_to_palette_cube(const uint8_t* bgra, uint8_t* rgba, size_t pixel_count,
+        const palette::Color* entries, size_t entry_count, const uint8_t* cube);
+
+    /**
+     * @brief Quantizes a range of rows with ordered dithering, like the bgra_dither_ordered kernel.
+     * @param bgra The whole frame in BGRA order.
+     * @param rgba The whole processed frame in RGBA order.
+     * @param width The width of the frame.
+     * @param first_row The first row to process.
+     * @param last_row One past the last row to process.
+     * @param params The kernel constants, only the nearest and binary modes are dithered.
+     * @param matrix The threshold matrix, see dither::threshold_matrix().
+     * @param matrix_bits log2 of the side of the matrix.
+     */
+    void dither_ordered_rows(const uint8_t* bgra, uint8_t* rgba, int width, int first_row, int last_row,
+        const QuantizeParams& params, const uint8_t* matrix, int matrix_bits);
+
+    /**
+     * @brief Quantizes a range of tiles with Floyd-Steinberg error diffusion, like the bgra_dither_error_diffusion kernel.
+     * The error does not cross the borders of the dither::TILE_WIDTH x dither::TILE_HEIGHT tiles.
+     * @param bgra The whole frame in BGRA order.
+     * @param rgba The whole processed frame in RGBA order.
+     * @param width The width of the frame.
+     * @param height The height of the frame.
+     * @param first_tile The first tile to process, in raster order.
+     * @param last_tile One past the last tile to process.
+     * @param params The kernel constants, only the nearest and binary modes are dithered.
+     */
+    void dither_error_diffusion_tiles(const uint8_t* bgra, uint8_t* rgba, int width, int height,
+        int first_tile, int last_tile, const QuantizeParams& params);
+} // namespace cpu
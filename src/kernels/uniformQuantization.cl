@@ -6,7 +6,16 @@
  * There could be problem based on the colorspase encoding depending on where the channel are stored, so that needs to be taken into account.
  * Since the quantization is done equally across the channels(other than the alpha channel), there is no difference if the colorspace changes the order of RGB.
  * Problems arise if we need to work on the single channels, if the colorspace is not RGB, and the order of the transparency channel is not the last one.
+ *
+ * The program can be specialized at build time with -D LEVELS=n: the levels kernel arguments are then ignored
+ * and the quantization step is a constant, so the divisions by it fold into multiplications or shifts.
  */
+#ifdef LEVELS
+#define QUANTIZATION_STEP(levels) (256 / LEVELS)
+#else
+#define QUANTIZATION_STEP(levels) (256 / (levels))
+#endif
+
 __kernel void uniform_quantize_lower_bound(
     __global const uchar4* input_image,
     __global uchar4* output_image,
@@ -23,7 +32,7 @@ __kernel void uniform_quantize_lower_bound(
 
     uchar4 pixel = input_image[idx];
 
-    int step = 256 / levels;
+    int step = QUANTIZATION_STEP(levels);
 
     uchar4 result;
     // floor(pixel.x / step) * step gives the quantized value (lower bound of each interval)
@@ -51,7 +60,7 @@ kernel void uniform_quantize_upper_bound(
 
     uchar4 pixel = input_image[idx];
 
-    int step = 256 / levels;
+    int step = QUANTIZATION_STEP(levels);
 
     uchar4 result;
     // ceil(pixel.x / step) * step gives the quantized value (upper bound of each interval)
@@ -79,7 +88,7 @@ kernel void uniform_quantize_nearest(
 
     uchar4 pixel = input_image[idx];
 
-    int step = 256 / levels;
+    int step = QUANTIZATION_STEP(levels);
 
     uchar4 result;
     // round(pixel.x / step) * step gives the quantized value (nearest value)
@@ -146,6 +155,17 @@ kernel void uniform_quantize_binary_bitshift(
     output_image[idx] = result;
 }
 
+// fixed-point weights of the luminosity method (0.299, 0.587, 0.114), they sum to 1 << GRAY_SHIFT
+// integer arithmetic keeps the result bit-exact with the native CPU backend, keep in sync with cpu_kernels.hpp
+#define GRAY_WEIGHT_R 9798
+#define GRAY_WEIGHT_G 19235
+#define GRAY_WEIGHT_B 3735
+#define GRAY_SHIFT 15
+
+uchar luminosity(const int r, const int g, const int b) {
+    return (uchar)((GRAY_WEIGHT_R * r + GRAY_WEIGHT_G * g + GRAY_WEIGHT_B * b) >> GRAY_SHIFT);
+}
+
 // convert RGB to grayscale RGB
 kernel void rgb_to_grayscale(
     __global const uchar4* input_image,
@@ -164,9 +184,11 @@ kernel void rgb_to_grayscale(
 
     uchar4 result;
     // Grayscale conversion formula
-    result.x = (uchar)(0.299 * pixel.x + 0.587 * pixel.y + 0.114 * pixel.z); // R
-    result.y = (uchar)(0.299 * pixel.x + 0.587 * pixel.y + 0.114 * pixel.z); // G
-    result.z = (uchar)(0.299 * pixel.x + 0.587 * pixel.y + 0.114 * pixel.z); // B
+    uchar gray = luminosity(pixel.x, pixel.y, pixel.z);
+    result.x = gray; // R
+    result.y = gray; // G
+    result.z = gray; // B
+    result.w = pixel.w; // Preserve alpha
 
     output_image[idx] = result;
 }
@@ -270,7 +292,7 @@ kernel void yuv_uniform_quantize_nearest(
 
     uchar3 pixel = input_image[idx];
 
-    int step = 256 / levels;
+    int step = QUANTIZATION_STEP(levels);
 
     uchar3 result;
     // round(pixel.x / step) * step gives the quantized value (nearest value)
@@ -305,4 +327,691 @@ kernel void yuv_uniform_quantize_binary_bitshift(
     result.z = (pixel.z >> 7) * 255; // V
 
     output_image[idx] = result;
-}
\ No newline at end of file
+}
+
+/* Fused kernels */
+// quantization modes understood by the fused kernel, keep in sync with the host code
+#define QUANTIZE_NEAREST 0
+#define QUANTIZE_LOWER_BOUND 1
+#define QUANTIZE_UPPER_BOUND 2
+#define QUANTIZE_BINARY 3
+
+// quantize a single channel value, with the same arithmetic as the single-operation kernels
+uchar quantize_channel(const int value, const int step, const int mode) {
+    switch (mode) {
+        case QUANTIZE_LOWER_BOUND:
+            return (uchar)((value / step) * step);
+        case QUANTIZE_UPPER_BOUND:
+            return (uchar)(((value + step - 1) / step) * step);
+        case QUANTIZE_BINARY:
+            return (uchar)((value >> 7) * 255);
+        default:
+            return (uchar)(((value + step / 2) / step) * step);
+    }
+}
+
+// BRGA to RGBA conversion, optional grayscale and quantization of one pixel, shared by the per-frame and batched kernels
+uchar4 quantize_pixel(const uchar4 pixel, const int levels, const int grayscale, const int mode) {
+    // BRGA to RGBA conversion
+    uchar r = pixel.z;
+    uchar g = pixel.y;
+    uchar b = pixel.x;
+
+    if (grayscale) {
+        // same luminosity formula as rgb_to_grayscale
+        uchar gray = luminosity(r, g, b);
+        r = gray;
+        g = gray;
+        b = gray;
+    }
+
+    int step = QUANTIZATION_STEP(levels);
+
+    uchar4 result;
+    result.x = quantize_channel(r, step, mode); // R
+    result.y = quantize_channel(g, step, mode); // G
+    result.z = quantize_channel(b, step, mode); // B
+    result.w = pixel.w; // Preserve alpha
+    return result;
+}
+
+// BRGA to RGBA conversion, optional grayscale and quantization in a single pass
+// every pixel is loaded and stored exactly once, the mode and grayscale flag are uniform across the work items so the branches do not diverge
+kernel void bgra_quantize_fused(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int levels,
+    const int grayscale,
+    const int mode
+) {
+    int idx = get_global_id(0); // 1D processing, like brga_to_rgba
+
+    if (idx >= width*height)
+        return;
+
+    output_image[idx] = quantize_pixel(input_image[idx], levels, grayscale, mode);
+}
+
+// same as bgra_quantize_fused over a batch of frames packed one after the other in the buffers
+// 3D processing (x, y, frame): a single launch covers every frame of the batch, the global size of the third dimension is the frame count
+kernel void bgra_quantize_fused_batch(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int levels,
+    const int grayscale,
+    const int mode
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    size_t idx = ((size_t)get_global_id(2) * height + y) * width + x;
+    output_image[idx] = quantize_pixel(input_image[idx], levels, grayscale, mode);
+}
+
+// BRGA to RGBA conversion, optional grayscale and lookup table of one pixel
+// the table holds any per-channel curve: R in lut[0..255], G in lut[256..511], B in lut[512..767]
+uchar4 lut_pixel(const uchar4 pixel, const int grayscale, __constant const uchar* lut) {
+    // BRGA to RGBA conversion
+    uchar r = pixel.z;
+    uchar g = pixel.y;
+    uchar b = pixel.x;
+
+    if (grayscale) {
+        uchar gray = luminosity(r, g, b);
+        r = gray;
+        g = gray;
+        b = gray;
+    }
+
+    uchar4 result;
+    result.x = lut[r]; // R
+    result.y = lut[256 + g]; // G
+    result.z = lut[512 + b]; // B
+    result.w = pixel.w; // Preserve alpha
+    return result;
+}
+
+// BRGA to RGBA conversion, optional grayscale and lookup table in a single pass
+kernel void bgra_lut_fused(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int grayscale,
+    __constant const uchar* lut
+) {
+    int idx = get_global_id(0); // 1D processing, like brga_to_rgba
+
+    if (idx >= width*height)
+        return;
+
+    output_image[idx] = lut_pixel(input_image[idx], grayscale, lut);
+}
+
+// same as bgra_lut_fused over a batch of frames, 3D processing (x, y, frame) like bgra_quantize_fused_batch
+kernel void bgra_lut_fused_batch(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int grayscale,
+    __constant const uchar* lut
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    size_t idx = ((size_t)get_global_id(2) * height + y) * width + x;
+    output_image[idx] = lut_pixel(input_image[idx], grayscale, lut);
+}
+
+/* Planar YUV 4:2:0 kernels */
+// the frames are packed planes: Y (width * height), then U and V ((width + 1) / 2 * (height + 1) / 2 each)
+// the conversions use BT.601 fixed-point coefficients, keep in sync with cpu_kernels.cpp
+
+uchar clamp_channel(const int value) {
+    return (uchar)clamp(value, 0, 255);
+}
+
+// YUV to RGB, limited (16-235) or full (0-255) range
+int3 yuv_to_rgb(const int y, const int u, const int v, const int full_range) {
+    const int d = u - 128;
+    const int e = v - 128;
+    int3 rgb;
+    if (full_range) {
+        rgb.x = y + ((359 * e + 128) >> 8);
+        rgb.y = y - ((88 * d + 183 * e + 128) >> 8);
+        rgb.z = y + ((454 * d + 128) >> 8);
+    } else {
+        const int c = 298 * (y - 16);
+        rgb.x = (c + 409 * e + 128) >> 8;
+        rgb.y = (c - 100 * d - 208 * e + 128) >> 8;
+        rgb.z = (c + 516 * d + 128) >> 8;
+    }
+    return clamp(rgb, 0, 255);
+}
+
+// convert, quantize and convert back a 2x2 block of a YUV 4:2:0 frame in a single pass
+// every work item owns one chroma sample and the (up to) four luma samples sharing it, the output is always limited range
+kernel void yuv420p_quantize_fused(
+    __global const uchar* input_image,
+    __global uchar* output_image,
+    const int width,
+    const int height,
+    const int levels,
+    const int grayscale,
+    const int mode,
+    const int full_range
+) {
+    int cx = get_global_id(0);
+    int cy = get_global_id(1);
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+
+    if (cx >= chroma_width || cy >= chroma_height)
+        return;
+
+    int u_offset = width * height;
+    int v_offset = u_offset + chroma_width * chroma_height;
+    int cidx = cy * chroma_width + cx;
+    int u = input_image[u_offset + cidx];
+    int v = input_image[v_offset + cidx];
+
+    int step = QUANTIZATION_STEP(levels);
+    int u_sum = 0;
+    int v_sum = 0;
+    int count = 0;
+    for (int dy = 0; dy < 2; dy++) {
+        int y = 2 * cy + dy;
+        if (y >= height)
+            break;
+        for (int dx = 0; dx < 2; dx++) {
+            int x = 2 * cx + dx;
+            if (x >= width)
+                break;
+            int idx = y * width + x;
+            int3 rgb = yuv_to_rgb(input_image[idx], u, v, full_range);
+            if (grayscale) {
+                int gray = luminosity(rgb.x, rgb.y, rgb.z);
+                rgb = (int3)(gray, gray, gray);
+            }
+            int r = quantize_channel(rgb.x, step, mode);
+            int g = quantize_channel(rgb.y, step, mode);
+            int b = quantize_channel(rgb.z, step, mode);
+            // RGB to limited range YUV
+            output_image[idx] = clamp_channel(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            u_sum += ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            v_sum += ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+            count++;
+        }
+    }
+    // the chroma of the block is the average of its pixels
+    output_image[u_offset + cidx] = clamp_channel((u_sum + count / 2) / count);
+    output_image[v_offset + cidx] = clamp_channel((v_sum + count / 2) / count);
+}
+
+
+// quantize the planes of a packed YUV 4:2:0 frame in place, directly in YUV space
+// Y uses the luma levels, U and V the chroma levels, with grayscale the chroma is set to the neutral 128
+// the values saturate at 255 instead of wrapping like the RGB kernels, a wrapped chroma sample would flip the hue
+kernel void yuv420p_quantize_planes(
+    __global uchar* image,
+    const int width,
+    const int height,
+    const int luma_levels,
+    const int chroma_levels,
+    const int grayscale,
+    const int mode
+) {
+    int idx = get_global_id(0); // 1D processing over the whole packed frame
+
+    int luma_size = width * height;
+    int frame_size = luma_size + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+
+    if (idx >= frame_size)
+        return;
+
+    if (grayscale && idx >= luma_size) {
+        image[idx] = 128;
+        return;
+    }
+
+    int value = image[idx];
+    int step = 256 / (idx < luma_size ? luma_levels : chroma_levels);
+    int bias = mode == QUANTIZE_UPPER_BOUND ? step - 1 : mode == QUANTIZE_NEAREST ? step / 2 : 0;
+    value = mode == QUANTIZE_BINARY ? (value >> 7) * 255 : ((value + bias) / step) * step;
+    image[idx] = (uchar)min(value, 255);
+}
+
+/* Adaptive palette kernels */
+// keep in sync with Palette.hpp
+#define HISTOGRAM_BITS 4
+#define HISTOGRAM_BINS (1 << (3 * HISTOGRAM_BITS))
+#define MAX_PALETTE_SIZE 256
+#define KMEANS_SAMPLE_STEP 4
+#define SIGNATURE_BITS 3
+#define SIGNATURE_BINS (1 << (3 * SIGNATURE_BITS))
+#define SIGNATURE_SAMPLE_STEP 16
+#define CUBE_BITS 5
+#define CUBE_CELLS (1 << (3 * CUBE_BITS))
+#define CUBE_CELL_SIZE 16
+#define CUBE_FULL_SEARCH 255
+
+// histogram bin of an RGB color, the top HISTOGRAM_BITS bits of every channel
+uint histogram_bin(const uchar r, const uchar g, const uchar b) {
+    return ((uint)(r >> (8 - HISTOGRAM_BITS)) << (2 * HISTOGRAM_BITS))
+        | ((uint)(g >> (8 - HISTOGRAM_BITS)) << HISTOGRAM_BITS)
+        | (uint)(b >> (8 - HISTOGRAM_BITS));
+}
+
+// index of the nearest palette entry in squared RGB distance, the first one on ties
+uint nearest_palette_entry(const int r, const int g, const int b, __constant const uchar4* palette, const int palette_size) {
+    uint best = 0;
+    int best_distance = INT_MAX;
+    for (int i = 0; i < palette_size; i++) {
+        uchar4 entry = palette[i];
+        int dr = r - entry.x;
+        int dg = g - entry.y;
+        int db = b - entry.z;
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// color histogram of a BGRA frame, the histogram must be zeroed beforehand
+// every work group counts its pixels in local memory and merges the populated bins once, so the global atomics stay rare
+kernel void bgra_color_histogram(
+    __global const uchar4* input_image,
+    const int width,
+    const int height,
+    __global uint* histogram
+) {
+    __local uint local_histogram[HISTOGRAM_BINS];
+    for (int i = get_local_id(0); i < HISTOGRAM_BINS; i += get_local_size(0))
+        local_histogram[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // grid-stride loop, the number of work groups is sized to the device and not to the frame
+    for (int idx = get_global_id(0); idx < width*height; idx += get_global_size(0)) {
+        uchar4 pixel = input_image[idx];
+        atomic_inc(&local_histogram[histogram_bin(pixel.z, pixel.y, pixel.x)]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int i = get_local_id(0); i < HISTOGRAM_BINS; i += get_local_size(0)) {
+        uint count = local_histogram[i];
+        if (count)
+            atomic_add(&histogram[i], count);
+    }
+}
+
+// coarse color histogram of a sample of the pixels, the signature used to detect scene cuts
+// same scheme as bgra_color_histogram, the signature must be zeroed beforehand
+kernel void bgra_color_signature(
+    __global const uchar4* input_image,
+    const int width,
+    const int height,
+    __global uint* signature
+) {
+    __local uint local_signature[SIGNATURE_BINS];
+    for (int i = get_local_id(0); i < SIGNATURE_BINS; i += get_local_size(0))
+        local_signature[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int idx = get_global_id(0) * SIGNATURE_SAMPLE_STEP; idx < width*height; idx += get_global_size(0) * SIGNATURE_SAMPLE_STEP) {
+        uchar4 pixel = input_image[idx];
+        uint bin = ((uint)(pixel.z >> (8 - SIGNATURE_BITS)) << (2 * SIGNATURE_BITS))
+            | ((uint)(pixel.y >> (8 - SIGNATURE_BITS)) << SIGNATURE_BITS)
+            | (uint)(pixel.x >> (8 - SIGNATURE_BITS));
+        atomic_inc(&local_signature[bin]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int i = get_local_id(0); i < SIGNATURE_BINS; i += get_local_size(0)) {
+        uint count = local_signature[i];
+        if (count)
+            atomic_add(&signature[i], count);
+    }
+}
+
+// one k-means step: assigns every sampled pixel to its nearest entry and sums the pixels of every entry
+// sums holds R, G, B and the pixel count of every entry and must be zeroed beforehand
+kernel void bgra_palette_accumulate(
+    __global const uchar4* input_image,
+    const int width,
+    const int height,
+    __constant const uchar4* palette,
+    const int palette_size,
+    __global uint* sums
+) {
+    __local uint local_sums[4 * MAX_PALETTE_SIZE];
+    for (int i = get_local_id(0); i < 4 * palette_size; i += get_local_size(0))
+        local_sums[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int idx = get_global_id(0) * KMEANS_SAMPLE_STEP; idx < width*height; idx += get_global_size(0) * KMEANS_SAMPLE_STEP) {
+        uchar4 pixel = input_image[idx];
+        uint entry = nearest_palette_entry(pixel.z, pixel.y, pixel.x, palette, palette_size);
+        atomic_add(&local_sums[4 * entry], pixel.z);
+        atomic_add(&local_sums[4 * entry + 1], pixel.y);
+        atomic_add(&local_sums[4 * entry + 2], pixel.x);
+        atomic_inc(&local_sums[4 * entry + 3]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int i = get_local_id(0); i < 4 * palette_size; i += get_local_size(0)) {
+        uint sum = local_sums[i];
+        if (sum)
+            atomic_add(&sums[i], sum);
+    }
+}
+
+// BRGA to RGBA conversion and mapping of every pixel to its nearest palette entry
+kernel void bgra_palette_map(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    __constant const uchar4* palette,
+    const int palette_size
+) {
+    int idx = get_global_id(0); // 1D processing, like brga_to_rgba
+
+    if (idx >= width*height)
+        return;
+
+    uchar4 pixel = input_image[idx];
+    uchar4 entry = palette[nearest_palette_entry(pixel.z, pixel.y, pixel.x, palette, palette_size)];
+
+    uchar4 result;
+    result.x = entry.x; // R
+    result.y = entry.y; // G
+    result.z = entry.z; // B
+    result.w = pixel.w; // Preserve alpha
+
+    output_image[idx] = result;
+}
+
+/* Palette cube kernels */
+// the cube splits the RGB space in CUBE_CELLS cells, each holding the palette entries that can be the nearest one
+// to some color of the cell: the entries whose distance to the cell is at most the smallest farthest-point distance
+// a cell is a candidate count followed by the candidate indices in increasing order, so the first-on-ties rule of
+// nearest_palette_entry is preserved and the mapping is exact; cells with too many candidates search the whole palette
+
+// squared distance from an entry to the nearest and to the farthest color of a cell
+int2 cell_distances(const uchar4 entry, const int r0, const int g0, const int b0) {
+    const int last = (1 << (8 - CUBE_BITS)) - 1;
+    int3 value = (int3)(entry.x, entry.y, entry.z);
+    int3 low = (int3)(r0, g0, b0);
+    int3 high = low + last;
+    int3 near = select((int3)(0), low - value, value < low) + select((int3)(0), value - high, value > high);
+    int3 far = max(abs(value - low), abs(value - high));
+    return (int2)(near.x * near.x + near.y * near.y + near.z * near.z, far.x * far.x + far.y * far.y + far.z * far.z);
+}
+
+// builds the candidate list of every cell, one work item per cell
+kernel void build_palette_cube(
+    __constant const uchar4* palette,
+    const int palette_size,
+    __global uchar* cube
+) {
+    int cell = get_global_id(0);
+
+    if (cell >= CUBE_CELLS)
+        return;
+
+    const int mask = (1 << CUBE_BITS) - 1;
+    const int r0 = ((cell >> (2 * CUBE_BITS)) & mask) << (8 - CUBE_BITS);
+    const int g0 = ((cell >> CUBE_BITS) & mask) << (8 - CUBE_BITS);
+    const int b0 = (cell & mask) << (8 - CUBE_BITS);
+
+    // every color of the cell is at most this far from its nearest entry
+    int bound = INT_MAX;
+    for (int i = 0; i < palette_size; i++)
+        bound = min(bound, cell_distances(palette[i], r0, g0, b0).y);
+
+    __global uchar* entry_list = cube + cell * CUBE_CELL_SIZE;
+    int count = 0;
+    for (int i = 0; i < palette_size; i++) {
+        if (cell_distances(palette[i], r0, g0, b0).x > bound)
+            continue;
+        if (count == CUBE_CELL_SIZE - 1) {
+            count = CUBE_FULL_SEARCH;
+            break;
+        }
+        entry_list[1 + count] = (uchar)i;
+        count++;
+    }
+    entry_list[0] = (uchar)count;
+}
+
+// index of the nearest palette entry through the cube, same result as nearest_palette_entry
+uint nearest_palette_entry_cube(const int r, const int g, const int b, __constant const uchar4* palette, const int palette_size,
+    __global const uchar* cube) {
+    uint cell = ((uint)(r >> (8 - CUBE_BITS)) << (2 * CUBE_BITS)) | ((uint)(g >> (8 - CUBE_BITS)) << CUBE_BITS) | (uint)(b >> (8 - CUBE_BITS));
+    __global const uchar* entry_list = cube + cell * CUBE_CELL_SIZE;
+    int count = entry_list[0];
+    if (count == 1)
+        return entry_list[1]; // most cells have a single candidate, the mapping is a single fetch
+    if (count == CUBE_FULL_SEARCH)
+        return nearest_palette_entry(r, g, b, palette, palette_size);
+    uint best = entry_list[1];
+    int best_distance = INT_MAX;
+    for (int i = 0; i < count; i++) {
+        uint index = entry_list[1 + i];
+        uchar4 entry = palette[index];
+        int dr = r - entry.x;
+        int dg = g - entry.y;
+        int db = b - entry.z;
+        int distance = dr * dr + dg * dg + db * db;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = index;
+        }
+    }
+    return best;
+}
+
+// BRGA to RGBA conversion and mapping of every pixel to its nearest palette entry through the cube
+kernel void bgra_palette_map_cube(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    __constant const uchar4* palette,
+    const int palette_size,
+    __global const uchar* cube
+) {
+    int idx = get_global_id(0); // 1D processing, like brga_to_rgba
+
+    if (idx >= width*height)
+        return;
+
+    uchar4 pixel = input_image[idx];
+    uchar4 entry = palette[nearest_palette_entry_cube(pixel.z, pixel.y, pixel.x, palette, palette_size, cube)];
+
+    uchar4 result;
+    result.x = entry.x; // R
+    result.y = entry.y; // G
+    result.z = entry.z; // B
+    result.w = pixel.w; // Preserve alpha
+
+    output_image[idx] = result;
+}
+
+/* Dithering kernels */
+// the patterns are anchored to the pixel coordinates and use no per-frame randomness, so a static scene
+// keeps the same pattern in every frame, keep in sync with Dither.hpp and cpu_kernels.cpp
+#define DITHER_TILE_WIDTH 64
+#define DITHER_TILE_HEIGHT 32
+
+// ordered dithering of a channel: the offset replaces the half step of the nearest rounding
+// the binary mode dithers the whole 0-255 range in a single step of 256
+uchar dither_ordered_channel(const int value, const int step, const int offset, const int mode) {
+    int level = (value + offset) / step;
+    return mode == QUANTIZE_BINARY ? (uchar)(level * 255) : (uchar)min(level * step, 255);
+}
+
+// nearest level of a channel corrected by the diffused error, saturated at 255
+int dither_level(const int value, const int step, const int mode) {
+    return mode == QUANTIZE_BINARY ? (value >> 7) * 255 : min(((value + step / 2) / step) * step, 255);
+}
+
+// BRGA to RGBA conversion, optional grayscale and ordered dithering of the pixel at (x, y) of its frame
+// the matrix holds the ranks of a (1 << matrix_bits) square threshold matrix, Bayer or blue noise, repeated over the frame
+uchar4 dither_ordered_pixel(const uchar4 pixel, const int x, const int y, const int levels, const int grayscale, const int mode,
+    __constant const uchar* matrix, const int matrix_bits) {
+    // BRGA to RGBA conversion
+    uchar r = pixel.z;
+    uchar g = pixel.y;
+    uchar b = pixel.x;
+
+    if (grayscale) {
+        uchar gray = luminosity(r, g, b);
+        r = gray;
+        g = gray;
+        b = gray;
+    }
+
+    // rank t of the cell gives the offset (t + 0.5) / cells of a step
+    int mask = (1 << matrix_bits) - 1;
+    int rank = matrix[((y & mask) << matrix_bits) | (x & mask)];
+    int step = mode == QUANTIZE_BINARY ? 256 : QUANTIZATION_STEP(levels);
+    int offset = ((2 * rank + 1) * step) >> (2 * matrix_bits + 1);
+
+    uchar4 result;
+    result.x = dither_ordered_channel(r, step, offset, mode); // R
+    result.y = dither_ordered_channel(g, step, offset, mode); // G
+    result.z = dither_ordered_channel(b, step, offset, mode); // B
+    result.w = pixel.w; // Preserve alpha
+    return result;
+}
+
+// BRGA to RGBA conversion, optional grayscale and ordered dithering in a single pass
+kernel void bgra_dither_ordered(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int levels,
+    const int grayscale,
+    const int mode,
+    __constant const uchar* matrix,
+    const int matrix_bits
+) {
+    int idx = get_global_id(0); // 1D processing, like brga_to_rgba
+
+    if (idx >= width*height)
+        return;
+
+    output_image[idx] = dither_ordered_pixel(input_image[idx], idx % width, idx / width, levels, grayscale, mode, matrix, matrix_bits);
+}
+
+// same as bgra_dither_ordered over a batch of frames, 3D processing (x, y, frame) like bgra_quantize_fused_batch
+// the matrix restarts at the corner of every frame, so a batched frame is dithered exactly like a single one
+kernel void bgra_dither_ordered_batch(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int levels,
+    const int grayscale,
+    const int mode,
+    __constant const uchar* matrix,
+    const int matrix_bits
+) {
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    if (x >= width || y >= height)
+        return;
+
+    size_t idx = ((size_t)get_global_id(2) * height + y) * width + x;
+    output_image[idx] = dither_ordered_pixel(input_image[idx], x, y, levels, grayscale, mode, matrix, matrix_bits);
+}
+
+// BRGA to RGBA conversion, optional grayscale and Floyd-Steinberg error diffusion in a single pass
+// every work group owns a DITHER_TILE_WIDTH x DITHER_TILE_HEIGHT tile and the error does not leave it, so the
+// tiles are independent; inside a tile every work item owns a row and the rows advance as a wavefront, row y
+// handling pixel x at step x + 2 * y, when the pixels of the previous row it receives error from are done
+__attribute__((reqd_work_group_size(DITHER_TILE_HEIGHT, 1, 1)))
+kernel void bgra_dither_error_diffusion(
+    __global const uchar4* input_image,
+    __global uchar4* output_image,
+    const int width,
+    const int height,
+    const int levels,
+    const int grayscale,
+    const int mode
+) {
+    // error received by every pixel from the previous row, in 1/16, with a column of padding on each side
+    local short errors[DITHER_TILE_HEIGHT][DITHER_TILE_WIDTH + 2][3];
+
+    int row = get_local_id(0);
+    int tiles_x = (width + DITHER_TILE_WIDTH - 1) / DITHER_TILE_WIDTH;
+    int x0 = (get_group_id(0) % tiles_x) * DITHER_TILE_WIDTH;
+    int y = (get_group_id(0) / tiles_x) * DITHER_TILE_HEIGHT + row;
+
+    for (int i = 0; i < DITHER_TILE_WIDTH + 2; i++) {
+        errors[row][i][0] = 0;
+        errors[row][i][1] = 0;
+        errors[row][i][2] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int step = QUANTIZATION_STEP(levels);
+    // error pushed to the right neighbour, in 1/16
+    int3 carry = (int3)(0, 0, 0);
+    // every work item runs all the steps, the barriers must be reached by the whole group
+    for (int wave = 0; wave < DITHER_TILE_WIDTH + 2 * (DITHER_TILE_HEIGHT - 1); wave++) {
+        int x = wave - 2 * row;
+        if (x >= 0 && x < DITHER_TILE_WIDTH && x0 + x < width && y < height) {
+            int idx = y * width + x0 + x;
+            uchar4 pixel = input_image[idx];
+            int3 value = (int3)(pixel.z, pixel.y, pixel.x); // BRGA to RGBA conversion
+            if (grayscale) {
+                uchar gray = luminosity(value.x, value.y, value.z);
+                value = (int3)(gray, gray, gray);
+            }
+            int3 received = carry + (int3)(errors[row][x + 1][0], errors[row][x + 1][1], errors[row][x + 1][2]);
+            int3 corrected = clamp(value + ((received + 8) >> 4), 0, 255);
+            int3 quantized = (int3)(dither_level(corrected.x, step, mode), dither_level(corrected.y, step, mode),
+                dither_level(corrected.z, step, mode));
+            int3 error = corrected - quantized;
+            carry = 7 * error;
+            if (row + 1 < DITHER_TILE_HEIGHT) {
+                // 3/16 below left, 5/16 below and 1/16 below right, the next row reaches them in the next steps
+                errors[row + 1][x][0] += (short)(3 * error.x);
+                errors[row + 1][x][1] += (short)(3 * error.y);
+                errors[row + 1][x][2] += (short)(3 * error.z);
+                errors[row + 1][x + 1][0] += (short)(5 * error.x);
+                errors[row + 1][x + 1][1] += (short)(5 * error.y);
+                errors[row + 1][x + 1][2] += (short)(5 * error.z);
+                errors[row + 1][x + 2][0] += (short)error.x;
+                errors[row + 1][x + 2][1] += (short)error.y;
+                errors[row + 1][x + 2][2] += (short)error.z;
+            }
+
+            uchar4 result;
+            result.x = (uchar)quantized.x; // R
+            result.y = (uchar)quantized.y; // G
+            result.z = (uchar)quantized.z; // B
+            result.w = pixel.w; // Preserve alpha
+            output_image[idx] = result;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
@@ -3,6 +3,12 @@
 #include <iostream>
 #include <boost/program_options.hpp>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
 
 // Include the OpenCL headers as our utility code
 #include "ocl_utility.hpp"
@@ -10,226 +16,306 @@
 // Include the Video class
 #include "VideoReaderFFMPEG.hpp"
 #include "VideoWriterFFMPEG.hpp"
+#include "RawVideoStream.hpp"
+
+// Include the processing backends
+#include "OpenCLFrameProcessor.hpp"
+#include "MultiDeviceFrameProcessor.hpp"
+#include "ProgramBinaryCache.hpp"
+#include "CpuFrameProcessor.hpp"
+
+// Include the lookup table builders
+#include "QuantizationLut.hpp"
+
+// Include the threaded decode, compute and encode pipeline
+#include "FramePipeline.hpp"
+#include "Segments.hpp"
+#include "FrameStats.hpp"
+#include "Log.hpp"
+#include "ThreadBudget.hpp"
+
+/**
+ * @struct FrameLoop
+ * @brief How the frames travel from the reader to the writer.
+ */
+struct FrameLoop {
+    bool planar = false;            ///< Hand the decoded YUV 4:2:0 planes to the backend and encode its 4:2:0 output
+    bool yuv_quantization = false;  ///< Posterize the planes in YUV space instead of going through RGB, implies planar
+    int pipeline_depth = 0;         ///< Frames in flight of the threaded pipeline, 0 for the sequential loop
+    FrameStats* stats = nullptr;    ///< Collector of the per-frame stage timings, null without --stats
+};
+
+/**
+ * @brief Decodes, processes and encodes every frame returned by a reader.
+ * @tparam Reader VideoReaderFFMPEG, or RawVideoReader for a raw stream.
+ * @tparam Writer VideoWriterFFMPEG, or RawVideoWriter for a raw stream.
+ * @param video The reader, possibly restricted to a segment.
+ * @param processor The backend.
+ * @param videoOutput The writer.
+ * @param loop How the frames travel.
+ * @return The number of frames written.
+ */
+template <typename Reader, typename Writer>
+int64_t process_video(Reader& video, FrameProcessor& processor, Writer& videoOutput, const FrameLoop& loop) {
+    const int width = video.get_width();
+    const int height = video.get_height();
+    int64_t processed_frames = 0;
+    video.set_stats(loop.stats);
+    processor.set_stats(loop.stats);
+    videoOutput.set_stats(loop.stats);
+    if (loop.planar) {
+        const bool full_range = video.is_full_range();
+        // in YUV space the planes are only posterized, otherwise they go through RGB inside the backend
+        auto process_planes = [&](const PlanarFrame& input, const PlanarFrame& output) {
+            StageTimer timer(loop.stats, "process");
+            if (loop.yuv_quantization) {
+                processor.quantize_yuv420_planes(input, output);
+            } else {
+                processor.process_yuv420(input, output, full_range);
+            }
+        };
+        if (loop.pipeline_depth > 0) {
+            // the decoder reuses its frame, so the planes are packed into the recycled frames of the pipeline
+            const size_t planar_size = yuv420_frame_size(width, height);
+            FramePipeline pipeline(loop.pipeline_depth, planar_size, planar_size);
+            processed_frames = pipeline.run(
+                [&](PipelineFrame& frame) {
+                    PlanarFrame decoded;
+                    if (!video.read_next_frame_planar(decoded)) {
+                        return false;
+                    }
+                    copy_yuv420(decoded, make_packed_yuv420(frame.input.data(), width, height), width, height);
+                    return true;
+                },
+                [&](PipelineFrame& frame) {
+                    process_planes(make_packed_yuv420(frame.input.data(), width, height),
+                        make_packed_yuv420(frame.output.data(), width, height));
+                },
+                [&](PipelineFrame& frame) {
+                    copy_yuv420(make_packed_yuv420(frame.output.data(), width, height), videoOutput.acquire_frame(), width, height);
+                    videoOutput.submit_frame();
+                });
+            LOG_INFO("Pipelined processing done, frames: " << processed_frames);
+        } else {
+            // the backend reads the decoder planes and writes straight into the planes of the encoder frame
+            PlanarFrame decoded;
+            while (video.read_next_frame_planar(decoded)) {
+                process_planes(decoded, videoOutput.acquire_frame());
+                videoOutput.submit_frame();
+                processed_frames++;
+            }
+        }
+        return processed_frames;
+    }
 
-cl_event vectorInit(cl_command_queue q, cl_kernel vecinit_k, cl_int nels,size_t lws_in,
-	cl_mem d_v1, cl_mem d_v2)
-{
-	const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
-
-	printf("number of elements %d round to %zu GWS %zu\n", nels, lws_in, gws[0]); // vecinit not used since we are not using a local work size
-
-	cl_int err = clSetKernelArg(vecinit_k, 0, sizeof(d_v1), &d_v1);
-	ocl::check(err, "setKernelArg vecinit_k 0");
-
-	err = clSetKernelArg(vecinit_k, 1, sizeof(d_v2), &d_v2);
-	ocl::check(err, "setKernelArg vecinit_k 1");
-
-	err = clSetKernelArg(vecinit_k, 2, sizeof(nels), &nels);
-	ocl::check(err, "setKernelArg vecinit_k 2");
-
-	cl_event vecinit_evt;
-	err = clEnqueueNDRangeKernel(q, vecinit_k,
-		1, // numero dimensioni
-		NULL, // offset
-		gws, // global work size
-		NULL, // local work size
-		0, // numero di elementi nella waiting list
-		NULL, // waiting list
-		&vecinit_evt); // evento di questo comando
-	ocl::check(err, "Enqueue vecinit");
-
-	return vecinit_evt;
-}
-
-cl_event vectorAddition(cl_command_queue q, cl_kernel vecadd_k, cl_int nels,size_t lws_in,
-    cl_mem d_v1, cl_mem d_v2, cl_mem d_results)
-{
-    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
-
-    printf("number of elements %d round to %zu GWS %zu\n", nels, lws_in, gws[0]); // vecinit not used since we are not using a local work size
-
-    cl_int err = clSetKernelArg(vecadd_k, 0, sizeof(d_v1), &d_v1);
-    ocl::check(err, "setKernelArg vecadd_k 0");
-
-    err = clSetKernelArg(vecadd_k, 1, sizeof(d_v2), &d_v2);
-    ocl::check(err, "setKernelArg vecadd_k 1");
-
-    err = clSetKernelArg(vecadd_k, 2, sizeof(d_results), &d_results);
-    ocl::check(err, "setKernelArg vecadd_k 2");
-
-    err = clSetKernelArg(vecadd_k, 3, sizeof(nels), &nels);
-    ocl::check(err, "setKernelArg vecadd_k 3");
-
-    cl_event vecadd_evt;
-    err = clEnqueueNDRangeKernel(q, vecadd_k,
-        1, // numero dimensioni
-        NULL, // offset
-        gws, // global work size
-        NULL, // local work size
-        0, // numero di elementi nella waiting list
-        NULL, // waiting list
-        &vecadd_evt); // evento di questo comando
-    ocl::check(err, "Enqueue vecinit");
-
-    return vecadd_evt;
-}
-
-cl_event bgra_to_yuv(cl_command_queue queue, cl_kernel bgra_to_yuv_kernel, cl_int width, cl_int height, size_t lws_in,
-    cl_mem input_image_buffer, cl_mem output_image_buffer)
-{
-    uint nels = width * height;
-    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
-
-    printf("number of elements %d round to %zu GWS %zu\n", nels, lws_in, gws[0]); // vecinit not used since we are not using a local work size
-
-    cl_int err = clSetKernelArg(bgra_to_yuv_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
-    ocl::check(err, "setKernelArg bgra_to_yuv_kernel 0");
-
-    err = clSetKernelArg(bgra_to_yuv_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
-    ocl::check(err, "setKernelArg bgra_to_yuv_kernel 1");
-
-    err = clSetKernelArg(bgra_to_yuv_kernel, 2, sizeof(width), &width);
-    ocl::check(err, "setKernelArg bgra_to_yuv_kernel 2");
-
-    err = clSetKernelArg(bgra_to_yuv_kernel, 3, sizeof(height), &height);
-    ocl::check(err, "setKernelArg bgra_to_yuv_kernel 3");
-
-    cl_event bgra_to_yuv_evt;
-    err = clEnqueueNDRangeKernel(queue, bgra_to_yuv_kernel,
-        1, // numero dimensioni
-        NULL, // offset
-        gws, // global work size
-        NULL, // local work size
-        0, // numero di elementi nella waiting list
-        NULL, // waiting list
-        &bgra_to_yuv_evt); // evento di questo comando
-    ocl::check(err, "Enqueue vecinit");
-
-    return bgra_to_yuv_evt;
+    const size_t frame_size = static_cast<size_t>(width) * height * 4; // BGRA RGB32 in, RGBA out
+    if (loop.pipeline_depth > 0) {
+        // decode, compute and encode run on their own threads, overlapping each other
+        // the decoder writes straight into the recycled frames, the only copy left is the upload to the device
+        // the backend keeps several frames in flight, the compute thread only waits for the oldest once the backend is full
+        // the pipeline is deepened to hold every frame the backend takes, as in_flight stays below the depth a shallower
+        // pipeline would complete the oldest frame, and launch its batch, before the batch is full
+        // the deepening stops at about 1 GiB of host frames (an input and an output per frame), the batches are then launched early
+        const size_t max_depth = std::max(static_cast<size_t>(loop.pipeline_depth), (static_cast<size_t>(1) << 30) / (2 * frame_size));
+        const size_t depth = std::min(std::max(static_cast<size_t>(loop.pipeline_depth), processor.max_in_flight() + 1), max_depth);
+        if (depth < processor.max_in_flight() + 1) {
+            LOG_WARNING("The pipeline is limited to " << depth << " frames of host memory, the batches of the device are launched before they are full");
+        } else if (depth > static_cast<size_t>(loop.pipeline_depth)) {
+            LOG_INFO("Pipeline deepened to " << depth << " frames to fill the batches of the device");
+        }
+        FramePipeline pipeline(depth, frame_size, frame_size);
+        processed_frames = pipeline.run(
+            [&](PipelineFrame& frame) { return video.read_next_frame(frame.input.data()); },
+            [&](PipelineFrame& frame) {
+                StageTimer timer(loop.stats, "process");
+                processor.submit(frame.input.data(), frame.output.data());
+            },
+            [&](PipelineFrame&) {
+                StageTimer timer(loop.stats, "process_wait");
+                processor.complete();
+            },
+            processor.max_in_flight(),
+            [&](PipelineFrame& frame) { videoOutput.write_frame(frame.output.data()); });
+        LOG_INFO("Pipelined processing done, frames: " << processed_frames);
+    } else if (processor.max_in_flight() > 1) {
+        // a ring of frames: the next frames are decoded while the device works on the previous ones,
+        // and the oldest one is only waited for when it is handed to the encoder
+        // the frames are decoded straight into the mapped device buffers when the backend exposes them, host frames are the fallback
+        const size_t in_flight = processor.max_in_flight();
+        std::vector<std::vector<uint8_t>> inputs(in_flight);
+        std::vector<std::vector<uint8_t>> outputs(in_flight, std::vector<uint8_t>(frame_size));
+        int64_t submitted = 0;
+        auto write_oldest = [&]() {
+            {
+                StageTimer timer(loop.stats, "process_wait");
+                processor.complete();
+            }
+            videoOutput.write_frame(outputs[processed_frames % in_flight].data());
+            processed_frames++;
+        };
+        while (true) {
+            if (submitted - processed_frames == static_cast<int64_t>(in_flight)) {
+                write_oldest();
+            }
+            const size_t slot = submitted % in_flight;
+            uint8_t* mapped = processor.map_submit_input();
+            if (!mapped) {
+                inputs[slot].resize(frame_size);
+            }
+            if (!video.read_next_frame(mapped ? mapped : inputs[slot].data())) {
+                // the end of the stream is only known after mapping, the partial batch must not run on a mapped buffer
+                processor.cancel_mapped_input();
+                break;
+            }
+            {
+                StageTimer timer(loop.stats, "process");
+                if (mapped) {
+                    processor.submit_mapped(outputs[slot].data());
+                } else {
+                    processor.submit(inputs[slot].data(), outputs[slot].data());
+                }
+            }
+            submitted++;
+        }
+        while (processed_frames < submitted) {
+            write_oldest();
+        }
+    } else {
+        std::vector<uint8_t> frame_data_output(frame_size); // RGBA
+        // the frames are decoded straight into the memory of the backend, a mapped device buffer for OpenCL
+        while(video.read_next_frame(processor.map_input())) {
+            // process the frame data
+            {
+                StageTimer timer(loop.stats, "process");
+                processor.process_mapped(frame_data_output.data());
+            }
+            // write the frame to the output file
+            videoOutput.write_frame(frame_data_output.data());
+            processed_frames++;
+        }
+    }
+    return processed_frames;
 }
 
-cl_event brga_to_rgba(cl_command_queue queue, cl_kernel bgra_to_rgba_kernel, cl_int width, cl_int height, size_t lws_in,
-    cl_mem input_image_buffer, cl_mem output_image_buffer)
-{
-    uint nels = width * height;
-    const size_t gws[] = { ocl::round_mul_up(nels, lws_in) };
-
-    printf("number of elements %d round to %zu GWS %zu\n", nels, lws_in, gws[0]); // vecinit not used since we are not using a local work size
-
-    cl_int err = clSetKernelArg(bgra_to_rgba_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
-    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 0");
-
-    err = clSetKernelArg(bgra_to_rgba_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
-    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 1");
-
-    err = clSetKernelArg(bgra_to_rgba_kernel, 2, sizeof(width), &width);
-    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 2");
-
-    err = clSetKernelArg(bgra_to_rgba_kernel, 3, sizeof(height), &height);
-    ocl::check(err, "setKernelArg bgra_to_rgba_kernel 3");
-
-    cl_event bgra_to_rgba_evt;
-    err = clEnqueueNDRangeKernel(queue, bgra_to_rgba_kernel,
-        1, // numero dimensioni
-        NULL, // offset
-        gws, // global work size
-        NULL, // local work size
-        0, // numero di elementi nella waiting list
-        NULL, // waiting list
-        &bgra_to_rgba_evt); // evento di questo comando
-    ocl::check(err, "Enqueue vecinit");
-
-    return bgra_to_rgba_evt;
+/**
+ * @brief Prints the percentiles of every stage and writes the requested dumps.
+ * @param stats The collected timings.
+ * @param csv_file The file receiving every sample as CSV, empty for none.
+ * @param json_file The file receiving the percentiles and every sample as JSON, empty for none.
+ * @param out The stream receiving the percentiles, stderr when stdout carries the frames.
+ * @return Whether the dumps were written.
+ */
+bool report_stats(const FrameStats& stats, const std::string& csv_file, const std::string& json_file, std::ostream& out = std::cout) {
+    out << "Stage timings (host wall time, device time for the device_ stages):\n";
+    stats.print(out);
+    try {
+        if (!csv_file.empty()) {
+            stats.write_csv(csv_file);
+        }
+        if (!json_file.empty()) {
+            stats.write_json(json_file);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+    return true;
 }
 
-cl_event rgba_to_grayscale(cl_command_queue queue, cl_kernel rgba_to_grayscale_kernel, cl_int width, cl_int height, size_t lws_in,
-    cl_mem input_image_buffer, cl_mem output_image_buffer)
-{
-    const size_t gws[] = { ocl::round_mul_up(width, lws_in), ocl::round_mul_up(height, lws_in) };
-    printf("number of elements %d round to %zu GWS %zu\n", width * height, lws_in, gws[0]); 
-    cl_int err = clSetKernelArg(rgba_to_grayscale_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
-    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 0");
-    err = clSetKernelArg(rgba_to_grayscale_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
-    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 1");
-    err = clSetKernelArg(rgba_to_grayscale_kernel, 2, sizeof(width), &width);
-    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 2");
-    err = clSetKernelArg(rgba_to_grayscale_kernel, 3, sizeof(height), &height);
-    ocl::check(err, "setKernelArg rgba_to_grayscale_kernel 3");
-    cl_event rgba_to_grayscale_evt;
-    err = clEnqueueNDRangeKernel(queue, rgba_to_grayscale_kernel,
-        2, // numero dimensioni
-        NULL, // offset
-        gws, // global work size
-        NULL, // local work size
-        0, // numero di elementi nella waiting list
-        NULL, // waiting list
-        &rgba_to_grayscale_evt); // evento di questo comando
-    ocl::check(err, "Enqueue rgba_to_grayscale");
-    return rgba_to_grayscale_evt;
+/**
+ * @brief Applies the --log-level option.
+ * @param name The level name.
+ * @return Whether the name is valid, an error is printed otherwise.
+ */
+bool apply_log_level(const std::string& name) {
+    logging::Level level;
+    if (!logging::parse_level(name, level)) {
+        std::cerr << "Invalid log level: " << name << ", expected debug, info, warning, error or quiet.\n";
+        return false;
+    }
+    logging::set_level(level);
+    return true;
 }
 
-cl_event uniform_quantize(cl_command_queue queue, cl_kernel uniform_quantize_kernel, cl_int width, cl_int height, size_t lws_in,
-    cl_mem input_image_buffer, cl_mem output_image_buffer, int levels)
-{
-    const size_t gws[] = { ocl::round_mul_up(width, lws_in), ocl::round_mul_up(height, lws_in) };
-    printf("number of elements %d round to %zu GWS %zu\n", width * height, lws_in, gws[0]); 
-    cl_int err = clSetKernelArg(uniform_quantize_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
-    ocl::check(err, "setKernelArg uniform_quantize_kernel 0");
-    err = clSetKernelArg(uniform_quantize_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
-    ocl::check(err, "setKernelArg uniform_quantize_kernel 1");
-    err = clSetKernelArg(uniform_quantize_kernel, 2, sizeof(width), &width);
-    ocl::check(err, "setKernelArg uniform_quantize_kernel 2");
-    err = clSetKernelArg(uniform_quantize_kernel, 3, sizeof(height), &height);
-    ocl::check(err, "setKernelArg uniform_quantize_kernel 3");
-    err = clSetKernelArg(uniform_quantize_kernel, 4, sizeof(levels), &levels);
-    ocl::check(err, "setKernelArg uniform_quantize_kernel 4");
-    cl_event uniform_quantize_evt;
-    err = clEnqueueNDRangeKernel(queue, uniform_quantize_kernel,
-        2, // numero dimensioni
-        NULL, // offset
-        gws, // global work size
-        NULL, // local work size
-        0, // numero di elementi nella waiting list
-        NULL, // waiting list
-        &uniform_quantize_evt); // evento di questo comando
-    ocl::check(err, "Enqueue uniform_quantize");
-    return uniform_quantize_evt;
-}
+/**
+ * @brief The merge subcommand: stitches the segments of the shard manifests into the final output.
+ * @param argc The arguments after "merge", the first one being the name of the subcommand.
+ * @param argv The arguments.
+ * @return The exit code of the program.
+ */
+int merge_shards(int argc, char** argv) {
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options of merge");
+    std::vector<std::string> manifest_files;
+    std::string log_level;
+    bool keep_segments = false;
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("manifest,m", po::value<std::vector<std::string>>(&manifest_files)->composing(), "manifest written by a --shard run, one per shard")
+        ("keep-segments", po::bool_switch(&keep_segments)->default_value(false), "keep the segment files and the manifests after merging")
+        ("log-level", po::value<std::string>(&log_level)->default_value("info"), "lowest severity logged to stderr: debug, info, warning, error or quiet")
+        ("output,o", po::value<std::string>(), "output video file name");
+    po::positional_options_description positional;
+    positional.add("manifest", -1);
 
-cl_event quantize_binarize(cl_command_queue queue, cl_kernel uniform_quantize_kernel, cl_int width, cl_int height, size_t lws_in,
-    cl_mem input_image_buffer, cl_mem output_image_buffer)
-{
-    const size_t gws[] = { ocl::round_mul_up(width, lws_in), ocl::round_mul_up(height, lws_in) };
-    printf("number of elements %d round to %zu GWS %zu\n", width * height, lws_in, gws[0]); 
-    cl_int err = clSetKernelArg(uniform_quantize_kernel, 0, sizeof(input_image_buffer), &input_image_buffer);
-    ocl::check(err, "setKernelArg binarize 0");
-    err = clSetKernelArg(uniform_quantize_kernel, 1, sizeof(output_image_buffer), &output_image_buffer);
-    ocl::check(err, "setKernelArg binarize 1");
-    err = clSetKernelArg(uniform_quantize_kernel, 2, sizeof(width), &width);
-    ocl::check(err, "setKernelArg binarize 2");
-    err = clSetKernelArg(uniform_quantize_kernel, 3, sizeof(height), &height);
-    ocl::check(err, "setKernelArg binarize 3");
-    cl_event uniform_quantize_evt;
-    err = clEnqueueNDRangeKernel(queue, uniform_quantize_kernel,
-        2, // numero dimensioni
-        NULL, // offset
-        gws, // global work size
-        NULL, // local work size
-        0, // numero di elementi nella waiting list
-        NULL, // waiting list
-        &uniform_quantize_evt); // evento di questo comando
-    ocl::check(err, "Enqueue uniform_quantize");
-    return uniform_quantize_evt;
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+    if (!apply_log_level(log_level)) {
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << "Usage: video-color-quantizer merge -o output manifest...\n" << desc << "\n";
+        return 0;
+    }
+    if (!vm.count("output") || manifest_files.empty()) {
+        std::cerr << "The merge needs an output file and the manifests of all the shards.\n";
+        return 1;
+    }
+    const std::string output_file = vm["output"].as<std::string>();
+    try {
+        std::vector<SegmentManifest> manifests;
+        for (const std::string& manifest_file : manifest_files) {
+            manifests.push_back(read_manifest(manifest_file));
+        }
+        const std::vector<SegmentFile> files = validate_manifests(manifests);
+        int64_t total_frames = 0;
+        for (const SegmentFile& file : files) {
+            total_frames += file.frames;
+        }
+        concat_segments(files, output_file, manifests.front().fps);
+        if (!keep_segments) {
+            for (const SegmentFile& file : files) {
+                std::remove(file.path.c_str());
+            }
+            for (const std::string& manifest_file : manifest_files) {
+                std::remove(manifest_file.c_str());
+            }
+        }
+        LOG_INFO("Merged " << files.size() << " segments of " << manifests.front().shard_count << " shards, frames: " << total_frames);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
 }
 
-
-
 int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "merge") {
+        return merge_shards(argc - 1, argv + 1);
+    }
     // Initialize the program options
     namespace po = boost::program_options;
     po::options_description desc("Allowed options");
-    std::string input_file, output_file;
-    bool binarize = false, grayscale = false;
+    std::string input_file, output_file, backend, rounding, colorspace, lut_file, dither, preset, bitrate, pix_fmt, shard,
+        stats_csv, stats_json, log_level, kernel_file, program_cache, devices, partition, batch_frames, stream;
+    std::vector<std::string> encoder_option_list;
+    size_t cpu_threads = 0;
+    int decode_threads = 0, encode_threads = 0, workers = 1, device_frames = 2, segment_count = 0, speed = -1, crf = -1, gop_size = 12;
+    int kmeans_iterations = 3, palette_interval = 0, stream_width = 0, stream_height = 0;
+    double scene_threshold = 0.2;
+    bool binarize = false, grayscale = false, unfused = false, device_yuv = false, generic_kernels = false, use_lut = false, brute_force_palette = false,
+        no_row_mt = false, keep_segments = false, collect_stats = false;
     // Add options
     desc.add_options()
         ("help,h", "produce help message")
@@ -237,24 +323,98 @@ int main(int argc, char** argv) {
         ("levels,l", po::value<int>(), "number of levels for quantization")
         ("binarize", po::bool_switch(&binarize)->default_value(false), "binarize the image, making the levels of the quantization 0 and 1 for every channel, meaning that the value will be either 0 or 255")
         ("grayscale", po::bool_switch(&grayscale)->default_value(false), "convert to grayscale using the luminosity method")
+        ("rounding", po::value<std::string>(&rounding)->default_value("nearest"), "how the channels are rounded to the levels: nearest, lower or upper")
+        ("dither", po::value<std::string>(&dither)->default_value("none"), "dithering of the nearest or binary quantization: none, bayer (8x8 ordered), blue-noise (16x16 ordered) or error-diffusion (Floyd-Steinberg within 64x32 tiles), all of them stable across frames of a static scene")
+        ("backend", po::value<std::string>(&backend)->default_value("opencl"), "processing backend: opencl, or cpu for the native SIMD implementation that does not need an OpenCL device")
+        ("cpu-threads", po::value<size_t>(&cpu_threads)->default_value(0), "number of threads of the cpu backend, 0 shares the cores with the decoder")
+        ("decode-threads", po::value<int>(&decode_threads)->default_value(0), "number of frame and slice decoding threads, 0 shares the cores with the backend (all but one core with opencl, a third of them with cpu)")
+        ("unfused", po::bool_switch(&unfused)->default_value(false), "run the channel swap, grayscale and quantization as separate kernels instead of the fused single-pass kernel, useful for validation")
+        ("palette", po::value<int>(), "map every frame to an adaptive palette of this many colors (2-256) built with median cut and k-means, instead of the per-channel levels")
+        ("kmeans-iterations", po::value<int>(&kmeans_iterations)->default_value(3), "number of k-means iterations refining the median cut palette")
+        ("palette-interval", po::value<int>(&palette_interval)->default_value(0), "largest number of frames sharing a palette before it is refined with k-means, 0 for no limit")
+        ("brute-force-palette", po::bool_switch(&brute_force_palette)->default_value(false), "search the whole palette for every pixel instead of the candidates of its cell of the 32x32x32 palette cube, useful for validation")
+        ("scene-threshold", po::value<double>(&scene_threshold)->default_value(0.2), "color signature distance (0-1) from the frame the palette was built from that starts a new scene and a new palette, 0 disables the detection and refreshes the palette every --palette-interval frames instead (every frame by default)")
+        ("lut", po::bool_switch(&use_lut)->default_value(false), "apply the quantization through a 256-entry lookup table instead of computing it")
+        ("gamma", po::value<double>(), "space the levels evenly in linear light with this gamma (e.g. 2.2) instead of in the encoded values, implies --lut")
+        ("lut-file", po::value<std::string>(&lut_file), "apply a custom curve read from a file of 256 (all channels) or 768 (R, G, B) values between 0 and 255, instead of the quantization")
+        ("generic-kernels", po::bool_switch(&generic_kernels)->default_value(false), "pass the levels to the OpenCL kernels at runtime instead of building a variant specialized for them")
+        ("kernel-file", po::value<std::string>(&kernel_file), "build the OpenCL kernels from this file instead of the ones embedded in the executable")
+        ("program-cache", po::value<std::string>(&program_cache)->default_value(ProgramBinaryCache::default_directory()), "directory of the compiled OpenCL programs reused by later runs (default $VCQ_PROGRAM_CACHE or ~/.cache/video-color-quantizer), none to always build from source")
+        ("colorspace", po::value<std::string>(&colorspace)->default_value("rgb"), "color space of the quantization: rgb, or yuv to posterize the decoded Y/U/V planes directly without any RGB conversion")
+        ("luma-levels", po::value<int>(), "number of levels of the Y plane with --colorspace yuv (default --levels)")
+        ("chroma-levels", po::value<int>(), "number of levels of the U and V planes with --colorspace yuv (default --levels)")
+        ("device-yuv", po::bool_switch(&device_yuv)->default_value(false), "hand the decoded YUV 4:2:0 planes to the backend and encode its YUV 4:2:0 output, skipping the swscale conversions on the host")
+        ("workers", po::value<int>(&workers)->default_value(1), "split the video into this many keyframe-aligned segments processed in parallel, each with its own decoder, backend and encoder, and concatenate them losslessly")
+        ("keep-segments", po::bool_switch(&keep_segments)->default_value(false), "keep the encoded segment files of --workers next to the output")
+        ("shard", po::value<std::string>(&shard), "i/N: encode only the i-th of N shares (0-based) of the segments, keep them next to the output with a manifest, and leave the final output to the merge subcommand")
+        ("segments", po::value<int>(&segment_count)->default_value(0), "number of keyframe-aligned segments the video is split into, it must be the same for all the shards, 0 for --workers segments per shard")
+        ("pipeline", po::value<int>()->implicit_value(4), "run decoding, processing and encoding on separate threads, optionally with the number of frames in flight (default 4)")
+        ("devices", po::value<std::string>(&devices), "spread the frames over several OpenCL devices: all, or a list of device indices optionally prefixed by their platform index (e.g. 0,1 or 0:0,1:0)")
+        ("partition", po::value<std::string>(&partition)->default_value("none"), "split every device into sub-devices scheduled as separate devices: none, numa (one per NUMA node) or equally:<compute units>")
+        ("device-frames", po::value<int>(&device_frames)->default_value(2), "batches of frames on the OpenCL device at once, each with its own buffers, so that uploads and readbacks overlap the kernels (1 to wait for every batch)")
+        ("batch-frames", po::value<std::string>(&batch_frames)->default_value("auto"), "frames processed by a single OpenCL kernel launch, packed in one buffer: auto to batch small resolutions only (up to 16 frames at 320x180 and below, none from 720p up), or a number, lowered to what the device memory holds")
+        ("pix-fmt", po::value<std::string>(&pix_fmt), "pixel format of the encoded video: yuv444p (default for RGB processing) or yuv420p (default and only choice with --device-yuv and --colorspace yuv), 4:2:0 encodes much faster")
+        ("preset", po::value<std::string>(&preset), "encoder speed preset: libx264 preset (ultrafast ... veryslow) for .mp4, libvpx deadline (realtime, good, best) for .webm")
+        ("speed", po::value<int>(&speed)->default_value(-1), "libvpx cpu-used (0 slowest to 8 fastest) for .webm, -1 for the encoder default")
+        ("crf", po::value<int>(&crf)->default_value(-1), "constant rate factor of the encoder, lower is better quality, -1 for the encoder default")
+        ("bitrate", po::value<std::string>(&bitrate), "target bitrate in bits per second, with an optional k or M suffix (e.g. 4M), instead of constant quality")
+        ("gop", po::value<int>(&gop_size)->default_value(12), "distance between keyframes")
+        ("encode-threads", po::value<int>(&encode_threads)->default_value(0), "number of encoder threads, 0 shares the cores with the decoder and the backend")
+        ("no-row-mt", po::bool_switch(&no_row_mt)->default_value(false), "disable the row-based multithreading of the VP9 encoder")
+        ("encoder-option", po::value<std::vector<std::string>>(&encoder_option_list)->composing(), "further key=value option passed to the encoder as it is, can be repeated (e.g. tune=animation)")
+        ("stats", po::bool_switch(&collect_stats)->default_value(false), "record the host time of decoding, conversions, processing and encoding and the device time of every kernel and transfer for every frame, and print their p50/p95/p99/max at the end")
+        ("stats-csv", po::value<std::string>(&stats_csv), "write every sample of --stats as CSV to this file, implies --stats")
+        ("stats-json", po::value<std::string>(&stats_json), "write the percentiles and every sample of --stats as JSON to this file, implies --stats")
+        ("log-level", po::value<std::string>(&log_level)->default_value("info"), "lowest severity logged to stderr: debug, info, warning, error or quiet, debug messages need a build with VCQ_DEBUG_LOG")
+        ("stream", po::value<std::string>(&stream), "read and write uncompressed frames instead of encoded videos, to run between two tools: y4m, rgba, bgra or yuv420p, the input and the output default to stdin and stdout")
+        ("width", po::value<int>(&stream_width)->default_value(0), "width of the frames of a headerless --stream")
+        ("height", po::value<int>(&stream_height)->default_value(0), "height of the frames of a headerless --stream")
         ("output,o", po::value<std::string>(), "output video file name");
     
     // Parse the command line arguments
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
+    if (!apply_log_level(log_level)) {
+        return 1;
+    }
     // Check if help is requested
     if (vm.count("help")) {
         std::cout << desc << "\n";
         return 0;
     }
+    // Check the raw stream, whose frames come from a pipe rather than a file
+    RawFormat stream_format = RAW_Y4M;
+    if (!stream.empty()) {
+        if (!parse_raw_format(stream, stream_format)) {
+            std::cerr << "Unknown stream format: " << stream << ", expected y4m, rgba, bgra or yuv420p.\n";
+            return 1;
+        }
+        if (stream_format != RAW_Y4M && (stream_width <= 0 || stream_height <= 0)) {
+            std::cerr << "--stream " << stream << " needs the frame size in --width and --height.\n";
+            return 1;
+        }
+        if (!is_planar_format(stream_format) && colorspace != "rgb") {
+            std::cerr << "--colorspace yuv needs a y4m or yuv420p stream.\n";
+            return 1;
+        }
+        if (workers > 1 || !shard.empty() || segment_count > 0) {
+            std::cerr << "A stream only goes forward and cannot be split, drop --workers, --shard and --segments.\n";
+            return 1;
+        }
+        // the 4:2:0 streams go through the planar paths, with the same restrictions as --device-yuv
+        device_yuv = is_planar_format(stream_format);
+    }
     // Check if input file is provided
-    if (vm.count("input")) {
-        input_file = vm["input"].as<std::string>();
-        std::cout << "Input file: " << input_file << std::endl;
-        // Check if the input file exists
-        std::ifstream file(input_file);
-        if (!file) {
+    if (vm.count("input") || !stream.empty()) {
+        input_file = vm.count("input") ? vm["input"].as<std::string>() : "-";
+        LOG_INFO("Input file: " << input_file);
+        // Check if the input file exists, a stream may come from a FIFO that must only be opened once
+        std::ifstream file;
+        if (stream.empty()) {
+            file.open(input_file);
+        }
+        if (stream.empty() && !file) {
             std::cerr << "Input file does not exist: " << input_file << "\n";
             return 1;
         }
@@ -263,9 +423,9 @@ int main(int argc, char** argv) {
         return 1;
     }
     // Check if output file is provided
-    if (vm.count("output")) {
-        output_file = vm["output"].as<std::string>();
-        std::cout << "Output file: " << output_file << "\n";
+    if (vm.count("output") || !stream.empty()) {
+        output_file = vm.count("output") ? vm["output"].as<std::string>() : "-";
+        LOG_INFO("Output file: " << output_file);
     } else {
         std::cerr << "No output file provided.\n";
         return 1;
@@ -280,117 +440,370 @@ int main(int argc, char** argv) {
             std::cerr << "The number of levels for quantization must be between 2 and 256.\n";
             return 1;
         }
-        std::cout << "Levels for quantization: " << levels << "\n";
+        LOG_INFO("Levels for quantization: " << levels);
     } else {
         // if the levels are not provided, see if the binarize option is set
         if (binarize) {
             levels = 2;
-            std::cout << "Binarization selected, setting levels to 2.\n";
+            LOG_INFO("Binarization selected, setting levels to 2.");
+        } else if (vm.count("palette")) {
+            // the palette replaces the per-channel levels
+            levels = 2;
         } else {
             std::cerr << "No levels for quantization provided.\n";
             return 1;
         }
     }
 
-    // Select the OpenCL platform
-    cl_platform_id platform = ocl::select_platform();
-    // Select the OpenCL device
-    cl_device_id device = ocl::select_device(platform);
-    // Create the OpenCL context
-    cl_context context = ocl::create_context(platform, device);
-    // Create the command queue
-    cl_command_queue queue = ocl::create_queue(context, device);
-    // Create the OpenCL program
-    cl_program program = ocl::create_program("src/kernels/uniformQuantization.cl", context, device);
+    // Check the adaptive palette options
+    int palette_size = 0;
+    if (vm.count("palette")) {
+        palette_size = vm["palette"].as<int>();
+        if (palette_size < 2 || palette_size > 256) {
+            std::cerr << "The number of palette colors must be between 2 and 256.\n";
+            return 1;
+        }
+        if (kmeans_iterations < 0 || palette_interval < 0 || scene_threshold < 0.0 || scene_threshold > 1.0) {
+            std::cerr << "The k-means iterations and the palette interval must not be negative, the scene threshold must be between 0 and 1.\n";
+            return 1;
+        }
+        if (grayscale || binarize || use_lut || vm.count("gamma") || !lut_file.empty() || device_yuv || colorspace != "rgb") {
+            std::cerr << "--palette cannot be combined with --grayscale, --binarize, the lookup tables or the YUV modes.\n";
+            return 1;
+        }
+        LOG_INFO("Adaptive palette of " << palette_size << " colors, " << kmeans_iterations
+            << " k-means iterations, scene threshold " << scene_threshold);
+    }
 
-    cl_int err;
+    // Check the dithering, it replaces the rounding of the per-channel quantization
+    DitherMethod dither_method = DITHER_NONE;
+    if (dither == "bayer") {
+        dither_method = DITHER_BAYER;
+    } else if (dither == "blue-noise") {
+        dither_method = DITHER_BLUE_NOISE;
+    } else if (dither == "error-diffusion") {
+        dither_method = DITHER_ERROR_DIFFUSION;
+    } else if (dither != "none") {
+        std::cerr << "Unknown dither: " << dither << ", expected none, bayer, blue-noise or error-diffusion.\n";
+        return 1;
+    }
+    if (dither_method != DITHER_NONE) {
+        if ((!binarize && rounding != "nearest") || unfused || palette_size > 0 || use_lut || vm.count("gamma")
+            || !lut_file.empty() || device_yuv || colorspace != "rgb") {
+            std::cerr << "--dither needs the nearest rounding or --binarize, and cannot be combined with --unfused, --palette, the lookup tables or the YUV modes.\n";
+            return 1;
+        }
+        LOG_INFO("Dithering: " << dither);
+    }
 
-    // get information on the preferred work group size
-    size_t lws_in = 0;
+    // Check if the pipelined mode is requested
+    int pipeline_depth = 0;
+    if (vm.count("pipeline")) {
+        pipeline_depth = vm["pipeline"].as<int>();
+        if (pipeline_depth < 3) {
+            std::cerr << "The number of frames in flight for the pipeline must be at least 3.\n";
+            return 1;
+        }
+        LOG_INFO("Pipelined mode with " << pipeline_depth << " frames in flight");
+    }
+    const bool multi_device = !devices.empty() || partition != "none";
+    if (multi_device && backend != "opencl") {
+        std::cerr << "--devices and --partition need the OpenCL backend.\n";
+        return 1;
+    }
+    if (multi_device && vm.count("palette")) {
+        std::cerr << "The adaptive palette follows the scenes frame by frame and runs on a single device, drop --devices and --partition.\n";
+        return 1;
+    }
+    if (device_frames < 1) {
+        std::cerr << "The number of frames on the device must be at least 1.\n";
+        return 1;
+    }
+    size_t batch_frame_count = 0;
+    if (batch_frames != "auto") {
+        if (batch_frames.empty() || batch_frames.size() > 3 || batch_frames.find_first_not_of("0123456789") != std::string::npos
+            || std::stoul(batch_frames) < 1 || std::stoul(batch_frames) > 256) {
+            std::cerr << "The number of frames per batch must be auto or between 1 and 256.\n";
+            return 1;
+        }
+        batch_frame_count = std::stoul(batch_frames);
+    }
 
-    // testing the reading of the video
-    VideoReaderFFMPEG video(input_file);
-    std::vector<uint8_t> frame_data(video.get_width() * video.get_height() * 4); // BGRA RGB32
-    // std::vector<uint8_t> frame_data(video.get_width() * video.get_height() * 3); // YUV444P
-    // get first frame for testing
-    // if(video.read_next_frame(frame_data)) {
-    //     std::cout << "Read first frame of size: " << frame_data.size() << "\n";
-    // } else {
-    //     std::cerr << "Failed to read first frame.\n";
-    //     return 1;
-    // }
-    // start working on the video frames
-    // create the kernel for the conversion
-    // cl_kernel bgra_to_yuv_kernel = clCreateKernel(program2, "bgra_to_yuv", &err);
-    // ocl::check(err, "Creating kernel bgra_to_yuv");
-    // // get information on the preferred work group size
-    // size_t lws_in = 0;
-    // err = clGetKernelWorkGroupInfo(bgra_to_yuv_kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
-    //     sizeof(lws_in), &lws_in, nullptr);  // TODO also change from parameters in the future
-    // ocl::check(err, "Getting preferred work group size");
-    // // create the kernel for the conversion
-    cl_kernel bgra_to_rgba_kernel = clCreateKernel(program, "brga_to_rgba", &err);
-    ocl::check(err, "Creating kernel bgra_to_rgba");
-    std::vector<uint8_t> frame_data_output(video.get_width() * video.get_height() * 4); // RGBA
-    cl_kernel quantization_kernel;
+    // Check the color space and the per-plane levels
+    if (colorspace != "rgb" && colorspace != "yuv") {
+        std::cerr << "Unknown colorspace: " << colorspace << ", expected rgb or yuv.\n";
+        return 1;
+    }
+    int luma_levels = vm.count("luma-levels") ? vm["luma-levels"].as<int>() : levels;
+    int chroma_levels = vm.count("chroma-levels") ? vm["chroma-levels"].as<int>() : levels;
+    if (luma_levels < 2 || luma_levels > 256 || chroma_levels < 2 || chroma_levels > 256) {
+        std::cerr << "The number of levels of every plane must be between 2 and 256.\n";
+        return 1;
+    }
+    if (colorspace == "yuv") {
+        LOG_INFO("YUV quantization with " << luma_levels << " luma levels and " << chroma_levels << " chroma levels");
+    }
+
+    // Collect the operations applied to every frame
+    QuantizationSettings settings;
+    settings.levels = levels;
+    settings.luma_levels = luma_levels;
+    settings.chroma_levels = chroma_levels;
+    settings.grayscale = grayscale;
+    settings.dither = dither_method;
+    settings.fused = !unfused;
+    settings.specialize = !generic_kernels;
+    settings.palette_size = palette_size;
+    settings.kmeans_iterations = kmeans_iterations;
+    settings.palette_interval = palette_interval;
+    settings.scene_threshold = scene_threshold;
+    settings.palette_cube = !brute_force_palette;
     if (binarize) {
-        quantization_kernel = clCreateKernel(program, "uniform_quantize_binary_bitshift", &err);
-        ocl::check(err, "Creating kernel quantize_binarize");
+        settings.mode = QUANTIZE_BINARY;
+    } else if (rounding == "nearest") {
+        settings.mode = QUANTIZE_NEAREST;
+    } else if (rounding == "lower") {
+        settings.mode = QUANTIZE_LOWER_BOUND;
+    } else if (rounding == "upper") {
+        settings.mode = QUANTIZE_UPPER_BOUND;
     } else {
-        quantization_kernel = clCreateKernel(program, "uniform_quantize_nearest", &err);
-        ocl::check(err, "Creating kernel uniform_quantize");
-    }
-    cl_kernel grayscale_kernel = clCreateKernel(program, "rgb_to_grayscale", &err);
-    ocl::check(err, "Creating kernel grayscale");
-    // get information on the preferred work group size
-    err = clGetKernelWorkGroupInfo(quantization_kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
-        sizeof(lws_in), &lws_in, nullptr);  // TODO also change from parameters in the future
-    ocl::check(err, "Getting preferred work group size");
+        std::cerr << "Unknown rounding: " << rounding << ", expected nearest, lower or upper.\n";
+        return 1;
+    }
 
-    VideoWriterFFMPEG videoOutput(output_file, video.get_width(), video.get_height(), video.get_fps());
-    while(video.read_next_frame(frame_data)) {
-        // process the frame data
-        // convert the BRGA to RGBA, since the conversion in FFMPEG has some problems
-        cl_mem input_image_buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-            frame_data.size(), frame_data.data(), &err);
-        ocl::check(err, "Creating buffer for input image");
-        // create the buffer for the output image
-        cl_mem output_image_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY,
-            frame_data.size(), nullptr, &err);
-        ocl::check(err, "Creating buffer for output image");
-        // create the event
-        cl_event bgra_to_rgba_evt = brga_to_rgba(queue, bgra_to_rgba_kernel,
-            video.get_width(), video.get_height(), lws_in, input_image_buffer, output_image_buffer);
-        // wait for the event to complete
-        clWaitForEvents(1, &bgra_to_rgba_evt);
-        // grayscale the image if needed
-        if (grayscale) {
-            cl_event grayscale_evt = rgba_to_grayscale(queue, grayscale_kernel,
-                video.get_width(), video.get_height(), lws_in, output_image_buffer, input_image_buffer);
-            // wait for the event to complete
-            clWaitForEvents(1, &grayscale_evt);
-            // swap the buffers
-            std::swap(input_image_buffer, output_image_buffer);
-        }
-        // quantize the image depending on input parameters
-        // the input parameters will establish which kernel to use and the number of levels in case of quantization with more than 2 levels
-        cl_event quantize_evt = uniform_quantize(queue, quantization_kernel,
-            video.get_width(), video.get_height(), lws_in, output_image_buffer, input_image_buffer, levels);
-        // wait for the event to complete
-        clWaitForEvents(1, &quantize_evt);
-        // read the output image
-        err = clEnqueueReadBuffer(queue, input_image_buffer, CL_TRUE, 0,
-            frame_data_output.size(), frame_data_output.data(), 0, nullptr, nullptr);
-        ocl::check(err, "Reading output image");
-        // free the buffers
-        clReleaseMemObject(input_image_buffer);
-        clReleaseMemObject(output_image_buffer);
-        // free the event
-        clReleaseEvent(bgra_to_rgba_evt);
-        // write the frame to the output file
-        videoOutput.write_frame(frame_data_output.data());
+    // Build the lookup table replacing the quantization, if any
+    if (!lut_file.empty()) {
+        try {
+            settings.lut = lut::load(lut_file);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        LOG_INFO("Lookup table loaded from " << lut_file);
+    } else if (vm.count("gamma")) {
+        const double gamma = vm["gamma"].as<double>();
+        if (gamma <= 0.0) {
+            std::cerr << "The gamma must be positive.\n";
+            return 1;
+        }
+        settings.lut = lut::build_gamma(settings, gamma);
+        LOG_INFO("Gamma-aware levels with gamma " << gamma);
+    } else if (use_lut) {
+        settings.lut = lut::build_uniform(settings);
     }
-    
 
-    return 0;
-}
\ No newline at end of file
+    // Share the cores between the decoder, the backend and the encoder, so that they do not oversubscribe them
+    if (decode_threads < 0 || encode_threads < 0) {
+        std::cerr << "The number of decoding and encoding threads must not be negative.\n";
+        return 1;
+    }
+    if (backend != "opencl" && backend != "cpu") {
+        std::cerr << "Unknown backend: " << backend << ", expected cpu or opencl.\n";
+        return 1;
+    }
+    if (workers < 1) {
+        std::cerr << "The number of workers must be at least 1.\n";
+        return 1;
+    }
+    int shard_index = 0, shard_count = 1;
+    if (!shard.empty()) {
+        char separator = 0;
+        std::istringstream shard_stream(shard);
+        if (!(shard_stream >> shard_index >> separator >> shard_count) || separator != '/' || !shard_stream.eof()
+            || shard_count < 1 || shard_index < 0 || shard_index >= shard_count) {
+            std::cerr << "Invalid shard: " << shard << ", expected i/N with 0 <= i < N.\n";
+            return 1;
+        }
+    }
+    if (segment_count < 0) {
+        std::cerr << "The number of segments must not be negative.\n";
+        return 1;
+    }
+    if (segment_count > 0 && workers == 1 && shard.empty()) {
+        std::cerr << "--segments only applies to segmented processing, add --workers or --shard.\n";
+        return 1;
+    }
+    if (segment_count == 0) {
+        segment_count = workers * shard_count;
+    }
+    // with segmented processing every worker gets its share of the cores
+    const size_t worker_cores = workers > 1 ? std::max(1u, std::thread::hardware_concurrency() / workers) : 0;
+    const ThreadBudget budget = plan_thread_budget(worker_cores, decode_threads, cpu_threads, encode_threads, backend == "cpu");
+    LOG_INFO("Thread budget: " << budget.decode_threads << " decoding, "
+        << (backend == "cpu" ? std::to_string(budget.compute_threads) + " processing, " : std::string())
+        << budget.encode_threads << " encoding" << (workers > 1 ? " per worker" : ""));
+
+    // Collect the encoder settings
+    EncoderOptions encoder_options;
+    encoder_options.preset = preset;
+    encoder_options.speed = speed;
+    encoder_options.crf = crf;
+    encoder_options.threads = budget.encode_threads;
+    encoder_options.row_mt = !no_row_mt;
+    encoder_options.gop_size = gop_size;
+    if (gop_size < 1) {
+        std::cerr << "The keyframe distance must be at least 1.\n";
+        return 1;
+    }
+    if (!bitrate.empty()) {
+        size_t parsed = 0;
+        double value = 0.0;
+        try {
+            value = std::stod(bitrate, &parsed);
+        } catch (const std::exception&) {
+            parsed = 0;
+        }
+        const std::string suffix = bitrate.substr(parsed);
+        const double multiplier = suffix == "k" || suffix == "K" ? 1e3 : suffix == "m" || suffix == "M" ? 1e6 : suffix.empty() ? 1.0 : 0.0;
+        if (parsed == 0 || multiplier == 0.0 || value <= 0.0) {
+            std::cerr << "Invalid bitrate: " << bitrate << ", expected bits per second with an optional k or M suffix.\n";
+            return 1;
+        }
+        encoder_options.bit_rate = static_cast<int64_t>(value * multiplier);
+    }
+    for (const std::string& option : encoder_option_list) {
+        const size_t separator = option.find('=');
+        if (separator == std::string::npos || separator == 0) {
+            std::cerr << "Invalid encoder option: " << option << ", expected key=value.\n";
+            return 1;
+        }
+        encoder_options.extra.emplace_back(option.substr(0, separator), option.substr(separator + 1));
+    }
+
+    // Create the processing backend, the CPU backend does not touch OpenCL at all
+    auto make_processor = [&](int width, int height, size_t compute_threads) -> std::unique_ptr<FrameProcessor> {
+        if (backend == "opencl" && multi_device) {
+            // without a list, the device of OCL_PLATFORM and OCL_DEVICE is partitioned
+            std::vector<cl_device_id> selected = MultiDeviceFrameProcessor::select_devices(
+                devices.empty() ? (std::getenv("OCL_DEVICE") ? std::getenv("OCL_DEVICE") : "0") : devices, partition);
+            return std::make_unique<MultiDeviceFrameProcessor>(std::move(selected), settings, width, height,
+                kernel_file, program_cache == "none" ? "" : program_cache, static_cast<size_t>(device_frames), batch_frame_count);
+        }
+        if (backend == "opencl") {
+            return std::make_unique<OpenCLFrameProcessor>(settings, width, height, kernel_file,
+                program_cache == "none" ? "" : program_cache, static_cast<size_t>(device_frames), batch_frame_count);
+        }
+        return std::make_unique<CpuFrameProcessor>(settings, width, height, compute_threads);
+    };
+
+    FrameLoop loop;
+    loop.yuv_quantization = colorspace == "yuv";
+    loop.pipeline_depth = pipeline_depth;
+    // the segment workers share the collector, it is thread-safe
+    FrameStats stats;
+    if (collect_stats || !stats_csv.empty() || !stats_json.empty()) {
+        loop.stats = &stats;
+    }
+
+    if (!stream.empty()) {
+        // raw frames in and out: no demuxer, decoder, swscale or encoder, the frames keep their size and layout
+        try {
+            RawVideoReader reader(input_file, stream_format, stream_width, stream_height);
+            loop.planar = is_planar_format(stream_format);
+            std::unique_ptr<FrameProcessor> processor = make_processor(reader.get_width(), reader.get_height(), budget.compute_threads);
+            LOG_INFO("Backend: " << processor->name());
+            // the YUV posterization keeps the range of the input, the planar path through RGB writes limited-range samples
+            RawVideoWriter writer(output_file, stream_format, reader.get_width(), reader.get_height(),
+                stream_format == RAW_Y4M ? reader.y4m_parameters(loop.yuv_quantization && reader.is_full_range()) : "");
+            const int64_t frames = process_video(reader, *processor, writer, loop);
+            LOG_INFO("Streaming done, frames: " << frames);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        // stdout may carry the frames, the report goes to stderr with the logs
+        return loop.stats && !report_stats(stats, stats_csv, stats_json, std::cerr) ? 1 : 0;
+    }
+
+    // testing the reading of the video
+    VideoReaderFFMPEG video(input_file, budget.decode_threads);
+
+    // The planar paths need 4:2:0 frames out of the decoder, any other format goes through swscale as usual
+    if (loop.yuv_quantization && !video.has_yuv420_frames()) {
+        std::cerr << "--colorspace yuv needs a YUV 4:2:0 input.\n";
+        return 1;
+    }
+    if (device_yuv && !video.has_yuv420_frames()) {
+        LOG_WARNING("The input is not YUV 4:2:0, --device-yuv is ignored");
+        device_yuv = false;
+    }
+    loop.planar = loop.yuv_quantization || device_yuv;
+    // the planar paths write 4:2:0 planes straight into the encoder frame
+    if (pix_fmt.empty()) {
+        pix_fmt = loop.planar ? "yuv420p" : "yuv444p";
+    }
+    if (pix_fmt == "yuv420p") {
+        encoder_options.pix_fmt = AV_PIX_FMT_YUV420P;
+    } else if (pix_fmt == "yuv444p" && !loop.planar) {
+        encoder_options.pix_fmt = AV_PIX_FMT_YUV444P;
+    } else {
+        std::cerr << "Unsupported pixel format: " << pix_fmt << ", expected yuv420p" << (loop.planar ? "" : " or yuv444p") << ".\n";
+        return 1;
+    }
+
+    if (workers > 1 || !shard.empty()) {
+        // every worker has its own reader, backend and encoder on a keyframe-aligned segment, the segments are then remuxed
+        try {
+            // the plan only depends on the input and the segment count, so every shard derives the same one
+            const std::vector<Segment> plan = plan_segments(scan_keyframes(input_file), segment_count);
+            const std::vector<Segment> segments(plan.begin() + plan.size() * shard_index / shard_count,
+                plan.begin() + plan.size() * (shard_index + 1) / shard_count);
+            LOG_INFO("Segmented processing: " << segments.size() << " of " << plan.size() << " segments on " << workers << " workers");
+            const std::vector<int64_t> frames = run_segments(segments, workers, [&](const Segment& segment) {
+                VideoReaderFFMPEG segment_video(input_file, budget.decode_threads);
+                segment_video.seek_range(segment.start_pts, segment.end_pts);
+                std::unique_ptr<FrameProcessor> segment_processor = make_processor(video.get_width(), video.get_height(), budget.compute_threads);
+                // the writer is closed, and its trailer written, before the segment is handed to the concatenation
+                VideoWriterFFMPEG segment_output(segment_path(output_file, segment.index),
+                    video.get_width(), video.get_height(), video.get_fps(), encoder_options);
+                return process_video(segment_video, *segment_processor, segment_output, loop);
+            });
+            std::vector<SegmentFile> files;
+            int64_t total_frames = 0;
+            for (size_t i = 0; i < segments.size(); i++) {
+                files.push_back(SegmentFile{ segment_path(output_file, segments[i].index), frames[i] });
+                total_frames += frames[i];
+            }
+            if (!shard.empty()) {
+                SegmentManifest manifest;
+                manifest.input = input_file;
+                manifest.fps = video.get_fps();
+                manifest.time_base = video.get_time_base();
+                manifest.segment_count = static_cast<int>(plan.size());
+                manifest.shard = shard_index;
+                manifest.shard_count = shard_count;
+                manifest.segments = segments;
+                manifest.files = files;
+                const std::string manifest_file = manifest_path(output_file, shard_index, shard_count);
+                write_manifest(manifest_file, manifest);
+                LOG_INFO("Shard " << shard_index << "/" << shard_count << " done, frames: " << total_frames
+                    << ", manifest: " << manifest_file);
+                return loop.stats && !report_stats(stats, stats_csv, stats_json) ? 1 : 0;
+            }
+            concat_segments(files, output_file, video.get_fps());
+            if (!keep_segments) {
+                for (const SegmentFile& file : files) {
+                    std::remove(file.path.c_str());
+                }
+            }
+            LOG_INFO("Segmented processing done, frames: " << total_frames);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return 1;
+        }
+        return loop.stats && !report_stats(stats, stats_csv, stats_json) ? 1 : 0;
+    }
+
+    // the device list and the partition are only checked against the platforms here
+    try {
+        std::unique_ptr<FrameProcessor> processor = make_processor(video.get_width(), video.get_height(), budget.compute_threads);
+        LOG_INFO("Backend: " << processor->name());
+        VideoWriterFFMPEG videoOutput(output_file, video.get_width(), video.get_height(), video.get_fps(), encoder_options);
+        process_video(video, *processor, videoOutput, loop);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return loop.stats && !report_stats(stats, stats_csv, stats_json) ? 1 : 0;
+}
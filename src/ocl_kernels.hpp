@@ -0,0 +1,118 @@
+/**
+ * @file ocl_kernels.hpp
+ * @brief Launch helpers of the kernels in uniformQuantization.cl, shared by the OpenCL backend and the benchmark.
+ *
+ * Every helper sets the arguments of the kernel, enqueues it on the queue without waiting for it and
+ * returns the event of the command, which the caller waits for and releases.
+ */
+#pragma once
+
+#include "ocl_utility.hpp"
+
+/**
+ * @brief Swaps the channels of a BGRA frame into RGBA, one work item per pixel.
+ */
+cl_event brga_to_rgba(cl_command_queue queue, cl_kernel bgra_to_rgba_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer);
+
+/**
+ * @brief Converts an RGBA frame to grayscale, one work item per pixel on a 2D range.
+ * Any kernel taking (input, output, width, height) on a 2D range can be launched with it,
+ * e.g. rgba_to_yuv, bgra_to_yuv or uniform_quantize_binary_threshold.
+ */
+cl_event rgba_to_grayscale(cl_command_queue queue, cl_kernel rgba_to_grayscale_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer);
+
+/**
+ * @brief Quantizes an RGBA frame with one of the uniform_quantize_* kernels, one work item per pixel on a 2D range.
+ */
+cl_event uniform_quantize(cl_command_queue queue, cl_kernel uniform_quantize_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, int levels);
+
+/**
+ * @brief Channel swap, grayscale and quantization of a BGRA frame in a single pass.
+ */
+cl_event bgra_quantize_fused(cl_command_queue queue, cl_kernel fused_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode);
+
+/**
+ * @brief Channel swap, grayscale and lookup table of a BGRA frame in a single pass.
+ */
+cl_event bgra_lut_fused(cl_command_queue queue, cl_kernel lut_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int grayscale, cl_mem lut_buffer);
+
+/**
+ * @brief Channel swap, grayscale and quantization of a batch of BGRA frames packed one after the other, in a single launch
+ * on a 3D (x, y, frame) range.
+ */
+cl_event bgra_quantize_fused_batch(cl_command_queue queue, cl_kernel fused_batch_kernel, cl_int width, cl_int height, cl_int frames,
+    size_t lws_in, cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode);
+
+/**
+ * @brief Channel swap, grayscale and lookup table of a batch of BGRA frames in a single launch, like bgra_quantize_fused_batch().
+ */
+cl_event bgra_lut_fused_batch(cl_command_queue queue, cl_kernel lut_batch_kernel, cl_int width, cl_int height, cl_int frames,
+    size_t lws_in, cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int grayscale, cl_mem lut_buffer);
+
+/**
+ * @brief Runs bgra_color_histogram or bgra_color_signature, which share their arguments.
+ * The kernels loop over the frame, so the global size only depends on the device.
+ */
+cl_event bgra_color_count(cl_command_queue queue, cl_kernel count_kernel, cl_int width, cl_int height,
+    size_t lws, size_t gws, cl_mem input_image_buffer, cl_mem counts_buffer);
+
+/**
+ * @brief Adds the sampled pixels of a frame to the k-means sums of the palette entries.
+ */
+cl_event bgra_palette_accumulate(cl_command_queue queue, cl_kernel accumulate_kernel, cl_int width, cl_int height,
+    size_t lws, size_t gws, cl_mem input_image_buffer, cl_mem palette_buffer, cl_int palette_size, cl_mem sums_buffer);
+
+/**
+ * @brief Maps every pixel to its nearest palette entry, searching the whole palette.
+ */
+cl_event bgra_palette_map(cl_command_queue queue, cl_kernel palette_map_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_mem palette_buffer, cl_int palette_size);
+
+/**
+ * @brief Builds the candidate lists of the palette cube, one work item per cell.
+ */
+cl_event build_palette_cube(cl_command_queue queue, cl_kernel cube_kernel, size_t lws_in,
+    cl_mem palette_buffer, cl_int palette_size, cl_mem cube_buffer);
+
+/**
+ * @brief Maps every pixel to its nearest palette entry through the palette cube.
+ */
+cl_event bgra_palette_map_cube(cl_command_queue queue, cl_kernel map_cube_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_mem palette_buffer, cl_int palette_size, cl_mem cube_buffer);
+
+/**
+ * @brief Quantizes a BGRA frame with ordered dithering.
+ */
+cl_event bgra_dither_ordered(cl_command_queue queue, cl_kernel dither_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode,
+    cl_mem matrix_buffer, cl_int matrix_bits);
+
+/**
+ * @brief Quantizes a batch of BGRA frames with ordered dithering in a single launch, like bgra_quantize_fused_batch().
+ */
+cl_event bgra_dither_ordered_batch(cl_command_queue queue, cl_kernel dither_batch_kernel, cl_int width, cl_int height, cl_int frames,
+    size_t lws_in, cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode,
+    cl_mem matrix_buffer, cl_int matrix_bits);
+
+/**
+ * @brief Quantizes a BGRA frame with error diffusion, one work group per tile.
+ */
+cl_event bgra_dither_error_diffusion(cl_command_queue queue, cl_kernel diffusion_kernel, cl_int width, cl_int height,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode);
+
+/**
+ * @brief Converts a packed YUV 4:2:0 frame to RGB, quantizes it and converts it back, one work item per chroma sample.
+ */
+cl_event yuv420p_quantize_fused(cl_command_queue queue, cl_kernel yuv420_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem input_image_buffer, cl_mem output_image_buffer, cl_int levels, cl_int grayscale, cl_int mode, cl_int full_range);
+
+/**
+ * @brief Quantizes the planes of a packed YUV 4:2:0 frame in place, one work item per sample.
+ */
+cl_event yuv420p_quantize_planes(cl_command_queue queue, cl_kernel planes_kernel, cl_int width, cl_int height, size_t lws_in,
+    cl_mem image_buffer, cl_int luma_levels, cl_int chroma_levels, cl_int grayscale, cl_int mode);
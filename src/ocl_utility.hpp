@@ -19,8 +19,9 @@
 #include <CL/cl.h>
 #endif
 
+#include "Log.hpp"
+
 #include <cstdlib>
-#include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
@@ -44,7 +45,8 @@ namespace ocl {
             vsnprintf(buffer, BUFSIZE, msg, args);
             va_end(args);
             buffer[BUFSIZE] = '\0';
-            std::cerr << buffer << " - error " << err << std::endl;
+            LOG_ERROR(buffer << " - error " << err);
+            // the log sink is drained by the static destructors that std::exit runs
             std::exit(EXIT_FAILURE);
         }
     }
@@ -63,43 +65,70 @@ namespace ocl {
         cl_uint index = (env && env[0] != '\0') ? std::atoi(env) : 0;
 
         if (index >= n_platforms) {
-            std::cerr << "Invalid platform index: " << index << std::endl;
+            LOG_ERROR("Invalid platform index: " << index);
             std::exit(EXIT_FAILURE);
         }
 
         char name[BUFSIZE];
         check(clGetPlatformInfo(platforms[index], CL_PLATFORM_NAME, BUFSIZE, name, nullptr), "Getting platform name");
-        std::cout << "Selected platform " << index << ": " << name << std::endl;
+        LOG_INFO("Selected platform " << index << ": " << name);
 
         return platforms[index];
     }
 
     /**
-     * @brief Selects an OpenCL device, optionally via the OCL_DEVICE environment variable.
-     * @param platform The OpenCL platform to search devices on.
-     * @return The selected cl_device_id.
+     * @brief Gets every device of a platform.
+     * @param platform The OpenCL platform.
+     * @return The devices, in the order of the OCL_DEVICE indices.
      */
-    inline cl_device_id select_device(cl_platform_id platform) {
+    inline std::vector<cl_device_id> platform_devices(cl_platform_id platform) {
         cl_uint n_devices;
         check(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &n_devices), "Getting device count");
         std::vector<cl_device_id> devices(n_devices);
         check(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, n_devices, devices.data(), nullptr), "Getting devices");
+        return devices;
+    }
+
+    /**
+     * @brief Selects an OpenCL device, optionally via the OCL_DEVICE environment variable.
+     * @param platform The OpenCL platform to search devices on.
+     * @return The selected cl_device_id.
+     */
+    inline cl_device_id select_device(cl_platform_id platform) {
+        const std::vector<cl_device_id> devices = platform_devices(platform);
 
         const char* env = std::getenv("OCL_DEVICE");
         cl_uint index = (env && env[0] != '\0') ? std::atoi(env) : 0;
 
-        if (index >= n_devices) {
-            std::cerr << "Invalid device index: " << index << std::endl;
+        if (index >= devices.size()) {
+            LOG_ERROR("Invalid device index: " << index);
             std::exit(EXIT_FAILURE);
         }
 
         char name[BUFSIZE];
         check(clGetDeviceInfo(devices[index], CL_DEVICE_NAME, BUFSIZE, name, nullptr), "Getting device name");
-        std::cout << "Selected device " << index << ": " << name << std::endl;
+        LOG_INFO("Selected device " << index << ": " << name);
 
         return devices[index];
     }
 
+    /**
+     * @brief Splits a device into sub-devices, e.g. one per NUMA node of a multi-socket CPU.
+     * @param device The device to split.
+     * @param properties The zero-terminated partition properties given to clCreateSubDevices.
+     * @return The sub-devices, to be released with clReleaseDevice, or empty if the device cannot be split that way.
+     */
+    inline std::vector<cl_device_id> create_sub_devices(cl_device_id device, const cl_device_partition_property* properties) {
+        cl_uint n_devices = 0;
+        // partitioning is optional, a device that does not support it is used as a whole
+        if (clCreateSubDevices(device, properties, 0, nullptr, &n_devices) != CL_SUCCESS || n_devices == 0) {
+            return {};
+        }
+        std::vector<cl_device_id> devices(n_devices);
+        check(clCreateSubDevices(device, properties, n_devices, devices.data(), nullptr), "Creating sub-devices");
+        return devices;
+    }
+
     /**
      * @brief Creates an OpenCL context for a single device.
      * @param platform The platform used.
@@ -130,40 +159,88 @@ namespace ocl {
     }
 
     /**
-     * @brief Creates and builds an OpenCL program from a source file.
-     * @param filename The file containing the OpenCL kernel code.
+     * @brief Gets a string property of a device, e.g. CL_DEVICE_NAME or CL_DRIVER_VERSION.
+     * @param device The OpenCL device.
+     * @param param The property.
+     * @return The value of the property.
+     */
+    inline std::string device_string(cl_device_id device, cl_device_info param) {
+        size_t size = 0;
+        check(clGetDeviceInfo(device, param, 0, nullptr, &size), "Getting device property size");
+        std::vector<char> value(size + 1, '\0');
+        check(clGetDeviceInfo(device, param, size, value.data(), nullptr), "Getting device property");
+        return value.data();
+    }
+
+    /**
+     * @brief Logs the build log of a program, as an error when the build failed.
+     * @param program The program that was built.
+     * @param device The device it was built for.
+     * @param err The result of clBuildProgram.
+     */
+    inline void log_build(cl_program program, cl_device_id device, cl_int err) {
+        size_t log_size;
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
+        std::vector<char> log(log_size);
+        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log.data(), nullptr);
+        // the log of a failed build explains the failure, the one of a successful build only holds warnings
+        if (log.size() > 1 && err != CL_SUCCESS) {
+            LOG_ERROR("=== BUILD LOG ===\n" << log.data() << "\n==================");
+        } else if (log.size() > 1) {
+            LOG_DEBUG("=== BUILD LOG ===\n" << log.data() << "\n==================");
+        }
+    }
+
+    /**
+     * @brief Creates and builds an OpenCL program from source code.
+     * @param source The OpenCL kernel code.
      * @param context The OpenCL context.
      * @param device The target device.
+     * @param options The build options, passed as they are.
      * @return A built OpenCL program.
      */
-    inline cl_program create_program(const std::string& filename, cl_context context, cl_device_id device) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Failed to open kernel file: " << filename << std::endl;
-            std::exit(EXIT_FAILURE);
-        }
-
-        std::ostringstream oss;
-        oss << file.rdbuf();
-        std::string source = oss.str();
+    inline cl_program build_program(const std::string& source, cl_context context, cl_device_id device,
+        const std::string& options) {
         const char* src_ptr = source.c_str();
         cl_int err;
 
         cl_program program = clCreateProgramWithSource(context, 1, &src_ptr, nullptr, &err);
         check(err, "Creating program");
 
-        err = clBuildProgram(program, 1, &device, "-I.", nullptr, nullptr);
+        err = clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+        log_build(program, device, err);
+        check(err, "Building program");
+        return program;
+    }
 
-        size_t log_size;
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &log_size);
-        std::vector<char> log(log_size);
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, log_size, log.data(), nullptr);
-        if (!log.empty()) {
-            std::cout << "=== BUILD LOG ===\n" << log.data() << "\n==================\n";
+    /**
+     * @brief Reads an OpenCL source file.
+     * @param filename The file containing the OpenCL kernel code.
+     * @return The content of the file.
+     */
+    inline std::string read_source(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            LOG_ERROR("Failed to open kernel file: " << filename);
+            std::exit(EXIT_FAILURE);
         }
 
-        check(err, "Building program");
-        return program;
+        std::ostringstream oss;
+        oss << file.rdbuf();
+        return oss.str();
+    }
+
+    /**
+     * @brief Creates and builds an OpenCL program from a source file.
+     * @param filename The file containing the OpenCL kernel code.
+     * @param context The OpenCL context.
+     * @param device The target device.
+     * @param options Additional build options, e.g. -D definitions specializing the kernels.
+     * @return A built OpenCL program.
+     */
+    inline cl_program create_program(const std::string& filename, cl_context context, cl_device_id device,
+        const std::string& options = "") {
+        return build_program(read_source(filename), context, device, options.empty() ? "-I." : "-I. " + options);
     }
 
     /**